@@ -0,0 +1,318 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+/*
+ * Frame statistics on the GPU. While enabled, the shader draws into a
+ * half float target, so values above 1 and NaNs or infinities survive, and
+ * that is blitted to the window. Two compute passes then reduce it: each
+ * workgroup bins a 64x64 tile into a luminance histogram in shared memory
+ * and reduces min, max and sum to one partial, which a single workgroup
+ * folds into the result, read back through a readback_ring_t. The pass
+ * reads each pixel once and writes a few hundred bytes.
+ */
+
+#include "gl.h"
+#include "overlay.h"
+#include "readback.h"
+#include "shader.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// The first four are repeated in the shaders.
+#define ANALYSIS_BINS       64
+#define ANALYSIS_EV_MIN     -12     // Histogram range in log2 luminance
+#define ANALYSIS_EV_MAX     4
+#define ANALYSIS_TILE       64      // Pixels per workgroup side, 16x16 invocations with 4x4 pixels each
+#define ANALYSIS_BUFFERS    3
+
+// Matches the std430 Result block of the shaders.
+typedef struct
+{
+    uint32_t histogram[ANALYSIS_BINS];  // Finite pixels by log2 luminance, the outer bins take the rest
+    uint32_t nan_count;                 // Pixels with a NaN in any color channel
+    uint32_t inf_count;                 // Pixels with an infinity and no NaN
+    float min;
+    float max;
+    float sum;
+} analysis_result_t;
+
+typedef struct
+{
+    GLuint reduce_program;
+    GLuint finish_program;
+    GLuint fbo;
+    GLuint texture;             // RGBA16F, what the shader draws into
+    int width;
+    int height;
+    GLuint partials;
+    GLsizeiptr partials_size;
+
+    readback_ring_t ring;
+    int sizes[ANALYSIS_BUFFERS][2];     // Frame size each buffer of the ring was reduced from
+
+    analysis_result_t result;   // Latest results read back
+    int result_width;
+    int result_height;
+    bool valid;
+} analysis_t;
+
+static const char *analysis_header_src =
+    "#version 450 core\n"
+    "#define BINS 64\n"
+    "#define EV_MIN -12.0\n"
+    "#define EV_MAX 4.0\n"
+    "#define TILE 64\n"
+    "layout(std430, binding = 0) buffer Result {\n"
+    "    uint histogram[BINS];\n"
+    "    uint nan_count;\n"
+    "    uint inf_count;\n"
+    "    float min_lum;\n"
+    "    float max_lum;\n"
+    "    float sum;\n"
+    "} result;\n"
+    "layout(std430, binding = 1) buffer Partials {\n"
+    "    vec4 partials[];\n"
+    "};\n"
+    "const float FLT_MAX = 3.402823466e38;\n"
+    "shared vec3 reduction[256];\n"
+    "// Min, max and sum over the workgroup, left in reduction[0].\n"
+    "void reduce(uint i, vec3 v) {\n"
+    "    reduction[i] = v;\n"
+    "    barrier();\n"
+    "    for (uint s = 128u; s > 0u; s >>= 1) {\n"
+    "        if (i < s) {\n"
+    "            vec3 a = reduction[i], b = reduction[i + s];\n"
+    "            reduction[i] = vec3(min(a.x, b.x), max(a.y, b.y), a.z + b.z);\n"
+    "        }\n"
+    "        barrier();\n"
+    "    }\n"
+    "}\n";
+
+static const char *analysis_reduce_src =
+    "layout(local_size_x = 16, local_size_y = 16) in;\n"
+    "layout(binding = 0) uniform sampler2D uFrame;\n"
+    "shared uint bins[BINS];\n"
+    "shared uint nans;\n"
+    "shared uint infs;\n"
+    "uint run_bin = 0u, run = 0u;\n"
+    "// Neighbouring pixels mostly fall in the same bin, runs cut the atomics on shared memory.\n"
+    "void count(uint bin) {\n"
+    "    if (bin != run_bin) {\n"
+    "        if (run != 0u) atomicAdd(bins[run_bin], run);\n"
+    "        run_bin = bin;\n"
+    "        run = 0u;\n"
+    "    }\n"
+    "    run++;\n"
+    "}\n"
+    "void main(void) {\n"
+    "    uint i = gl_LocalInvocationIndex;\n"
+    "    if (i < BINS) bins[i] = 0u;\n"
+    "    if (i == 0u) {\n"
+    "        nans = 0u;\n"
+    "        infs = 0u;\n"
+    "    }\n"
+    "    barrier();\n"
+    "\n"
+    "    // Neighbouring invocations read neighbouring pixels in each step.\n"
+    "    ivec2 size = textureSize(uFrame, 0);\n"
+    "    ivec2 base = ivec2(gl_WorkGroupID.xy)*TILE + ivec2(gl_LocalInvocationID.xy);\n"
+    "    vec3 v = vec3(FLT_MAX, -FLT_MAX, 0.0);\n"
+    "    for (int y = 0; y < TILE; y += 16) {\n"
+    "        for (int x = 0; x < TILE; x += 16) {\n"
+    "            ivec2 p = base + ivec2(x, y);\n"
+    "            if (p.x >= size.x || p.y >= size.y) continue;\n"
+    "            vec3 c = texelFetch(uFrame, p, 0).rgb;\n"
+    "            if (any(isnan(c))) {\n"
+    "                atomicAdd(nans, 1u);\n"
+    "            } else if (any(isinf(c))) {\n"
+    "                atomicAdd(infs, 1u);\n"
+    "            } else {\n"
+    "                float l = dot(c, vec3(0.2126, 0.7152, 0.0722));\n"
+    "                v = vec3(min(v.x, l), max(v.y, l), v.z + l);\n"
+    "                float ev = l > 0.0 ? log2(l) : EV_MIN;\n"
+    "                int bin = int(floor((ev - EV_MIN) * (float(BINS) / (EV_MAX - EV_MIN))));\n"
+    "                count(uint(clamp(bin, 0, BINS - 1)));\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "    if (run != 0u) atomicAdd(bins[run_bin], run);\n"
+    "    reduce(i, v);\n"
+    "\n"
+    "    uint group = gl_WorkGroupID.y*gl_NumWorkGroups.x + gl_WorkGroupID.x;\n"
+    "    if (i == 0u) {\n"
+    "        partials[group] = vec4(reduction[0], 0.0);\n"
+    "        if (nans != 0u) atomicAdd(result.nan_count, nans);\n"
+    "        if (infs != 0u) atomicAdd(result.inf_count, infs);\n"
+    "    }\n"
+    "    if (i < BINS && bins[i] != 0u) atomicAdd(result.histogram[i], bins[i]);\n"
+    "}\n";
+
+static const char *analysis_finish_src =
+    "layout(local_size_x = 256) in;\n"
+    "layout(location = 0) uniform int uNumPartials;\n"
+    "void main(void) {\n"
+    "    uint i = gl_LocalInvocationIndex;\n"
+    "    vec3 v = vec3(FLT_MAX, -FLT_MAX, 0.0);\n"
+    "    for (uint j = i; j < uint(uNumPartials); j += 256u) {\n"
+    "        vec3 p = partials[j].xyz;\n"
+    "        v = vec3(min(v.x, p.x), max(v.y, p.y), v.z + p.z);\n"
+    "    }\n"
+    "    reduce(i, v);\n"
+    "    if (i == 0u) {\n"
+    "        result.min_lum = reduction[0].x;\n"
+    "        result.max_lum = reduction[0].y;\n"
+    "        result.sum = reduction[0].z;\n"
+    "    }\n"
+    "}\n";
+
+static GLuint analysis_program(const char *src)
+{
+    const char *srcs[2] = { analysis_header_src, src };
+    GLuint cs = create_shader(srcs, 2, GL_COMPUTE_SHADER);
+    if (!cs) return 0;
+    GLuint program = link_compute_program(cs);
+    glDeleteShader(cs);
+    return program;
+}
+
+static void analysis_destroy(analysis_t *a)
+{
+    readback_destroy(&a->ring);
+    if (a->partials) glDeleteBuffers(1, &a->partials);
+    if (a->fbo) glDeleteFramebuffers(1, &a->fbo);
+    if (a->texture) glDeleteTextures(1, &a->texture);
+    if (a->reduce_program) glDeleteProgram(a->reduce_program);
+    if (a->finish_program) glDeleteProgram(a->finish_program);
+    memset(a, 0, sizeof *a);
+}
+
+static bool analysis_init(analysis_t *a)
+{
+    memset(a, 0, sizeof *a);
+    a->reduce_program = analysis_program(analysis_reduce_src);
+    a->finish_program = a->reduce_program ? analysis_program(analysis_finish_src) : 0;
+    if (!a->finish_program) {
+        fprintf(stderr, "Analysis shaders failed:\n%.*s\n", (int)array_size(log_buffer), log_buffer ? log_buffer : "");
+        analysis_destroy(a);
+        return false;
+    }
+
+    readback_init(&a->ring, GL_SHADER_STORAGE_BUFFER, ANALYSIS_BUFFERS);
+    glGenBuffers(1, &a->partials);
+    glGenFramebuffers(1, &a->fbo);
+    return true;
+}
+
+// Framebuffer the shader should draw into this frame, resized to the window.
+static GLuint analysis_target(analysis_t *a, int width, int height)
+{
+    if (a->texture && a->width == width && a->height == height) return a->fbo;
+
+    if (a->texture) glDeleteTextures(1, &a->texture);
+    glGenTextures(1, &a->texture);
+    glBindTexture(GL_TEXTURE_2D, a->texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, a->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, a->texture, 0);
+    a->width = width;
+    a->height = height;
+
+    GLsizeiptr partials_size = (GLsizeiptr)(((width + ANALYSIS_TILE - 1) / ANALYSIS_TILE) *
+                                            ((height + ANALYSIS_TILE - 1) / ANALYSIS_TILE) * 4*sizeof(float));
+    if (partials_size > a->partials_size) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, a->partials);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, partials_size, NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        a->partials_size = partials_size;
+    }
+    return a->fbo;
+}
+
+// Keeps the results of a buffer whose fence has signalled.
+static void analysis_collect(void *user, int index, const void *data, GLsizeiptr size)
+{
+    (void)size;
+    analysis_t *a = user;
+    memcpy(&a->result, data, sizeof a->result);
+    a->result_width = a->sizes[index][0];
+    a->result_height = a->sizes[index][1];
+    a->valid = true;
+}
+
+/*
+ * Reduces what was drawn into the target since analysis_target() and
+ * blits it to framebuffer, which is left bound.
+ */
+static void analysis_run(analysis_t *a, GLuint framebuffer)
+{
+    readback_collect(&a->ring, analysis_collect, a);
+    int index = readback_begin(&a->ring, sizeof(analysis_result_t));
+    if (index >= 0) {
+        int groups_x = (a->width + ANALYSIS_TILE - 1) / ANALYSIS_TILE;
+        int groups_y = (a->height + ANALYSIS_TILE - 1) / ANALYSIS_TILE;
+
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, a->ring.buffers[index]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, a->partials);
+        glBindTexture(GL_TEXTURE_2D, a->texture);
+
+        glUseProgram(a->reduce_program);
+        glDispatchCompute((GLuint)groups_x, (GLuint)groups_y, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUseProgram(a->finish_program);
+        glUniform1i(0, groups_x*groups_y);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        readback_end(&a->ring);
+        a->sizes[index][0] = a->width;
+        a->sizes[index][1] = a->height;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, a->fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    glBlitFramebuffer(0, 0, a->width, a->height, 0, 0, a->width, a->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+// Pixels the mean was taken over.
+static inline uint64_t analysis_finite(const analysis_result_t *r, int width, int height)
+{
+    return (uint64_t)width*(uint64_t)height - r->nan_count - r->inf_count;
+}
+
+static int analysis_format(const analysis_t *a, char *buf, size_t size)
+{
+    const analysis_result_t *r = &a->result;
+    uint64_t n = analysis_finite(r, a->result_width, a->result_height);
+    return snprintf(buf, size, "min=%.4g max=%.4g mean=%.4g nan=%u inf=%u",
+                    n ? r->min : 0.0, n ? r->max : 0.0, n ? r->sum / (double)n : 0.0,
+                    r->nan_count, r->inf_count);
+}
+
+// Histogram bars in r, bins above 1.0 in orange.
+static void analysis_push_histogram(const analysis_t *a, rect_t r)
+{
+    const analysis_result_t *res = &a->result;
+    uint32_t peak = 1;
+    for (int i = 0; i < ANALYSIS_BINS; i++)
+        if (res->histogram[i] > peak) peak = res->histogram[i];
+
+    int first_bright = -ANALYSIS_EV_MIN*ANALYSIS_BINS / (ANALYSIS_EV_MAX - ANALYSIS_EV_MIN);
+    float w = r.w / ANALYSIS_BINS;
+    push_quad(r, make_rect(-1, -1, -1, -1), 0x7F);
+    for (int i = 0; i < ANALYSIS_BINS; i++) {
+        if (!res->histogram[i]) continue;
+        float h = r.h*(float)res->histogram[i] / (float)peak;
+        push_quad(make_rect(r.x + (float)i*w, r.y + r.h - h, w, h), make_rect(-1, -1, -1, -1),
+                  i < first_bright ? 0xD0D0D0FF : 0xFF9030FF);
+    }
+}
+
+#endif
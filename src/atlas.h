@@ -0,0 +1,460 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+/*
+ * Runtime fonts. A font file is opened with FreeType and glyphs are
+ * rasterized the first time they are drawn, into an atlas texture of fixed
+ * size, so startup does no rasterizing and GPU memory is bounded whatever
+ * the text. The atlas is split into horizontal bands, each packed with a
+ * skyline: a glyph goes where its top edge ends up lowest. When no band has
+ * room, the band drawn from least recently is emptied and reused. Bands
+ * with glyphs drawn in the current frame are never evicted, so the quads
+ * already built stay valid. Glyphs are rasterized into a CPU copy of the
+ * atlas and the rectangle covering what changed is uploaded once a frame.
+ * Glyphs are stored as distance fields at FONT_SDF_SIZE whatever the size
+ * text is drawn at, so the atlas holds a glyph once for every size.
+ */
+
+#include "font.h"
+#include "gl.h"
+#include "memory.h"
+#include "overlay.h"
+#include "sdf.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#define ATLAS_SIZE          1024
+#define ATLAS_BANDS         8
+#define ATLAS_BAND_HEIGHT   (ATLAS_SIZE / ATLAS_BANDS)
+#define ATLAS_PADDING       1       // Empty texels around each glyph, keeps linear filtering from bleeding
+#define ATLAS_SDF_PADDING   6       // Texels of distance around each glyph's outline
+#define FONT_SDF_SIZE       32      // Pixel size glyphs are rasterized at
+#define ATLAS_MAX_NODES     256     // Skyline segments per band
+#define FONT_MIN_SIZE       6
+#define FONT_MAX_SIZE       96
+#define FONT_DEFAULT_SIZE   14
+#define UTF8_REPLACEMENT    0xFFFD
+
+typedef struct
+{
+    int x;
+    int y;      // Lowest free row above the segment
+    int width;
+} skyline_node_t;
+
+typedef struct
+{
+    skyline_node_t nodes[ATLAS_MAX_NODES];
+    int num_nodes;
+    uint64_t last_used;
+} atlas_band_t;
+
+typedef struct
+{
+    uint32_t key;       // Codepoint + 1, 0 for a free entry
+    int band;           // -1 for glyphs without pixels, like spaces
+    glyph_t glyph;
+} atlas_glyph_t;
+
+typedef struct
+{
+    FT_Library library;
+    FT_Face face;
+    float line_height;          // In drawn pixels
+    float scale;                // Drawn pixels per atlas texel
+    uint8_t *pixels;            // CPU copy of the atlas
+    uint8_t *coverage;          // Rendered glyph before its distance field is taken
+    GLuint texture;
+    atlas_band_t bands[ATLAS_BANDS];
+    atlas_glyph_t *glyphs;      // Open addressing on the codepoint
+    uint32_t glyph_cap;         // Power of two
+    uint32_t num_glyphs;
+    int dirty_x0, dirty_y0, dirty_x1, dirty_y1;   // Changed since the last upload, empty if x0 >= x1
+    uint64_t frame;
+} font_atlas_t;
+
+/*
+ * Decodes the UTF-8 sequence at *s and advances past it. Malformed,
+ * overlong and surrogate sequences decode to U+FFFD one byte at a time.
+ */
+static uint32_t utf8_next(const unsigned char **s, const unsigned char *end)
+{
+    const unsigned char *p = *s;
+    uint32_t c = *p++;
+    if (c < 0x80) {
+        *s = p;
+        return c;
+    }
+    int n = c < 0xC2 ? -1 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : c < 0xF5 ? 3 : -1;
+    if (n < 0 || end - p < n) {
+        *s += 1;
+        return UTF8_REPLACEMENT;
+    }
+
+    c &= 0x3F >> n;
+    for (int i = 0; i < n; i++, p++) {
+        if ((*p & 0xC0) != 0x80) {
+            *s += 1;
+            return UTF8_REPLACEMENT;
+        }
+        c = c << 6 | (*p & 0x3F);
+    }
+    static const uint32_t min[4] = { 0, 0x80, 0x800, 0x10000 };
+    if (c < min[n] || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+        *s += 1;
+        return UTF8_REPLACEMENT;
+    }
+    *s = p;
+    return c;
+}
+
+static void atlas_mark_dirty(font_atlas_t *a, int x0, int y0, int x1, int y1)
+{
+    if (a->dirty_x0 >= a->dirty_x1) {
+        a->dirty_x0 = x0;
+        a->dirty_y0 = y0;
+        a->dirty_x1 = x1;
+        a->dirty_y1 = y1;
+        return;
+    }
+    if (x0 < a->dirty_x0) a->dirty_x0 = x0;
+    if (y0 < a->dirty_y0) a->dirty_y0 = y0;
+    if (x1 > a->dirty_x1) a->dirty_x1 = x1;
+    if (y1 > a->dirty_y1) a->dirty_y1 = y1;
+}
+
+static void skyline_reset(atlas_band_t *b)
+{
+    b->nodes[0] = (skyline_node_t){ 0, 0, ATLAS_SIZE };
+    b->num_nodes = 1;
+}
+
+// Row a w*h rectangle starting at node i would be placed at, -1 if it does not fit there.
+static int skyline_fit(const atlas_band_t *b, int i, int w, int h)
+{
+    if (b->nodes[i].x + w > ATLAS_SIZE) return -1;
+    int y = 0;
+    for (int left = w; left > 0; left -= b->nodes[i++].width) {
+        if (b->nodes[i].y > y) y = b->nodes[i].y;
+        if (y + h > ATLAS_BAND_HEIGHT) return -1;
+    }
+    return y;
+}
+
+// Places a w*h rectangle at the position leaving the lowest top edge, ties broken by the narrower segment.
+static bool skyline_pack(atlas_band_t *b, int w, int h, int *x, int *y)
+{
+    int best = -1, best_top = INT32_MAX, best_width = INT32_MAX;
+    for (int i = 0; i < b->num_nodes; i++) {
+        int top = skyline_fit(b, i, w, h);
+        if (top < 0) continue;
+        if (top + h < best_top || (top + h == best_top && b->nodes[i].width < best_width)) {
+            best = i;
+            best_top = top + h;
+            best_width = b->nodes[i].width;
+        }
+    }
+    if (best < 0 || b->num_nodes == ATLAS_MAX_NODES) return false;
+
+    *x = b->nodes[best].x;
+    *y = best_top - h;
+    memmove(&b->nodes[best+1], &b->nodes[best], (size_t)(b->num_nodes - best)*sizeof *b->nodes);
+    b->nodes[best] = (skyline_node_t){ *x, best_top, w };
+    b->num_nodes++;
+
+    // Trim or drop the segments now under the new one.
+    int right = *x + w;
+    int i = best + 1;
+    while (i < b->num_nodes && b->nodes[i].x < right) {
+        skyline_node_t *n = &b->nodes[i];
+        if (n->x + n->width <= right) {
+            memmove(n, n + 1, (size_t)(b->num_nodes - i - 1)*sizeof *n);
+            b->num_nodes--;
+            continue;
+        }
+        n->width -= right - n->x;
+        n->x = right;
+        break;
+    }
+
+    for (i = 0; i + 1 < b->num_nodes; ) {
+        if (b->nodes[i].y == b->nodes[i+1].y) {
+            b->nodes[i].width += b->nodes[i+1].width;
+            memmove(&b->nodes[i+1], &b->nodes[i+2], (size_t)(b->num_nodes - i - 2)*sizeof *b->nodes);
+            b->num_nodes--;
+        } else {
+            i++;
+        }
+    }
+    return true;
+}
+
+static inline uint32_t atlas_hash(uint32_t key, uint32_t cap)
+{
+    return (key*2654435761u) & (cap - 1);
+}
+
+static void atlas_table_insert(atlas_glyph_t *table, uint32_t cap, const atlas_glyph_t *g)
+{
+    uint32_t i = atlas_hash(g->key, cap);
+    while (table[i].key)
+        i = (i + 1) & (cap - 1);
+    table[i] = *g;
+}
+
+// Rebuilds the glyph table with the given capacity, leaving out the glyphs in band drop.
+static void atlas_rehash(font_atlas_t *a, uint32_t cap, int drop)
+{
+    atlas_glyph_t *table = xmalloc(cap*sizeof *table);
+    memset(table, 0, cap*sizeof *table);
+    a->num_glyphs = 0;
+    for (uint32_t i = 0; i < a->glyph_cap; i++) {
+        if (!a->glyphs[i].key || (drop >= 0 && a->glyphs[i].band == drop)) continue;
+        atlas_table_insert(table, cap, &a->glyphs[i]);
+        a->num_glyphs++;
+    }
+    free(a->glyphs);
+    a->glyphs = table;
+    a->glyph_cap = cap;
+}
+
+// Empties the least recently used band not drawn from this frame. Returns it, or -1 if every band is in use.
+static int atlas_evict(font_atlas_t *a)
+{
+    int band = -1;
+    for (int i = 0; i < ATLAS_BANDS; i++) {
+        if (a->bands[i].last_used == a->frame) continue;
+        if (band < 0 || a->bands[i].last_used < a->bands[band].last_used) band = i;
+    }
+    if (band < 0) return -1;
+
+    int y0 = band*ATLAS_BAND_HEIGHT;
+    memset(a->pixels + (size_t)y0*ATLAS_SIZE, 0, (size_t)ATLAS_BAND_HEIGHT*ATLAS_SIZE);
+    atlas_mark_dirty(a, 0, y0, ATLAS_SIZE, y0 + ATLAS_BAND_HEIGHT);
+    skyline_reset(&a->bands[band]);
+    atlas_rehash(a, a->glyph_cap, band);
+    return band;
+}
+
+// Copies a rendered FreeType bitmap to dst, expanding 1 bit bitmaps from bitmap fonts.
+static void atlas_copy_bitmap(const FT_Bitmap *bm, uint8_t *dst_pixels, int stride)
+{
+    for (unsigned row = 0; row < bm->rows; row++) {
+        const uint8_t *src = bm->buffer + (ptrdiff_t)row*bm->pitch;
+        uint8_t *dst = dst_pixels + (size_t)row*(size_t)stride;
+        if (bm->pixel_mode == FT_PIXEL_MODE_MONO) {
+            for (unsigned col = 0; col < bm->width; col++)
+                dst[col] = (src[col >> 3] >> (7 - (col & 7))) & 1 ? 0xFF : 0x00;
+        } else {
+            memcpy(dst, src, bm->width);
+        }
+    }
+}
+
+/*
+ * Rasterizes a glyph into g and the atlas. Returns false if it should not be
+ * cached: the atlas is full for now, or the glyph does not fit at all.
+ */
+static bool atlas_rasterize(font_atlas_t *a, uint32_t codepoint, atlas_glyph_t *g)
+{
+    *g = (atlas_glyph_t){ .key = codepoint + 1, .band = -1 };
+    if (FT_Load_Char(a->face, codepoint, FT_LOAD_RENDER)) return true;
+
+    FT_GlyphSlot slot = a->face->glyph;
+    const FT_Bitmap *bm = &slot->bitmap;
+    g->glyph.advance_x = (float)slot->advance.x / 64.0f;
+    g->glyph.offset_x = slot->bitmap_left - ATLAS_SDF_PADDING;
+    g->glyph.offset_y = slot->bitmap_top + ATLAS_SDF_PADDING;
+    if (!bm->width || !bm->rows) return true;
+    if (bm->pixel_mode != FT_PIXEL_MODE_GRAY && bm->pixel_mode != FT_PIXEL_MODE_MONO) return true;
+
+    // The quad takes in the padding, the distance field reaches out into it.
+    int gw = (int)bm->width + 2*ATLAS_SDF_PADDING, gh = (int)bm->rows + 2*ATLAS_SDF_PADDING;
+    int w = gw + 2*ATLAS_PADDING, h = gh + 2*ATLAS_PADDING;
+    if (w > ATLAS_SIZE || h > ATLAS_BAND_HEIGHT) return false;
+
+    int band, x = 0, y = 0;
+    for (band = 0; band < ATLAS_BANDS; band++)
+        if (skyline_pack(&a->bands[band], w, h, &x, &y)) break;
+    if (band == ATLAS_BANDS) {
+        band = atlas_evict(a);
+        if (band < 0 || !skyline_pack(&a->bands[band], w, h, &x, &y)) return false;
+    }
+
+    x += ATLAS_PADDING;
+    y += band*ATLAS_BAND_HEIGHT + ATLAS_PADDING;
+    atlas_copy_bitmap(bm, a->coverage, (int)bm->width);
+    sdf_generate(a->coverage, (int)bm->width, (int)bm->rows, (int)bm->width, ATLAS_SDF_PADDING,
+                 a->pixels + (size_t)y*ATLAS_SIZE + (size_t)x, ATLAS_SIZE);
+    atlas_mark_dirty(a, x, y, x + gw, y + gh);
+
+    g->band = band;
+    g->glyph.width = gw;
+    g->glyph.height = gh;
+    g->glyph.uv = make_rect((float)x / ATLAS_SIZE, (float)y / ATLAS_SIZE,
+                            (float)gw / ATLAS_SIZE, (float)gh / ATLAS_SIZE);
+    return true;
+}
+
+static atlas_glyph_t *atlas_find(font_atlas_t *a, uint32_t codepoint)
+{
+    uint32_t key = codepoint + 1;
+    for (uint32_t i = atlas_hash(key, a->glyph_cap); a->glyphs[i].key; i = (i + 1) & (a->glyph_cap - 1))
+        if (a->glyphs[i].key == key) return &a->glyphs[i];
+    return NULL;
+}
+
+// Returns the glyph of a codepoint, rasterizing it on first use.
+static const glyph_t *font_atlas_glyph(font_atlas_t *a, uint32_t codepoint)
+{
+    atlas_glyph_t *e = atlas_find(a, codepoint);
+    if (!e) {
+        // Codepoints missing from the font draw its .notdef glyph, codepoint 0. They are
+        // not cached themselves, which keeps the table bounded by what the atlas holds.
+        if (codepoint && !FT_Get_Char_Index(a->face, codepoint))
+            return font_atlas_glyph(a, 0);
+
+        atlas_glyph_t g;
+        if (!atlas_rasterize(a, codepoint, &g)) {
+            // Drawn without pixels this time, the atlas has no room for it.
+            static atlas_glyph_t uncached;
+            uncached = g;
+            uncached.glyph.width = uncached.glyph.height = 0;
+            return &uncached.glyph;
+        }
+
+        // Keep the table at most half full.
+        if ((a->num_glyphs + 1)*2 > a->glyph_cap)
+            atlas_rehash(a, a->glyph_cap*2, -1);
+        atlas_table_insert(a->glyphs, a->glyph_cap, &g);
+        a->num_glyphs++;
+        e = atlas_find(a, codepoint);
+    }
+    if (e->band >= 0) a->bands[e->band].last_used = a->frame;
+    return &e->glyph;
+}
+
+static void font_atlas_destroy(font_atlas_t *a)
+{
+    if (a->texture) glDeleteTextures(1, &a->texture);
+    if (a->face) FT_Done_Face(a->face);
+    if (a->library) FT_Done_FreeType(a->library);
+    free(a->pixels);
+    free(a->coverage);
+    free(a->glyphs);
+    memset(a, 0, sizeof *a);
+}
+
+/*
+ * Opens a font file to be drawn at the given pixel size and creates the
+ * atlas texture. Outlines are rasterized at FONT_SDF_SIZE and scaled, fonts
+ * without outlines use the bitmap size closest to the one drawn.
+ */
+static bool font_atlas_init(font_atlas_t *a, const char *path, int size)
+{
+    memset(a, 0, sizeof *a);
+    if (FT_Init_FreeType(&a->library)) {
+        fprintf(stderr, "Could not initialize FreeType.\n");
+        return false;
+    }
+    if (FT_New_Face(a->library, path, 0, &a->face)) {
+        fprintf(stderr, "%s: Could not load font.\n", path);
+        font_atlas_destroy(a);
+        return false;
+    }
+    FT_Select_Charmap(a->face, FT_ENCODING_UNICODE);
+
+    FT_Error error;
+    if (FT_IS_SCALABLE(a->face) || !a->face->num_fixed_sizes) {
+        error = FT_Set_Pixel_Sizes(a->face, 0, FONT_SDF_SIZE);
+    } else {
+        int best = 0;
+        for (int i = 1; i < a->face->num_fixed_sizes; i++)
+            if (abs(a->face->available_sizes[i].height - size) < abs(a->face->available_sizes[best].height - size))
+                best = i;
+        error = FT_Select_Size(a->face, best);
+    }
+    if (error) {
+        fprintf(stderr, "%s: Font has no size %d.\n", path, size);
+        font_atlas_destroy(a);
+        return false;
+    }
+    // Strikes without a nominal size are drawn as they are.
+    FT_UShort ppem = a->face->size->metrics.y_ppem;
+    a->scale = ppem ? (float)size / (float)ppem : 1.0f;
+    a->line_height = (float)a->face->size->metrics.height / 64.0f * a->scale;
+
+    a->pixels = xmalloc((size_t)ATLAS_SIZE*ATLAS_SIZE);
+    memset(a->pixels, 0, (size_t)ATLAS_SIZE*ATLAS_SIZE);
+    a->coverage = xmalloc((size_t)ATLAS_SIZE*ATLAS_BAND_HEIGHT);
+    a->glyph_cap = 256;
+    a->glyphs = xmalloc(a->glyph_cap*sizeof *a->glyphs);
+    memset(a->glyphs, 0, a->glyph_cap*sizeof *a->glyphs);
+    for (int i = 0; i < ATLAS_BANDS; i++)
+        skyline_reset(&a->bands[i]);
+    // Frame 0 marks bands as never used.
+    a->frame = 1;
+
+    glGenTextures(1, &a->texture);
+    glBindTexture(GL_TEXTURE_2D, a->texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, ATLAS_SIZE, ATLAS_SIZE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    atlas_mark_dirty(a, 0, 0, ATLAS_SIZE, ATLAS_SIZE);
+    return true;
+}
+
+// Uploads the part of the atlas that changed and starts the next frame.
+static void font_atlas_flush(font_atlas_t *a)
+{
+    if (a->dirty_x0 < a->dirty_x1) {
+        glBindTexture(GL_TEXTURE_2D, a->texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, ATLAS_SIZE);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, a->dirty_x0, a->dirty_y0, a->dirty_x1 - a->dirty_x0,
+                        a->dirty_y1 - a->dirty_y0, GL_RED, GL_UNSIGNED_BYTE,
+                        a->pixels + (size_t)a->dirty_y0*ATLAS_SIZE + (size_t)a->dirty_x0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        a->dirty_x0 = a->dirty_x1 = 0;
+    }
+    a->frame++;
+}
+
+// Lays out UTF-8 text like push_text(), with the font's line height and scaled to its size.
+static void font_atlas_push_text(font_atlas_t *a, const char *str, size_t len, float x, float y)
+{
+    if (!len) return;
+
+    // Every codepoint takes at least a byte, unused quads are given back at the end.
+    overlay_quad_t *q = array_reserve(quad_buffer, len);
+    overlay_quad_t *start = q;
+    const unsigned char *s = (const unsigned char *)str, *end = s + len;
+    float orig_x = x;
+    while (s < end) {
+        uint32_t c = utf8_next(&s, end);
+        if (c == '\n') {
+            y += a->line_height;
+            x = orig_x;
+            continue;
+        }
+
+        const glyph_t *g = font_atlas_glyph(a, c);
+        if (g->width) {
+            float s = a->scale;
+            rect_t r = make_rect(x+(float)g->offset_x*s, y-(float)g->offset_y*s, (float)g->width*s, (float)g->height*s);
+            *q++ = make_quad(r, g->uv, 0xFFFFFFFF);
+        }
+        x += g->advance_x*a->scale;
+    }
+    array_header(quad_buffer)->size -= len - (size_t)(q - start);
+}
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+/*
+ * Audio input for iChannel0, laid out like Shadertoy's music channel: a
+ * 512x2 texture with the spectrum in the first row and the waveform in the
+ * second. A PCM WAV file is streamed from disk in chunks by a worker thread,
+ * which windows the AUDIO_FFT_SIZE samples ending at the requested time and
+ * transforms them. Nothing is played, so no audio device is needed.
+ *
+ * The render loop only swaps the latest result in and asks for the next
+ * frame's time, so by the time that frame is drawn its spectrum is usually
+ * ready. Every result depends only on the time it was made for, there is no
+ * smoothing across frames, so recordings come out the same at any rate.
+ */
+
+#include "fft.h"
+#include "gl.h"
+#include "memory.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define AUDIO_FFT_SIZE      2048
+#define AUDIO_WIDTH         512         // Texels per row, the spectrum keeps the lowest bins
+#define AUDIO_CHUNK_FRAMES  65536       // Sample frames read from disk at once
+#define AUDIO_MIN_DB        -100.0f     // Spectrum range mapped to 0..255, as in Web Audio
+#define AUDIO_MAX_DB        -30.0f
+
+typedef struct
+{
+    int fd;
+    int channels;
+    int sample_rate;
+    int bits;
+    bool is_float;
+    int block_align;            // Bytes per sample frame
+    off_t data_offset;
+    int64_t num_frames;
+
+    // Worker side: the chunk of mono samples in memory and the transform.
+    float *chunk;
+    uint8_t *raw;
+    int64_t chunk_start;
+    int chunk_frames;
+    fft_t fft;
+    float window[AUDIO_FFT_SIZE];
+    float re[AUDIO_FFT_SIZE];
+    float im[AUDIO_FFT_SIZE];
+
+    pthread_t thread;
+    bool thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    double request_time;
+    uint64_t request;           // Bumped for every new request
+    uint64_t done;              // Request the result belongs to
+    uint8_t result[2*AUDIO_WIDTH];
+    bool quit;
+
+    GLuint texture;
+    uint64_t uploaded;
+} audio_t;
+
+static inline uint16_t audio_u16(const uint8_t *p) { return (uint16_t)(p[0] | p[1] << 8); }
+static inline uint32_t audio_u32(const uint8_t *p) { return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24; }
+
+// Reads the fmt chunk and finds the data chunk. Only the headers are read.
+static bool audio_parse(audio_t *a, const char *path)
+{
+    struct stat st;
+    uint8_t hdr[40];
+    if (fstat(a->fd, &st) || pread(a->fd, hdr, 12, 0) != 12 ||
+        memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) {
+        fprintf(stderr, "%s: Not a WAV file.\n", path);
+        return false;
+    }
+
+    bool have_fmt = false;
+    off_t pos = 12;
+    while (pos + 8 <= st.st_size) {
+        if (pread(a->fd, hdr, 8, pos) != 8) break;
+        off_t size = audio_u32(hdr + 4);
+        off_t body = pos + 8;
+        if (!memcmp(hdr, "fmt ", 4) && size >= 16) {
+            size_t n = size < (off_t)sizeof hdr ? (size_t)size : sizeof hdr;
+            if (pread(a->fd, hdr, n, body) != (ssize_t)n) break;
+            unsigned format = audio_u16(hdr);
+            // WAVE_FORMAT_EXTENSIBLE keeps the actual format at the start of the sub-format GUID.
+            if (format == 0xFFFE && n >= 26) format = audio_u16(hdr + 24);
+            a->channels = audio_u16(hdr + 2);
+            a->sample_rate = (int)audio_u32(hdr + 4);
+            a->block_align = audio_u16(hdr + 12);
+            a->bits = audio_u16(hdr + 14);
+            a->is_float = format == 3;
+            bool ok = (format == 1 && (a->bits == 8 || a->bits == 16 || a->bits == 24 || a->bits == 32)) ||
+                      (format == 3 && (a->bits == 32 || a->bits == 64));
+            if (!ok || a->channels < 1 || a->sample_rate < 1 || a->block_align < a->channels*a->bits/8) {
+                fprintf(stderr, "%s: Only PCM and float WAV files are supported.\n", path);
+                return false;
+            }
+            have_fmt = true;
+        } else if (!memcmp(hdr, "data", 4) && have_fmt) {
+            // Streamed files may not know their length, the rest of the file is taken then.
+            if (size == 0 || size == 0xFFFFFFFF || body + size > st.st_size) size = st.st_size - body;
+            a->data_offset = body;
+            a->num_frames = size / a->block_align;
+            return true;
+        }
+        pos = body + size + (size & 1);
+    }
+    fprintf(stderr, "%s: No audio data found.\n", path);
+    return false;
+}
+
+// Loads the chunk starting at sample frame start, mixed down to mono.
+static void audio_load_chunk(audio_t *a, int64_t start)
+{
+    int64_t frames = a->num_frames - start;
+    if (frames > AUDIO_CHUNK_FRAMES) frames = AUDIO_CHUNK_FRAMES;
+    size_t bytes = (size_t)frames*(size_t)a->block_align;
+    ssize_t got = pread(a->fd, a->raw, bytes, a->data_offset + (off_t)start*a->block_align);
+    int n = got > 0 ? (int)(got / a->block_align) : 0;
+
+    const int bps = a->bits/8;
+    const float scale = 1.0f / (float)a->channels;
+    for (int i = 0; i < n; i++) {
+        const uint8_t *p = a->raw + (size_t)i*(size_t)a->block_align;
+        float sum = 0.0f;
+        for (int c = 0; c < a->channels; c++, p += bps) {
+            if (a->is_float && a->bits == 32) {
+                float v;
+                memcpy(&v, p, sizeof v);
+                sum += v;
+            } else if (a->is_float) {
+                double v;
+                memcpy(&v, p, sizeof v);
+                sum += (float)v;
+            } else if (a->bits == 8) {
+                sum += (float)(p[0] - 128) / 128.0f;
+            } else if (a->bits == 16) {
+                sum += (float)(int16_t)audio_u16(p) / 32768.0f;
+            } else if (a->bits == 24) {
+                sum += (float)((int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8) / 8388608.0f;
+            } else {
+                sum += (float)(int32_t)audio_u32(p) / 2147483648.0f;
+            }
+        }
+        a->chunk[i] = sum*scale;
+    }
+    a->chunk_start = start;
+    a->chunk_frames = n;
+}
+
+// Copies n mono samples from sample frame start, silence outside the file.
+static void audio_samples(audio_t *a, int64_t start, int n, float *out)
+{
+    for (int i = 0; i < n; ) {
+        int64_t f = start + i;
+        if (f < 0 || f >= a->num_frames) {
+            out[i++] = 0.0f;
+            continue;
+        }
+        if (f < a->chunk_start || f >= a->chunk_start + a->chunk_frames) {
+            audio_load_chunk(a, f);
+            if (!a->chunk_frames) {
+                out[i++] = 0.0f;
+                continue;
+            }
+        }
+        int64_t avail = a->chunk_start + a->chunk_frames - f;
+        int count = avail < n - i ? (int)avail : n - i;
+        memcpy(out + i, a->chunk + (f - a->chunk_start), (size_t)count*sizeof *out);
+        i += count;
+    }
+}
+
+// Spectrum and waveform of the window ending at time t, as texture rows.
+static void audio_analyze(audio_t *a, double t, uint8_t *out)
+{
+    int64_t end = (int64_t)floor(t*a->sample_rate);
+    audio_samples(a, end - AUDIO_FFT_SIZE, AUDIO_FFT_SIZE, a->re);
+
+    uint8_t *wave = out + AUDIO_WIDTH;
+    for (int i = 0; i < AUDIO_WIDTH; i++) {
+        float v = 128.0f*(1.0f + a->re[AUDIO_FFT_SIZE - AUDIO_WIDTH + i]);
+        wave[i] = (uint8_t)(v < 0.0f ? 0.0f : v > 255.0f ? 255.0f : v);
+    }
+
+    for (int i = 0; i < AUDIO_FFT_SIZE; i++) {
+        a->re[i] *= a->window[i];
+        a->im[i] = 0.0f;
+    }
+    fft_forward(&a->fft, a->re, a->im);
+
+    const float range = 255.0f / (AUDIO_MAX_DB - AUDIO_MIN_DB);
+    for (int i = 0; i < AUDIO_WIDTH; i++) {
+        float power = (a->re[i]*a->re[i] + a->im[i]*a->im[i]) / ((float)AUDIO_FFT_SIZE*AUDIO_FFT_SIZE);
+        float db = power > 0.0f ? 10.0f*log10f(power) : AUDIO_MIN_DB;
+        float v = (db - AUDIO_MIN_DB)*range;
+        out[i] = (uint8_t)(v < 0.0f ? 0.0f : v > 255.0f ? 255.0f : v);
+    }
+}
+
+static void *audio_thread(void *user)
+{
+    audio_t *a = user;
+    uint8_t result[2*AUDIO_WIDTH];
+    pthread_mutex_lock(&a->lock);
+    for (;;) {
+        while (a->done == a->request && !a->quit)
+            pthread_cond_wait(&a->wake, &a->lock);
+        if (a->quit) break;
+
+        uint64_t request = a->request;
+        double t = a->request_time;
+        pthread_mutex_unlock(&a->lock);
+
+        audio_analyze(a, t, result);
+
+        pthread_mutex_lock(&a->lock);
+        memcpy(a->result, result, sizeof result);
+        a->done = request;
+    }
+    pthread_mutex_unlock(&a->lock);
+    return NULL;
+}
+
+static void audio_close(audio_t *a)
+{
+    if (a->thread_started) {
+        pthread_mutex_lock(&a->lock);
+        a->quit = true;
+        pthread_cond_signal(&a->wake);
+        pthread_mutex_unlock(&a->lock);
+        pthread_join(a->thread, NULL);
+        pthread_mutex_destroy(&a->lock);
+        pthread_cond_destroy(&a->wake);
+    }
+    if (a->fd >= 0) close(a->fd);
+    if (a->texture) glDeleteTextures(1, &a->texture);
+    fft_destroy(&a->fft);
+    free(a->chunk);
+    free(a->raw);
+    memset(a, 0, sizeof *a);
+    a->fd = -1;
+}
+
+// Opens the WAV file at path and starts the analysis thread, needs a GL context.
+static bool audio_open(audio_t *a, const char *path)
+{
+    memset(a, 0, sizeof *a);
+    a->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (a->fd < 0) {
+        perror(path);
+        return false;
+    }
+    if (!audio_parse(a, path)) {
+        audio_close(a);
+        return false;
+    }
+
+    a->chunk = xmalloc(AUDIO_CHUNK_FRAMES*sizeof *a->chunk);
+    a->raw = xmalloc((size_t)AUDIO_CHUNK_FRAMES*(size_t)a->block_align);
+    a->chunk_start = -1;
+    fft_init(&a->fft, AUDIO_FFT_SIZE);
+    // Blackman window, as Web Audio's analyser uses.
+    for (int i = 0; i < AUDIO_FFT_SIZE; i++) {
+        double x = 2.0*M_PI*i / AUDIO_FFT_SIZE;
+        a->window[i] = (float)(0.42 - 0.5*cos(x) + 0.08*cos(2.0*x));
+    }
+
+    glGenTextures(1, &a->texture);
+    glBindTexture(GL_TEXTURE_2D, a->texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, AUDIO_WIDTH, 2);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Silence until the first result is in: no energy, a flat waveform.
+    memset(a->result, 0, AUDIO_WIDTH);
+    memset(a->result + AUDIO_WIDTH, 128, AUDIO_WIDTH);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, AUDIO_WIDTH, 2, GL_RED, GL_UNSIGNED_BYTE, a->result);
+
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->wake, NULL);
+    a->request_time = -1.0;
+    if (pthread_create(&a->thread, NULL, audio_thread, a) != 0) {
+        fprintf(stderr, "Could not start the audio thread.\n");
+        pthread_mutex_destroy(&a->lock);
+        pthread_cond_destroy(&a->wake);
+        audio_close(a);
+        return false;
+    }
+    a->thread_started = true;
+    return true;
+}
+
+/*
+ * Uploads the newest result, if there is one, and asks for the spectrum at
+ * next_time, when the following frame is expected. Never waits for the
+ * worker beyond taking the lock.
+ */
+static void audio_update(audio_t *a, double next_time)
+{
+    uint8_t result[2*AUDIO_WIDTH];
+    pthread_mutex_lock(&a->lock);
+    bool fresh = a->done != a->uploaded;
+    if (fresh) {
+        memcpy(result, a->result, sizeof result);
+        a->uploaded = a->done;
+    }
+    if (next_time != a->request_time) {
+        a->request_time = next_time;
+        a->request++;
+        pthread_cond_signal(&a->wake);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    glBindTexture(GL_TEXTURE_2D, a->texture);
+    if (fresh) {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, AUDIO_WIDTH, 2, GL_RED, GL_UNSIGNED_BYTE, result);
+    }
+}
+
+#endif
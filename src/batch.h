@@ -0,0 +1,326 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/*
+ * Process farm for offline rendering. The coordinator forks the workers
+ * before any GL state exists, so each sets up its own context in init().
+ * Frames are handed out one request at a time over pipes, keeping at most
+ * BATCH_QUEUE_DEPTH frames queued per worker, so faster workers naturally
+ * take more of the range. Frames of a worker that dies are given to the
+ * others. Completion is tracked in frame order for progress reporting; a
+ * worker that exits unsuccessfully fails the batch even if every frame
+ * came back.
+ */
+
+#include "memory.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define BATCH_MAX_WORKERS   256
+#define BATCH_QUEUE_DEPTH   2
+
+typedef struct
+{
+    bool (*init)(void *user);
+    bool (*render)(void *user, int frame);
+    // Optional, hands back a frame render() left in flight once it is done, waiting for one if asked.
+    bool (*collect)(void *user, bool wait, int *frame, bool *ok);
+    // Returns false if anything failed that no frame reported.
+    bool (*shutdown)(void *user);
+    void *user;
+} batch_worker_t;
+
+typedef struct
+{
+    int32_t frame;
+    int32_t ok;
+    int64_t render_ns;
+} batch_result_t;
+
+typedef struct
+{
+    pid_t pid;
+    int request_fd;
+    int result_fd;
+    int queued;
+    int rendered;
+    int64_t render_ns;
+} batch_process_t;
+
+static inline int64_t batch_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+static bool write_full(int fd, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool read_full(int fd, void *data, size_t size)
+{
+    char *p = data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// Sends the result of a frame render() left in flight, with its render time.
+static bool batch_finish(int result_fd, batch_result_t *started, int frame, bool ok)
+{
+    size_t n = array_size(started);
+    for (size_t i = 0; i < n; i++) {
+        if (started[i].frame != frame) continue;
+        batch_result_t result = started[i];
+        result.ok = ok;
+        started[i] = started[n-1];
+        array_header(started)->size--;
+        return write_full(result_fd, &result, sizeof result);
+    }
+    return true;
+}
+
+static void batch_worker_main(const batch_worker_t *w, int request_fd, int result_fd)
+{
+    if (!w->init(w->user)) _exit(EXIT_FAILURE);
+
+    batch_result_t *started = NULL;
+    bool failed = false;
+    bool sent = true;
+    while (sent) {
+        // Only wait on frames in flight while no request is queued, so the next render overlaps them.
+        struct pollfd pfd = { .fd = request_fd, .events = POLLIN };
+        bool wait = array_size(started) > 0 && poll(&pfd, 1, 0) == 0;
+        int frame;
+        bool ok;
+        if (w->collect && w->collect(w->user, wait, &frame, &ok)) {
+            failed |= !ok;
+            sent = batch_finish(result_fd, started, frame, ok);
+            continue;
+        }
+
+        int32_t request;
+        if (!read_full(request_fd, &request, sizeof request)) break;
+        int64_t t0 = batch_now();
+        batch_result_t result = { .frame = request };
+        result.ok = w->render(w->user, request);
+        result.render_ns = batch_now() - t0;
+        if (result.ok && w->collect) {
+            array_push_back(started, result);
+            continue;
+        }
+        failed |= !result.ok;
+        sent = write_full(result_fd, &result, sizeof result);
+    }
+
+    if (!w->shutdown(w->user)) failed = true;
+    _exit(failed || array_size(started) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// Waits for a worker, returns false unless it exited successfully.
+static bool batch_reap(pid_t pid)
+{
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+static bool batch_spawn(batch_process_t *proc, const batch_worker_t *w, const batch_process_t *procs, int num_procs)
+{
+    int request[2], result[2];
+    if (pipe(request)) return false;
+    if (pipe(result)) {
+        close(request[0]);
+        close(request[1]);
+        return false;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(request[0]);
+        close(request[1]);
+        close(result[0]);
+        close(result[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        // Drop the coordinator ends, including those of earlier workers.
+        for (int i = 0; i < num_procs; i++) {
+            close(procs[i].request_fd);
+            close(procs[i].result_fd);
+        }
+        close(request[1]);
+        close(result[0]);
+        batch_worker_main(w, request[0], result[1]);
+    }
+
+    close(request[0]);
+    close(result[1]);
+    *proc = (batch_process_t){ .pid = pid, .request_fd = request[1], .result_fd = result[0] };
+    return true;
+}
+
+/*
+ * Renders frames first..last (inclusive) on num_workers processes. Returns
+ * false if any frame failed or could not be rendered at all.
+ */
+static bool run_batch(int first, int last, int num_workers, const batch_worker_t *w)
+{
+    if (last < first) return false;
+    if (num_workers < 1) num_workers = 1;
+    if (num_workers > BATCH_MAX_WORKERS) num_workers = BATCH_MAX_WORKERS;
+
+    int num_frames = last - first + 1;
+    if (num_workers > num_frames) num_workers = num_frames;
+
+    // Frame states: 0 pending, 1 queued, 2 done, 3 failed
+    uint8_t *state = xmalloc((size_t)num_frames);
+    int *owner = xmalloc((size_t)num_frames*sizeof *owner);
+    memset(state, 0, (size_t)num_frames);
+
+    batch_process_t procs[BATCH_MAX_WORKERS];
+    int num_procs = 0;
+    for (int i = 0; i < num_workers; i++) {
+        if (!batch_spawn(&procs[num_procs], w, procs, num_procs)) {
+            perror("fork");
+            break;
+        }
+        num_procs++;
+    }
+
+    // A worker exiting early must not take the coordinator down with SIGPIPE.
+    void (*old_sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    int64_t t0 = batch_now();
+    int next = 0;       // Lowest frame that may still be pending
+    int in_order = 0;   // Frames completed in sequence from the start
+    int finished = 0;
+    int failed = 0;
+    int failed_workers = 0;
+    int alive = num_procs;
+
+    while (finished < num_frames && alive > 0) {
+        for (int p = 0; p < num_procs; p++) {
+            batch_process_t *proc = &procs[p];
+            while (proc->pid > 0 && proc->queued < BATCH_QUEUE_DEPTH) {
+                while (next < num_frames && state[next] != 0) next++;
+                if (next == num_frames) break;
+
+                int32_t frame = first + next;
+                if (!write_full(proc->request_fd, &frame, sizeof frame)) break;
+                state[next] = 1;
+                owner[next] = p;
+                proc->queued++;
+            }
+        }
+
+        struct pollfd fds[BATCH_MAX_WORKERS];
+        int map[BATCH_MAX_WORKERS];
+        int num_fds = 0;
+        for (int p = 0; p < num_procs; p++) {
+            if (procs[p].pid <= 0) continue;
+            fds[num_fds] = (struct pollfd){ .fd = procs[p].result_fd, .events = POLLIN };
+            map[num_fds++] = p;
+        }
+        if (poll(fds, (nfds_t)num_fds, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        for (int i = 0; i < num_fds; i++) {
+            if (!fds[i].revents) continue;
+            batch_process_t *proc = &procs[map[i]];
+
+            batch_result_t result;
+            if (!read_full(proc->result_fd, &result, sizeof result)) {
+                // Worker is gone, put its queued frames back up for grabs.
+                fprintf(stderr, "\nbatch: worker %d exited\n", (int)proc->pid);
+                for (int f = 0; f < num_frames; f++) {
+                    if (state[f] == 1 && owner[f] == map[i]) {
+                        state[f] = 0;
+                        if (f < next) next = f;
+                    }
+                }
+                close(proc->request_fd);
+                close(proc->result_fd);
+                failed_workers += !batch_reap(proc->pid);
+                proc->pid = 0;
+                alive--;
+                continue;
+            }
+
+            int f = result.frame - first;
+            if (f < 0 || f >= num_frames || state[f] != 1) continue;
+            state[f] = result.ok ? 2 : 3;
+            failed += !result.ok;
+            finished++;
+            proc->queued--;
+            proc->rendered++;
+            proc->render_ns += result.render_ns;
+        }
+
+        int prev = in_order;
+        while (in_order < num_frames && state[in_order] >= 2) in_order++;
+        if (in_order != prev) {
+            double elapsed = (double)(batch_now() - t0) / 1e9;
+            fprintf(stderr, "\rbatch: %d/%d frames done in order, %.1f frames/s", in_order, num_frames,
+                    elapsed > 0.0 ? (double)finished / elapsed : 0.0);
+        }
+    }
+
+    for (int p = 0; p < num_procs; p++) {
+        if (procs[p].pid <= 0) continue;
+        close(procs[p].request_fd);
+        close(procs[p].result_fd);
+    }
+    for (int p = 0; p < num_procs; p++) {
+        if (procs[p].pid > 0 && !batch_reap(procs[p].pid)) {
+            fprintf(stderr, "\nbatch: worker %d failed", (int)procs[p].pid);
+            failed_workers++;
+        }
+    }
+    signal(SIGPIPE, old_sigpipe);
+
+    double elapsed = (double)(batch_now() - t0) / 1e9;
+    fprintf(stderr, "\nbatch: %d frames (%d failed) in %.2f s, %.2f frames/s on %d workers\n",
+            finished, failed, elapsed, elapsed > 0.0 ? (double)finished / elapsed : 0.0, num_procs);
+    for (int p = 0; p < num_procs; p++) {
+        fprintf(stderr, "  worker %d: %d frames, %.2f ms/frame\n", p, procs[p].rendered,
+                procs[p].rendered ? (double)procs[p].render_ns / 1e6 / procs[p].rendered : 0.0);
+    }
+
+    bool ok = finished == num_frames && failed == 0 && failed_workers == 0;
+    free(state);
+    free(owner);
+    return ok;
+}
+
+#endif
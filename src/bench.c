@@ -0,0 +1,589 @@
+/*
+ * Micro-benchmarks of the CPU-side hot paths, built separately from the
+ * program:
+ *
+ *   cc -O2 -DTADERSHOY_BENCH src/bench.c -o bench -lGL -lm
+ *   ./bench [--reps n] [filter] > results.json
+ *
+ * Every benchmark is warmed up while its iteration count is calibrated,
+ * then timed over a number of repetitions. Results are printed as JSON with
+ * the median and fastest ns per operation and the xmalloc/xrealloc calls
+ * per operation; what an operation is depends on the benchmark (unit).
+ * Optimized paths are checked against their reference versions first.
+ */
+
+// The modules are header-only, most of what they define is not benchmarked.
+#pragma GCC diagnostic ignored "-Wunused-function"
+
+#include "event_queue.h"
+#include "fft.h"
+#include "font.h"
+#include "gl.h"
+#include "hash.h"
+#include "memory.h"
+#include "overlay.h"
+#include "shader.h"
+#include "source.h"
+#include "uniforms.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_WARMUP_NS     50000000    // Calibration runs at least this long
+#define BENCH_REP_NS        20000000    // Target duration of one repetition
+#define BENCH_DEFAULT_REPS  15
+#define BENCH_MAX_REPS      1000
+
+typedef struct
+{
+    const char *name;
+    const char *unit;       // What one operation is
+    double ops;             // Operations per call of run()
+    void (*setup)(void);
+    void (*run)(void);
+    void (*teardown)(void);
+} bench_t;
+
+static volatile float bench_sink;
+
+static char *log_text;
+static size_t log_len;
+static char *big_source;
+static char source_path[64];
+static size_t source_size;
+
+static int64_t bench_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+// Compiler output of a broken shader, as shown by the overlay.
+static void make_log(size_t size)
+{
+    static const char *lines[] = {
+        "0:%d(%d): error: syntax error, unexpected IDENTIFIER, expecting ',' or ';'\n",
+        "0:%d(%d): warning: `col' used uninitialized\n",
+        "0:%d(%d): error: no function with name 'textur' found\n",
+    };
+    free(log_text);
+    log_text = xmalloc(size + 128);
+    log_len = 0;
+    for (int i = 0; log_len < size; i++)
+        log_len += (size_t)sprintf(log_text + log_len, lines[i % 3], i + 1, (i*7) % 40);
+    log_len = size;
+}
+
+static void setup_log_1k(void)   { make_log(1 << 10); }
+static void setup_log_16k(void)  { make_log(16 << 10); }
+static void setup_log_256k(void) { make_log(256 << 10); }
+
+/*
+ * The layout push_text() replaced: one character at a time, six vertices
+ * per glyph. push_text() is checked and timed against it.
+ */
+typedef struct
+{
+    float x, y, u, v;
+    uint32_t color;
+} reference_vertex_t;
+
+static reference_vertex_t *reference_vertices;
+
+static void write_reference_quad(reference_vertex_t *v, rect_t r, rect_t uv, uint32_t color)
+{
+    v[0] = (reference_vertex_t){ r.x, r.y, uv.x, uv.y, color };
+    v[1] = (reference_vertex_t){ r.x+r.w, r.y, uv.x+uv.w, uv.y, color };
+    v[2] = (reference_vertex_t){ r.x+r.w, r.y+r.h, uv.x+uv.w, uv.y+uv.h, color };
+    v[3] = v[2];
+    v[4] = (reference_vertex_t){ r.x, r.y+r.h, uv.x, uv.y+uv.h, color };
+    v[5] = v[0];
+}
+
+static void push_text_reference(const char *str, size_t len, float x, float y)
+{
+    reference_vertex_t *v = array_reserve(reference_vertices, len*6);
+    reference_vertex_t *start = v;
+    float orig_x = x;
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '\n') {
+            y += TEXT_LINE_HEIGHT;
+            x = orig_x;
+            continue;
+        }
+
+        const glyph_t *glyph = get_glyph(str[i]);
+        rect_t r = make_rect(x+(float)glyph->offset_x, y-(float)glyph->offset_y, (float)glyph->width, (float)glyph->height);
+        write_reference_quad(v, r, glyph->uv, 0xFFFFFFFF);
+        v += 6;
+        x += glyph->advance_x;
+    }
+    array_header(reference_vertices)->size -= len*6 - (size_t)(v - start);
+}
+
+// The six vertices the quad vertex shader makes of a quad.
+static void expand_quad(const overlay_quad_t *q, reference_vertex_t *v)
+{
+    v[0] = (reference_vertex_t){ q->left, q->top, q->u0, q->v0, q->color };
+    v[1] = (reference_vertex_t){ q->right, q->top, q->u1, q->v0, q->color };
+    v[2] = (reference_vertex_t){ q->right, q->bottom, q->u1, q->v1, q->color };
+    v[3] = v[2];
+    v[4] = (reference_vertex_t){ q->left, q->bottom, q->u0, q->v1, q->color };
+    v[5] = v[0];
+}
+
+static void run_push_text(void)
+{
+    array_clear(quad_buffer);
+    push_text(log_text, log_len, 0.0f, 14.0f);
+}
+
+static void run_push_text_reference(void)
+{
+    array_clear(reference_vertices);
+    push_text_reference(log_text, log_len, 0.0f, 14.0f);
+}
+
+static void run_push_quad(void)
+{
+    array_clear(quad_buffer);
+    for (int i = 0; i < 1024; i++)
+        push_quad(make_rect((float)i, 0, 8, 14), make_rect(-1, -1, -1, -1), 0x7F);
+}
+
+static void teardown_vertices(void)
+{
+    array_free(quad_buffer);
+    quad_buffer = NULL;
+    array_free(reference_vertices);
+    reference_vertices = NULL;
+}
+
+static void run_array_push_back(void)
+{
+    int *a = NULL;
+    for (int i = 0; i < 1 << 16; i++)
+        array_push_back(a, i);
+    bench_sink = (float)a[array_size(a) - 1];
+    array_free(a);
+}
+
+static void run_array_reserve(void)
+{
+    int *a = NULL;
+    for (int i = 0; i < 1 << 6; i++) {
+        int *p = array_reserve(a, 1 << 10);
+        for (int j = 0; j < 1 << 10; j++)
+            p[j] = j;
+    }
+    bench_sink = (float)a[array_size(a) - 1];
+    array_free(a);
+}
+
+static arena_t bench_arena;
+
+static void run_arena_alloc(void)
+{
+    for (int i = 0; i < 1024; i++)
+        bench_sink = *arena_push(&bench_arena, float, 1 + i % 64) = (float)i;
+    arena_reset(&bench_arena);
+}
+
+static void teardown_arena(void)
+{
+    arena_free(&bench_arena);
+}
+
+static void run_get_glyph(void)
+{
+    float x = 0.0f;
+    for (size_t i = 0; i < 4096; i++)
+        x += get_glyph(log_text[i])->advance_x;
+    bench_sink = x;
+}
+
+static void make_source(size_t size)
+{
+    static const char *lines[] = {
+        "    vec3 p = ro + rd*t; // march\n",
+        "    float d = sdBox(p - vec3(1.0, 0.5, 0.0), vec3(0.5)) + 0.01*sin(iTime);\n",
+        "uniform float uRough; // @slider 0 1 0.5\n",
+        "    col = mix(col, vec3(0.2, 0.3, 0.4), 1.0 - exp(-0.02*t*t));\n",
+    };
+    free(big_source);
+    big_source = xmalloc(size + 128);
+    size_t n = 0;
+    for (int i = 0; n < size; i++) {
+        // Sliders are rare in real sources.
+        const char *line = lines[i % 64 == 2 ? 2 : i % 2 ? 1 : i % 4 == 0 ? 0 : 3];
+        n += (size_t)sprintf(big_source + n, "%s", line);
+    }
+    big_source[size] = 0;
+    source_size = size;
+}
+
+static void setup_file(size_t size)
+{
+    make_source(size);
+    strcpy(source_path, "/tmp/tadershoy-bench-XXXXXX");
+    int fd = mkstemp(source_path);
+    if (fd < 0 || write(fd, big_source, size) != (ssize_t)size) {
+        perror(source_path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+static void setup_file_1m(void)  { setup_file(1 << 20); }
+static void setup_file_16m(void) { setup_file(16 << 20); }
+
+static void run_update_file_buffer(void)
+{
+    update_file_buffer(source_path);
+}
+
+static void teardown_file(void)
+{
+    unlink(source_path);
+    free_file_buffer();
+}
+
+static void setup_source_1m(void) { make_source(1 << 20); }
+
+// The CPU work of a reload before anything reaches the driver.
+static void run_program_key(void)
+{
+    const char *src[3] = { fs_header_src, big_source, fs_footer_src };
+    bench_sink = (float)program_key(src, 3);
+}
+
+static void run_hash_bytes(void)
+{
+    bench_sink = (float)hash_bytes(big_source, source_size, 0);
+}
+
+static void run_uniforms_parse(void)
+{
+    uniforms_parse(big_source);
+}
+
+static void teardown_source(void)
+{
+    array_free(custom_uniforms);
+    custom_uniforms = NULL;
+}
+
+static fft_t bench_fft;
+static float fft_re[4096], fft_im[4096];
+
+static void setup_fft_2048(void)
+{
+    fft_init(&bench_fft, 2048);
+    for (int i = 0; i < 2048; i++) {
+        fft_re[i] = sinf((float)i*0.1f);
+        fft_im[i] = 0.0f;
+    }
+}
+
+static void run_fft(void)
+{
+    fft_forward(&bench_fft, fft_re, fft_im);
+    // Keeps the values bounded across iterations.
+    fft_re[0] = fft_im[0] = 0.0f;
+    bench_sink = fft_re[1];
+}
+
+static void teardown_fft(void)
+{
+    fft_destroy(&bench_fft);
+}
+
+static event_queue_t bench_queue;
+
+static void setup_event_queue(void)
+{
+    event_queue_init(&bench_queue);
+}
+
+// Half a queue in, then out again, on one thread: the cost without contention.
+static void run_event_queue(void)
+{
+    platform_event_t e = { .type = PLATFORM_EVENT_MOTION };
+    for (int i = 0; i < EVENT_QUEUE_SIZE/2; i++) {
+        e.x = i;
+        event_queue_push(&bench_queue, &e);
+    }
+    while (event_queue_pop(&bench_queue, &e)) bench_sink = (float)e.x;
+}
+
+static const bench_t benchmarks[] = {
+    { "push_text/log_1k",            "char",    1 << 10,  setup_log_1k,    run_push_text,          teardown_vertices },
+    { "push_text/log_16k",           "char",    16 << 10, setup_log_16k,   run_push_text,          teardown_vertices },
+    { "push_text/log_256k",          "char",    256 << 10, setup_log_256k, run_push_text,          teardown_vertices },
+    { "push_text_reference/log_1k",  "char",    1 << 10,  setup_log_1k,    run_push_text_reference, teardown_vertices },
+    { "push_text_reference/log_16k", "char",    16 << 10, setup_log_16k,   run_push_text_reference, teardown_vertices },
+    { "push_quad",                   "quad",    1024,     NULL,            run_push_quad,          teardown_vertices },
+    { "array_push_back/grow_64k",    "element", 1 << 16,  NULL,            run_array_push_back,    NULL },
+    { "array_reserve/grow_64k",      "element", 1 << 16,  NULL,            run_array_reserve,      NULL },
+    { "arena_alloc",                 "alloc",   1024,     NULL,            run_arena_alloc,        teardown_arena },
+    { "get_glyph",                   "char",    4096,     setup_log_16k,   run_get_glyph,          NULL },
+    { "update_file_buffer/1m",       "byte",    1 << 20,  setup_file_1m,   run_update_file_buffer, teardown_file },
+    { "update_file_buffer/16m",      "byte",    16 << 20, setup_file_16m,  run_update_file_buffer, teardown_file },
+    { "source/program_key_1m",       "byte",    1 << 20,  setup_source_1m, run_program_key,        NULL },
+    { "source/hash_bytes_1m",        "byte",    1 << 20,  setup_source_1m, run_hash_bytes,         NULL },
+    { "source/uniforms_parse_1m",    "byte",    1 << 20,  setup_source_1m, run_uniforms_parse,     teardown_source },
+    { "event_queue/push_pop",        "event",   EVENT_QUEUE_SIZE/2, setup_event_queue, run_event_queue, NULL },
+    { "fft/2048",                    "sample",  2048,     setup_fft_2048,  run_fft,                teardown_fft },
+};
+
+/*
+ * push_text() quads, expanded the way the vertex shader does, must be
+ * exactly the vertices of push_text_reference(). Run
+ * before the benchmarks over line lengths around the batch sizes, odd
+ * bytes and starting points between pixels.
+ */
+static bool check_push_text(void)
+{
+    static const float origins[][2] = { { 0.0f, 14.0f }, { 3.0f, 0.5f }, { 0.5f, 14.0f }, { -17.0f, -3.25f },
+                                         { 1e7f, 0.0f }, { 0.1f, 0.2f } };
+    char str[1024];
+    unsigned seed = 1;
+    bool ok = true;
+    for (int t = 0; t < 400 && ok; t++) {
+        size_t len = (size_t)t < 200 ? (size_t)t : (size_t)(seed % sizeof str);
+        for (size_t i = 0; i < len; i++) {
+            seed = seed*1103515245 + 12345;
+            unsigned r = (seed >> 16) % 100;
+            str[i] = r < 3 ? '\n' : r < 5 ? (char)(seed >> 8) : (char)(32 + (seed >> 9) % 95);
+        }
+        if (t % 7 == 0 && len > 2) str[len-1] = str[len-2] = '\n';
+
+        for (size_t o = 0; o < sizeof origins / sizeof *origins && ok; o++) {
+            array_clear(reference_vertices);
+            push_text_reference(str, len, origins[o][0], origins[o][1]);
+            array_clear(quad_buffer);
+            push_text(str, len, origins[o][0], origins[o][1]);
+
+            size_t n = array_size(quad_buffer);
+            ok = array_size(reference_vertices) == n*6;
+            for (size_t i = 0; i < n && ok; i++) {
+                reference_vertex_t v[6];
+                expand_quad(&quad_buffer[i], v);
+                ok = memcmp(v, &reference_vertices[i*6], sizeof v) == 0;
+            }
+            if (!ok)
+                fprintf(stderr, "push_text differs from push_text_reference: length %zu at (%g, %g)\n",
+                        len, (double)origins[o][0], (double)origins[o][1]);
+        }
+    }
+    teardown_vertices();
+    return ok;
+}
+
+// fft_forward() against a direct DFT in double precision, for every size up to 4096.
+static bool check_fft(void)
+{
+    static double ref_re[4096], ref_im[4096];
+    unsigned seed = 1;
+    for (int n = 4; n <= 4096; n *= 2) {
+        fft_t f;
+        fft_init(&f, n);
+        for (int i = 0; i < n; i++) {
+            seed = seed*1103515245 + 12345;
+            fft_re[i] = (float)((seed >> 16) % 2001) / 1000.0f - 1.0f;
+            seed = seed*1103515245 + 12345;
+            fft_im[i] = (float)((seed >> 16) % 2001) / 1000.0f - 1.0f;
+        }
+        for (int k = 0; k < n; k++) {
+            ref_re[k] = ref_im[k] = 0.0;
+            for (int j = 0; j < n; j++) {
+                double a = -2.0*M_PI*(double)((int64_t)j*k % n) / n;
+                ref_re[k] += fft_re[j]*cos(a) - fft_im[j]*sin(a);
+                ref_im[k] += fft_re[j]*sin(a) + fft_im[j]*cos(a);
+            }
+        }
+        fft_forward(&f, fft_re, fft_im);
+        fft_destroy(&f);
+
+        // Rounding grows with log n, the values themselves with sqrt n.
+        double tolerance = 1e-5*sqrt((double)n)*log2((double)n);
+        for (int k = 0; k < n; k++) {
+            if (fabs(fft_re[k] - ref_re[k]) > tolerance || fabs(fft_im[k] - ref_im[k]) > tolerance) {
+                fprintf(stderr, "fft_forward differs from the DFT: size %d, bin %d\n", n, k);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * hash_blocks() against the scalar stripes over lengths around the block
+ * size and unaligned starts, then update_file_buffer() for sizes around the
+ * page size: the mapping must hold the file, end in a zero byte and hash
+ * like the bytes in memory.
+ */
+static bool check_source(void)
+{
+    static unsigned char data[4*HASH_STRIPE*HASH_BLOCK_STRIPES + 16];
+    unsigned seed = 1;
+    for (size_t i = 0; i < sizeof data; i++) {
+        seed = seed*1103515245 + 12345;
+        data[i] = (unsigned char)(seed >> 16);
+    }
+    const size_t block = HASH_STRIPE*HASH_BLOCK_STRIPES;
+    for (size_t size = 0; size + 16 <= sizeof data; size += size < 2*block - 64 ? 61 : 1) {
+        for (size_t offset = 0; offset < 16; offset += 5) {
+            uint64_t acc[8], ref[8];
+            for (int j = 0; j < 8; j++) acc[j] = ref[j] = hash_keys[7 - j] + (uint64_t)size;
+            size_t done = hash_blocks(acc, data + offset, size);
+            for (size_t b = 0; b + block <= size; b += block) {
+                for (int s = 0; s < HASH_BLOCK_STRIPES; s++)
+                    hash_stripe(ref, data + offset + b + (size_t)s*HASH_STRIPE);
+                hash_scramble(ref);
+            }
+            if (done != size/block*block || memcmp(acc, ref, sizeof acc)) {
+                fprintf(stderr, "hash_blocks differs from the scalar stripes: size %zu, offset %zu\n", size, offset);
+                return false;
+            }
+        }
+    }
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t sizes[] = { 0, 1, page - 1, page, page + 1, 2*page, 3*page - 7 };
+    make_source(3*page);
+    bool ok = true;
+    for (size_t i = 0; i < sizeof sizes / sizeof *sizes && ok; i++) {
+        strcpy(source_path, "/tmp/tadershoy-bench-XXXXXX");
+        int fd = mkstemp(source_path);
+        if (fd < 0 || write(fd, big_source, sizes[i]) != (ssize_t)sizes[i]) {
+            perror(source_path);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+        if (!update_file_buffer(source_path) || memcmp(file_buffer, big_source, sizes[i]) ||
+            file_buffer[sizes[i]] || file_hash != hash_bytes(big_source, sizes[i], 0)) {
+            fprintf(stderr, "update_file_buffer differs from the file: size %zu\n", sizes[i]);
+            ok = false;
+        }
+        teardown_file();
+    }
+    return ok;
+}
+
+#define CHECK_EVENTS 1000000
+
+static void *check_event_producer(void *arg)
+{
+    event_queue_t *q = arg;
+    for (int i = 0; i < CHECK_EVENTS; i++) {
+        platform_event_t e = { .type = PLATFORM_EVENT_MOTION, .x = i, .y = ~i };
+        while (!event_queue_push(q, &e)) {}
+    }
+    return NULL;
+}
+
+// Events pushed from another thread arrive complete and in order.
+static bool check_event_queue(void)
+{
+    event_queue_init(&bench_queue);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, check_event_producer, &bench_queue) != 0) return false;
+    bool ok = true;
+    for (int i = 0; i < CHECK_EVENTS; ) {
+        platform_event_t e;
+        if (!event_queue_pop(&bench_queue, &e)) continue;
+        if (ok && (e.x != i || e.y != ~i)) {
+            fprintf(stderr, "event_queue_pop returned event %d instead of %d\n", e.x, i);
+            ok = false;
+        }
+        i++;
+    }
+    pthread_join(thread, NULL);
+    return ok;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_benchmark(const bench_t *b, int reps, bool first)
+{
+    if (b->setup) b->setup();
+
+    // Doubling the iterations until the warm-up time is reached also calibrates a repetition.
+    long iters = 1;
+    for (;;) {
+        int64_t t0 = bench_now();
+        for (long i = 0; i < iters; i++) b->run();
+        int64_t dt = bench_now() - t0;
+        if (dt >= BENCH_WARMUP_NS) {
+            iters = (long)((double)iters*BENCH_REP_NS / (double)dt);
+            break;
+        }
+        iters *= 2;
+    }
+    if (iters < 1) iters = 1;
+
+    double ns[BENCH_MAX_REPS];
+    unsigned long long allocs = memory_allocs;
+    for (int r = 0; r < reps; r++) {
+        int64_t t0 = bench_now();
+        for (long i = 0; i < iters; i++) b->run();
+        ns[r] = (double)(bench_now() - t0) / ((double)iters*b->ops);
+    }
+    double total_ops = (double)reps*(double)iters*b->ops;
+    double allocs_per_op = (double)(memory_allocs - allocs) / total_ops;
+    qsort(ns, (size_t)reps, sizeof *ns, compare_double);
+
+    printf("%s    {\"name\": \"%s\", \"unit\": \"%s\", \"ns_per_op\": %.4f, \"min_ns_per_op\": %.4f, "
+           "\"allocs_per_op\": %.6f, \"iterations\": %ld, \"reps\": %d}",
+           first ? "" : ",\n", b->name, b->unit, ns[reps/2], ns[0], allocs_per_op, iters, reps);
+    fflush(stdout);
+    fprintf(stderr, "%-28s %10.3f ns/%s\n", b->name, ns[reps/2], b->unit);
+
+    if (b->teardown) b->teardown();
+}
+
+int main(int argc, char *argv[])
+{
+    int reps = BENCH_DEFAULT_REPS;
+    const char *filter = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--reps") == 0 && i+1 < argc) {
+            reps = atoi(argv[++i]);
+            if (reps < 1 || reps > BENCH_MAX_REPS) {
+                fprintf(stderr, "Repetitions must be between 1 and %d.\n", BENCH_MAX_REPS);
+                return EXIT_FAILURE;
+            }
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--reps n] [filter]\n", argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    if (!check_push_text() || !check_fft() || !check_source() || !check_event_queue()) return EXIT_FAILURE;
+
+    printf("{\"benchmarks\": [\n");
+    bool first = true;
+    for (size_t i = 0; i < sizeof benchmarks / sizeof *benchmarks; i++) {
+        if (filter && !strstr(benchmarks[i].name, filter)) continue;
+        run_benchmark(&benchmarks[i], reps, first);
+        first = false;
+    }
+    printf("\n]}\n");
+
+    free(log_text);
+    free(big_source);
+    return EXIT_SUCCESS;
+}
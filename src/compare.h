@@ -0,0 +1,274 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+/*
+ * Golden image comparison. The calling thread renders each frame at the
+ * size of its reference image and hands it to a pool of threads that
+ * decode the reference, compute the metrics and write a diff image when
+ * the frame fails. Like the frame writer, a fixed set of slots bounds how
+ * far rendering runs ahead. Results are printed in frame order.
+ */
+
+#include "image.h"
+#include "memory.h"
+#include "metrics.h"
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define COMPARE_MAX_THREADS 64
+
+typedef struct
+{
+    // Renders frame at the given size into bottom-up RGBA pixels.
+    bool (*render)(void *user, int frame, int width, int height, uint8_t *pixels);
+    void *user;
+} compare_renderer_t;
+
+typedef enum
+{
+    COMPARE_PENDING,
+    COMPARE_PASS,
+    COMPARE_FAIL,
+    COMPARE_ERROR,
+} compare_status_t;
+
+typedef struct
+{
+    compare_status_t status;
+    image_metrics_t metrics;
+    char message[64];
+} compare_result_t;
+
+typedef struct
+{
+    int frame;
+    int width;
+    int height;
+    uint8_t *pixels;
+    size_t pixels_cap;
+    uint8_t *reference;
+    size_t reference_cap;
+    uint8_t *scratch;
+    size_t scratch_cap;
+} compare_slot_t;
+
+typedef struct
+{
+    pthread_t threads[COMPARE_MAX_THREADS];
+    int num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready;
+    pthread_cond_t slot_free;
+    compare_slot_t *slots;
+    int num_slots;
+    int *free_slots;
+    int num_free;
+    int *tasks;
+    int task_head;
+    int num_tasks;
+    bool quit;
+
+    const char *reference;
+    const char *diff;
+    double threshold;
+    int first;
+    compare_result_t *results;
+} compare_t;
+
+static void compare_frame(compare_t *c, compare_slot_t *s, compare_result_t *r)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof path, c->reference, s->frame);
+    int width, height;
+    if (!read_image(path, &s->reference, &s->reference_cap, &width, &height)) {
+        r->status = COMPARE_ERROR;
+        snprintf(r->message, sizeof r->message, "could not read reference");
+        return;
+    }
+    if (width != s->width || height != s->height) {
+        r->status = COMPARE_ERROR;
+        snprintf(r->message, sizeof r->message, "size changed while reading");
+        return;
+    }
+
+    size_t scratch_size = (size_t)width*(size_t)height*4;
+    if (s->scratch_cap < scratch_size) {
+        s->scratch = xrealloc(s->scratch, scratch_size);
+        s->scratch_cap = scratch_size;
+    }
+    r->metrics = image_metrics(s->pixels, s->reference, width, height, s->scratch);
+    r->status = r->metrics.psnr >= c->threshold ? COMPARE_PASS : COMPARE_FAIL;
+    if (r->status == COMPARE_FAIL && c->diff) {
+        snprintf(path, sizeof path, c->diff, s->frame);
+        make_diff_image(s->scratch, s->pixels, s->reference, width, height);
+        if (!write_image(path, s->scratch, width, height))
+            snprintf(r->message, sizeof r->message, "could not write diff image");
+    }
+}
+
+static void *compare_thread(void *user)
+{
+    compare_t *c = user;
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        while (!c->num_tasks && !c->quit)
+            pthread_cond_wait(&c->task_ready, &c->lock);
+        if (!c->num_tasks) break;
+
+        int slot = c->tasks[c->task_head];
+        c->task_head = (c->task_head + 1) % c->num_slots;
+        c->num_tasks--;
+        pthread_mutex_unlock(&c->lock);
+
+        compare_slot_t *s = &c->slots[slot];
+        compare_result_t r = {0};
+        compare_frame(c, s, &r);
+
+        pthread_mutex_lock(&c->lock);
+        c->results[s->frame - c->first] = r;
+        c->free_slots[c->num_free++] = slot;
+        pthread_cond_broadcast(&c->slot_free);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+static void compare_print(int frame, const compare_result_t *r)
+{
+    static const char *status[] = { "", "ok", "FAIL", "ERROR" };
+    if (r->status == COMPARE_ERROR) {
+        printf("%6d %5s %8s %8s %7s  %s\n", frame, status[r->status], "-", "-", "-", r->message);
+        return;
+    }
+    const image_metrics_t *m = &r->metrics;
+    printf("%6d %5s %8d %8.2f %7.5f  %s\n", frame, status[r->status], m->max_error, m->psnr, m->ssim, r->message);
+}
+
+static int64_t compare_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+/*
+ * Compares frames first..last (inclusive) against the references named by
+ * the reference pattern. Frames with a PSNR below threshold fail and get a
+ * diff image written to the diff pattern, if one is given. Returns true if
+ * every frame passed.
+ */
+static bool run_compare(int first, int last, int num_threads, const char *reference, const char *diff,
+                        double threshold, const compare_renderer_t *renderer)
+{
+    compare_t c = { .reference = reference, .diff = diff, .threshold = threshold, .first = first };
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > COMPARE_MAX_THREADS) num_threads = COMPARE_MAX_THREADS;
+
+    int num_frames = last - first + 1;
+    c.results = xmalloc((size_t)num_frames*sizeof *c.results);
+    memset(c.results, 0, (size_t)num_frames*sizeof *c.results);
+    c.num_slots = num_threads + 1;
+    c.slots = xmalloc((size_t)c.num_slots*sizeof *c.slots);
+    memset(c.slots, 0, (size_t)c.num_slots*sizeof *c.slots);
+    c.free_slots = xmalloc((size_t)c.num_slots*sizeof *c.free_slots);
+    c.tasks = xmalloc((size_t)c.num_slots*sizeof *c.tasks);
+    for (int i = 0; i < c.num_slots; i++)
+        c.free_slots[c.num_free++] = i;
+
+    pthread_mutex_init(&c.lock, NULL);
+    pthread_cond_init(&c.task_ready, NULL);
+    pthread_cond_init(&c.slot_free, NULL);
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&c.threads[i], NULL, compare_thread, &c) != 0) break;
+        c.num_threads++;
+    }
+
+    printf("%6s %5s %8s %8s %7s\n", "frame", "", "max", "psnr(dB)", "ssim");
+    int64_t start = compare_now();
+    int printed = 0;
+    for (int frame = first; frame <= last && c.num_threads; frame++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof path, reference, frame);
+        int width, height;
+        int slot = -1;
+        compare_result_t r = {0};
+        if (!image_info(path, &width, &height)) {
+            r.status = COMPARE_ERROR;
+            snprintf(r.message, sizeof r.message, "missing or unreadable reference");
+        } else {
+            pthread_mutex_lock(&c.lock);
+            while (!c.num_free)
+                pthread_cond_wait(&c.slot_free, &c.lock);
+            slot = c.free_slots[--c.num_free];
+            pthread_mutex_unlock(&c.lock);
+
+            compare_slot_t *s = &c.slots[slot];
+            size_t size = (size_t)width*(size_t)height*4;
+            if (s->pixels_cap < size) {
+                s->pixels = xrealloc(s->pixels, size);
+                s->pixels_cap = size;
+            }
+            s->frame = frame;
+            s->width = width;
+            s->height = height;
+            if (!renderer->render(renderer->user, frame, width, height, s->pixels)) {
+                r.status = COMPARE_ERROR;
+                snprintf(r.message, sizeof r.message, "render failed");
+            }
+        }
+
+        pthread_mutex_lock(&c.lock);
+        if (r.status != COMPARE_PENDING) {
+            c.results[frame - first] = r;
+            if (slot >= 0) c.free_slots[c.num_free++] = slot;
+        } else {
+            c.tasks[(c.task_head + c.num_tasks++) % c.num_slots] = slot;
+            pthread_cond_signal(&c.task_ready);
+        }
+        for (; printed < num_frames && c.results[printed].status != COMPARE_PENDING; printed++)
+            compare_print(first + printed, &c.results[printed]);
+        pthread_mutex_unlock(&c.lock);
+        fflush(stdout);
+    }
+
+    pthread_mutex_lock(&c.lock);
+    c.quit = true;
+    pthread_cond_broadcast(&c.task_ready);
+    pthread_mutex_unlock(&c.lock);
+    for (int i = 0; i < c.num_threads; i++)
+        pthread_join(c.threads[i], NULL);
+    for (; printed < num_frames && c.results[printed].status != COMPARE_PENDING; printed++)
+        compare_print(first + printed, &c.results[printed]);
+
+    int passed = 0, failed = 0, errors = 0;
+    for (int i = 0; i < num_frames; i++) {
+        passed += c.results[i].status == COMPARE_PASS;
+        failed += c.results[i].status == COMPARE_FAIL;
+        errors += c.results[i].status == COMPARE_ERROR;
+    }
+    double seconds = (double)(compare_now() - start) / 1e9;
+    printf("%d passed, %d failed, %d errors (threshold %.1f dB) in %.2f s\n", passed, failed, errors, threshold, seconds);
+    if (!c.num_threads) fprintf(stderr, "Could not start comparison threads.\n");
+
+    for (int i = 0; i < c.num_slots; i++) {
+        free(c.slots[i].pixels);
+        free(c.slots[i].reference);
+        free(c.slots[i].scratch);
+    }
+    free(c.slots);
+    free(c.free_slots);
+    free(c.tasks);
+    free(c.results);
+    pthread_cond_destroy(&c.slot_free);
+    pthread_cond_destroy(&c.task_ready);
+    pthread_mutex_destroy(&c.lock);
+    return passed == num_frames;
+}
+
+#endif
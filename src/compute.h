@@ -0,0 +1,346 @@
+#ifndef COMPUTE_H
+#define COMPUTE_H
+
+/*
+ * Compute path for mainImage. The shader is wrapped in a compute shader
+ * whose workgroups each shade one tile of the image and store it with
+ * imageStore(). Workgroups are launched in index order, and each looks its
+ * tile up in a table, so the order tiles are shaded in is chosen on the
+ * CPU: row by row, along a Morton (Z-order) curve or along a Hilbert
+ * curve. Curves keep consecutive workgroups close together, which can help
+ * caches when neighbouring pixels read the same data. Shaders that use
+ * derivatives or gl_FragCoord only work on the fragment path.
+ */
+
+#include "gl.h"
+#include "memory.h"
+#include "shader.h"
+#include "sweep.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define COMPUTE_MAX_INVOCATIONS 1024    // Guaranteed GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS
+#define COMPUTE_DEFAULT_GROUP   8
+
+typedef enum
+{
+    TILE_ORDER_LINEAR,
+    TILE_ORDER_MORTON,
+    TILE_ORDER_HILBERT,
+    NUM_TILE_ORDERS
+} tile_order_t;
+
+static const char *tile_order_names[NUM_TILE_ORDERS] = { "linear", "morton", "hilbert" };
+
+typedef struct
+{
+    int group_width;
+    int group_height;
+    tile_order_t order;
+    char header[1024];          // Compute counterpart of fs_header_src for this workgroup size
+
+    GLuint tiles;               // Tile coordinates in shading order, x | y << 16
+    int tiles_x;
+    int tiles_y;
+    tile_order_t tiles_order;
+
+    GLuint texture;             // RGBA16F, blitted to the window
+    GLuint fbo;
+    int width;
+    int height;
+} compute_path_t;
+
+static const char *compute_footer_src =
+    "void main(void) {\n"
+    "   uint tile = tiles[gl_WorkGroupID.y*gl_NumWorkGroups.x + gl_WorkGroupID.x];\n"
+    "   ivec2 p = ivec2(uvec2(tile & 0xFFFFu, tile >> 16)*gl_WorkGroupSize.xy + gl_LocalInvocationID.xy);\n"
+    "   if (p.x >= int(iResolution.x) || p.y >= int(iResolution.y)) return;\n"
+    "   vec4 color;\n"
+    "   mainImage(color, vec2(p) + 0.5);\n"
+    "   imageStore(uOutput, p, color);\n"
+    "}\n";
+
+static void compute_header(char *buf, size_t size, int group_width, int group_height)
+{
+    snprintf(buf, size,
+             "#version 450 core\n"
+             "layout(local_size_x = %d, local_size_y = %d) in;\n"
+             "layout(binding = 0) writeonly uniform image2D uOutput;\n"
+             "layout(std430, binding = 0) readonly buffer Tiles {\n"
+             "    uint tiles[];\n"
+             "};\n"
+             "layout(location = 0) uniform vec2 iResolution;\n"
+             "layout(location = 1) uniform float iTime;\n"
+             "layout(location = 2) uniform float iTimeDelta;\n"
+             "layout(location = 3) uniform int iFrame;\n"
+             "layout(location = 4) uniform vec2 iMouse;\n"
+             "layout(binding = 0) uniform sampler2D iChannel0;\n"
+             "layout(binding = 1) uniform sampler3D iChannel1;\n"
+             "#define debugPrint(v)\n",
+             group_width, group_height);
+}
+
+static inline uint32_t morton_compact(uint32_t v)
+{
+    v &= 0x55555555u;
+    v = (v | (v >> 1)) & 0x33333333u;
+    v = (v | (v >> 2)) & 0x0F0F0F0Fu;
+    v = (v | (v >> 4)) & 0x00FF00FFu;
+    v = (v | (v >> 8)) & 0x0000FFFFu;
+    return v;
+}
+
+// Position d along the Hilbert curve filling an n*n grid, n a power of two.
+static void hilbert_point(uint32_t n, uint32_t d, uint32_t *x, uint32_t *y)
+{
+    *x = *y = 0;
+    for (uint32_t s = 1; s < n; s *= 2, d /= 4) {
+        uint32_t rx = 1 & (d / 2);
+        uint32_t ry = 1 & (d ^ rx);
+        if (!ry) {
+            if (rx) {
+                *x = s - 1 - *x;
+                *y = s - 1 - *y;
+            }
+            uint32_t t = *x;
+            *x = *y;
+            *y = t;
+        }
+        *x += s*rx;
+        *y += s*ry;
+    }
+}
+
+/*
+ * Writes the tiles of a tiles_x*tiles_y grid in the given order. The curves
+ * are walked over the enclosing power of two square, skipping tiles outside
+ * the grid, so every tile comes up exactly once.
+ */
+static void tile_order_build(tile_order_t order, int tiles_x, int tiles_y, uint32_t *out)
+{
+    uint32_t n = 1;
+    while (n < (uint32_t)tiles_x || n < (uint32_t)tiles_y)
+        n *= 2;
+
+    size_t k = 0;
+    if (order == TILE_ORDER_LINEAR) {
+        for (int y = 0; y < tiles_y; y++)
+            for (int x = 0; x < tiles_x; x++)
+                out[k++] = (uint32_t)x | (uint32_t)y << 16;
+        return;
+    }
+    for (uint32_t d = 0; d < n*n; d++) {
+        uint32_t x, y;
+        if (order == TILE_ORDER_MORTON) {
+            x = morton_compact(d);
+            y = morton_compact(d >> 1);
+        } else {
+            hilbert_point(n, d, &x, &y);
+        }
+        if (x < (uint32_t)tiles_x && y < (uint32_t)tiles_y)
+            out[k++] = x | y << 16;
+    }
+}
+
+static void compute_init(compute_path_t *c, int group_width, int group_height, tile_order_t order)
+{
+    memset(c, 0, sizeof *c);
+    c->group_width = group_width;
+    c->group_height = group_height;
+    c->order = order;
+    compute_header(c->header, sizeof c->header, group_width, group_height);
+    glGenBuffers(1, &c->tiles);
+    glGenFramebuffers(1, &c->fbo);
+}
+
+static void compute_destroy(compute_path_t *c)
+{
+    if (c->tiles) glDeleteBuffers(1, &c->tiles);
+    if (c->fbo) glDeleteFramebuffers(1, &c->fbo);
+    if (c->texture) glDeleteTextures(1, &c->texture);
+    memset(c, 0, sizeof *c);
+}
+
+// Rebuilds the tile table when the image size or the order changed.
+static void compute_update_tiles(compute_path_t *c, int width, int height)
+{
+    int tiles_x = (width + c->group_width - 1) / c->group_width;
+    int tiles_y = (height + c->group_height - 1) / c->group_height;
+    if (tiles_x == c->tiles_x && tiles_y == c->tiles_y && c->order == c->tiles_order) return;
+
+    size_t num_tiles = (size_t)tiles_x*(size_t)tiles_y;
+    uint32_t *tiles = xmalloc(num_tiles*sizeof *tiles);
+    tile_order_build(c->order, tiles_x, tiles_y, tiles);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, c->tiles);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(num_tiles*sizeof *tiles), tiles, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    free(tiles);
+    c->tiles_x = tiles_x;
+    c->tiles_y = tiles_y;
+    c->tiles_order = c->order;
+}
+
+// Runs program over a width*height image in texture, which must be as large.
+static void compute_dispatch(compute_path_t *c, GLuint program, GLuint texture, GLenum format, int width, int height)
+{
+    compute_update_tiles(c, width, height);
+    glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, format);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, c->tiles);
+    glUseProgram(program);
+    glDispatchCompute((GLuint)c->tiles_x, (GLuint)c->tiles_y, 1);
+}
+
+/*
+ * Runs program, whose uniforms are set, and blits the image to framebuffer,
+ * which is left bound.
+ */
+static void compute_draw(compute_path_t *c, GLuint program, int width, int height, GLuint framebuffer)
+{
+    if (!c->texture || c->width != width || c->height != height) {
+        if (c->texture) glDeleteTextures(1, &c->texture);
+        glGenTextures(1, &c->texture);
+        glBindTexture(GL_TEXTURE_2D, c->texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, c->fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, c->texture, 0);
+        c->width = width;
+        c->height = height;
+    }
+
+    compute_dispatch(c, program, c->texture, GL_RGBA16F, width, height);
+    glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, c->fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+typedef struct
+{
+    char label[64];
+    double time_ms;
+    double rmse;
+} tile_sweep_entry_t;
+
+static const int tile_sweep_groups[][2] = { {8, 8}, {16, 8}, {16, 16}, {32, 8}, {8, 32}, {32, 32} };
+#define TILE_SWEEP_GROUPS   (int)(sizeof tile_sweep_groups / sizeof tile_sweep_groups[0])
+
+static int tile_sweep_order(const void *a, const void *b)
+{
+    const tile_sweep_entry_t *x = a, *y = b;
+    return (x->time_ms > y->time_ms) - (x->time_ms < y->time_ms);
+}
+
+// Median GPU time of SWEEP_FRAMES dispatches in milliseconds.
+static double tile_sweep_time(compute_path_t *c, GLuint program, GLuint texture, int width, int height, const GLuint *queries)
+{
+    glUseProgram(program);
+    set_user_uniforms(width, height, SWEEP_TIME, 1.0/60.0, 0, -1, -1);
+    for (int i = 0; i < SWEEP_WARMUP; i++)
+        compute_dispatch(c, program, texture, GL_RGBA8, width, height);
+
+    for (int i = 0; i < SWEEP_FRAMES; i++) {
+        glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+        compute_dispatch(c, program, texture, GL_RGBA8, width, height);
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+    glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+    uint64_t ns[SWEEP_FRAMES];
+    for (int i = 0; i < SWEEP_FRAMES; i++)
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns[i]);
+    qsort(ns, SWEEP_FRAMES, sizeof ns[0], compare_u64);
+
+    return (double)ns[SWEEP_FRAMES/2] / 1e6;
+}
+
+/*
+ * Times source on the fragment path and on the compute path with every
+ * workgroup size and tile order, at the sweep's fixed iTime, and prints
+ * them fastest first with the RMSE against the fragment path. Custom
+ * uniforms keep their defaults, as in the variant sweep.
+ */
+static bool run_tile_sweep(GLuint vs, const char *source, int width, int height)
+{
+    char headers[TILE_SWEEP_GROUPS][1024];
+    const char *srcs[TILE_SWEEP_GROUPS][3];
+    const char **src_ptrs[TILE_SWEEP_GROUPS];
+    int num_srcs[TILE_SWEEP_GROUPS];
+    GLuint programs[TILE_SWEEP_GROUPS];
+    for (int g = 0; g < TILE_SWEEP_GROUPS; g++) {
+        compute_header(headers[g], sizeof headers[g], tile_sweep_groups[g][0], tile_sweep_groups[g][1]);
+        srcs[g][0] = headers[g];
+        srcs[g][1] = source;
+        srcs[g][2] = compute_footer_src;
+        src_ptrs[g] = srcs[g];
+        num_srcs[g] = 3;
+    }
+    const char *fs_src[3] = { fs_header_src, source, fs_footer_src };
+    GLuint fragment = load_program(vs, fs_src, 3);
+    if (!fragment) {
+        fprintf(stderr, "tile sweep: fragment program failed to build:\n%.*s\n",
+                (int)array_size(log_buffer), log_buffer ? log_buffer : "");
+        return false;
+    }
+    load_programs(0, src_ptrs, num_srcs, TILE_SWEEP_GROUPS, programs);
+
+    GLuint texture, fbo;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glViewport(0, 0, width, height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    GLuint queries[SWEEP_FRAMES];
+    glGenQueries(SWEEP_FRAMES, queries);
+
+    size_t num_pixels = (size_t)width*(size_t)height;
+    uint8_t *reference = xmalloc(num_pixels*4);
+    uint8_t *image = xmalloc(num_pixels*4);
+
+    tile_sweep_entry_t entries[1 + TILE_SWEEP_GROUPS*NUM_TILE_ORDERS];
+    int num_entries = 0;
+    entries[num_entries++] = (tile_sweep_entry_t){ "fragment", sweep_time(fragment, width, height, queries), 0.0 };
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, reference);
+
+    for (int g = 0; g < TILE_SWEEP_GROUPS; g++) {
+        if (!programs[g]) {
+            fprintf(stderr, "tile sweep: %dx%d failed to build:\n%.*s\n", tile_sweep_groups[g][0],
+                    tile_sweep_groups[g][1], (int)array_size(log_buffer), log_buffer ? log_buffer : "");
+            continue;
+        }
+        for (int o = 0; o < NUM_TILE_ORDERS; o++) {
+            compute_path_t c;
+            compute_init(&c, tile_sweep_groups[g][0], tile_sweep_groups[g][1], (tile_order_t)o);
+            tile_sweep_entry_t *e = &entries[num_entries++];
+            snprintf(e->label, sizeof e->label, "compute %dx%d %s", c.group_width, c.group_height, tile_order_names[o]);
+            e->time_ms = tile_sweep_time(&c, programs[g], texture, width, height, queries);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, image);
+            e->rmse = image_rmse(image, reference, num_pixels);
+            compute_destroy(&c);
+        }
+    }
+
+    qsort(entries, (size_t)num_entries, sizeof *entries, tile_sweep_order);
+    printf("%10s %10s  %s\n", "time(ms)", "rmse", "path");
+    for (int i = 0; i < num_entries; i++)
+        printf("%10.3f %10.4f  %s\n", entries[i].time_ms, entries[i].rmse, entries[i].label);
+
+    glDeleteQueries(SWEEP_FRAMES, queries);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &texture);
+    for (int g = 0; g < TILE_SWEEP_GROUPS; g++)
+        if (programs[g]) glDeleteProgram(programs[g]);
+    glDeleteProgram(fragment);
+    free(reference);
+    free(image);
+    return true;
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+/*
+ * Local control server. Clients connect to a Unix stream socket and send
+ * newline terminated commands, each answered with a single line starting
+ * with "ok" or "error". The socket is non-blocking and meant to be polled
+ * once per frame; control_next() hands out complete lines one at a time and
+ * the caller answers them with control_reply().
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_LINE_SIZE   1024
+
+typedef struct
+{
+    int fd;
+    size_t len;
+    char line[CONTROL_LINE_SIZE];
+} control_client_t;
+
+typedef struct
+{
+    int fd;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    control_client_t clients[CONTROL_MAX_CLIENTS];
+} control_t;
+
+static bool control_open(control_t *ctl, const char *path)
+{
+    memset(ctl, 0, sizeof *ctl);
+    ctl->fd = -1;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++)
+        ctl->clients[i].fd = -1;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "control: socket path too long\n");
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return false;
+    }
+
+    // A stale socket from a previous instance would make bind() fail.
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof addr) || listen(fd, CONTROL_MAX_CLIENTS)) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+
+    ctl->fd = fd;
+    strcpy(ctl->path, path);
+    return true;
+}
+
+static void control_close(control_t *ctl)
+{
+    if (ctl->fd < 0) return;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (ctl->clients[i].fd >= 0) close(ctl->clients[i].fd);
+        ctl->clients[i].fd = -1;
+    }
+    close(ctl->fd);
+    unlink(ctl->path);
+    ctl->fd = -1;
+}
+
+static void control_drop(control_client_t *client)
+{
+    close(client->fd);
+    client->fd = -1;
+    client->len = 0;
+}
+
+// Takes the first complete line out of the client buffer.
+static bool control_take_line(control_client_t *client, char *line)
+{
+    char *nl = memchr(client->line, '\n', client->len);
+    if (!nl) {
+        if (client->len == CONTROL_LINE_SIZE) {
+            // Overlong line, nothing sensible can be done with it.
+            control_drop(client);
+        }
+        return false;
+    }
+
+    size_t n = (size_t)(nl - client->line);
+    memcpy(line, client->line, n);
+    line[n] = 0;
+    if (n > 0 && line[n-1] == '\r') line[n-1] = 0;
+    client->len -= n + 1;
+    memmove(client->line, nl + 1, client->len);
+    return true;
+}
+
+/*
+ * Accepts pending connections, reads whatever is available and returns the
+ * next complete command line in line (CONTROL_LINE_SIZE bytes) along with
+ * the index of the client that sent it. Returns false once nothing is left.
+ */
+static bool control_next(control_t *ctl, char *line, int *client_index)
+{
+    if (ctl->fd < 0) return false;
+
+    for (;;) {
+        int fd = accept(ctl->fd, NULL, NULL);
+        if (fd < 0) break;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        int i = 0;
+        while (i < CONTROL_MAX_CLIENTS && ctl->clients[i].fd >= 0) i++;
+        if (i == CONTROL_MAX_CLIENTS) {
+            static const char busy[] = "error too many clients\n";
+            ssize_t n = write(fd, busy, sizeof busy - 1);
+            (void)n;
+            close(fd);
+            continue;
+        }
+        ctl->clients[i].fd = fd;
+        ctl->clients[i].len = 0;
+    }
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        control_client_t *client = &ctl->clients[i];
+        if (client->fd < 0) continue;
+
+        if (control_take_line(client, line)) {
+            *client_index = i;
+            return true;
+        }
+        if (client->fd < 0) continue;
+
+        ssize_t n = read(client->fd, client->line + client->len, CONTROL_LINE_SIZE - client->len);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            control_drop(client);
+            continue;
+        }
+        if (n > 0) client->len += (size_t)n;
+
+        if (control_take_line(client, line)) {
+            *client_index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Replies are short, a client that cannot take one is dropped rather than waited on.
+static void control_reply(control_t *ctl, int client_index, const char *fmt, ...)
+{
+    control_client_t *client = &ctl->clients[client_index];
+    if (client->fd < 0) return;
+
+    char buf[CONTROL_LINE_SIZE];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof buf - 1, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n > sizeof buf - 2) n = (int)sizeof buf - 2;
+    buf[n++] = '\n';
+
+    if (send(client->fd, buf, (size_t)n, MSG_NOSIGNAL) != n)
+        control_drop(client);
+}
+
+#endif
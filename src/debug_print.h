@@ -0,0 +1,196 @@
+#ifndef DEBUG_PRINT_H
+#define DEBUG_PRINT_H
+
+/*
+ * debugPrint() for shaders. The fragment header defines it as an empty
+ * macro, so calls cost nothing unless --debug-print adds debug_print_src,
+ * which defines it for real: the fragment at the selected pixel appends a
+ * record of its source line and value to a storage buffer through an
+ * atomic counter, every other fragment returns at once. Records are read
+ * back through a readback_ring_t; a dropped frame selects no pixel.
+ *
+ *     debugPrint(uv);           // line 12: vec2(0.25, 0.5)
+ */
+
+#include "gl.h"
+#include "memory.h"
+#include "readback.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Both are repeated in debug_print_src.
+#define DEBUG_PRINT_RECORDS 64
+#define DEBUG_PRINT_BINDING 2
+#define DEBUG_PRINT_BUFFERS 3
+#define ULOC_DEBUG_PIXEL    5
+
+enum { DEBUG_PRINT_FLOAT, DEBUG_PRINT_INT, DEBUG_PRINT_UINT, DEBUG_PRINT_BOOL };
+
+// Matches the std430 DebugPrint block.
+typedef struct
+{
+    uint32_t line;
+    uint32_t type;
+    uint32_t count;
+    uint32_t pad;
+    uint32_t values[4];
+} debug_record_t;
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t pad[3];
+    debug_record_t records[DEBUG_PRINT_RECORDS];
+} debug_print_result_t;
+
+typedef struct
+{
+    readback_ring_t ring;
+    int pixels[DEBUG_PRINT_BUFFERS][2]; // Pixel each buffer of the ring was filled for
+    bool issued;    // A buffer was bound for the current frame
+    char *text;     // The latest records, formatted
+} debug_print_t;
+
+// Follows the fragment header and replaces its empty debugPrint().
+static const char *debug_print_src =
+    "#undef debugPrint\n"
+    "#define debugPrint(v) debugPrint_(__LINE__, v)\n"
+    "layout(location = 5) uniform vec2 iDebugPixel;\n"
+    "layout(std430, binding = 2) buffer DebugPrint {\n"
+    "    uint debugCount;\n"
+    "    uvec4 debugRecords[];\n"
+    "};\n"
+    "void debugWrite_(int line, uint type, uint count, uvec4 v) {\n"
+    "    if (ivec2(gl_FragCoord.xy) != ivec2(iDebugPixel)) return;\n"
+    "    uint i = atomicAdd(debugCount, 1u);\n"
+    "    if (i >= 64u) return;\n"
+    "    debugRecords[2u*i] = uvec4(uint(line), type, count, 0u);\n"
+    "    debugRecords[2u*i + 1u] = v;\n"
+    "}\n"
+    "void debugPrint_(int l, float v) { debugWrite_(l, 0u, 1u, floatBitsToUint(vec4(v, 0, 0, 0))); }\n"
+    "void debugPrint_(int l, vec2 v) { debugWrite_(l, 0u, 2u, floatBitsToUint(vec4(v, 0, 0))); }\n"
+    "void debugPrint_(int l, vec3 v) { debugWrite_(l, 0u, 3u, floatBitsToUint(vec4(v, 0))); }\n"
+    "void debugPrint_(int l, vec4 v) { debugWrite_(l, 0u, 4u, floatBitsToUint(v)); }\n"
+    "void debugPrint_(int l, int v) { debugWrite_(l, 1u, 1u, uvec4(v, 0, 0, 0)); }\n"
+    "void debugPrint_(int l, ivec2 v) { debugWrite_(l, 1u, 2u, uvec4(ivec4(v, 0, 0))); }\n"
+    "void debugPrint_(int l, ivec3 v) { debugWrite_(l, 1u, 3u, uvec4(ivec4(v, 0))); }\n"
+    "void debugPrint_(int l, ivec4 v) { debugWrite_(l, 1u, 4u, uvec4(v)); }\n"
+    "void debugPrint_(int l, uint v) { debugWrite_(l, 2u, 1u, uvec4(v, 0u, 0u, 0u)); }\n"
+    "void debugPrint_(int l, uvec2 v) { debugWrite_(l, 2u, 2u, uvec4(v, 0u, 0u)); }\n"
+    "void debugPrint_(int l, uvec3 v) { debugWrite_(l, 2u, 3u, uvec4(v, 0u)); }\n"
+    "void debugPrint_(int l, uvec4 v) { debugWrite_(l, 2u, 4u, v); }\n"
+    "void debugPrint_(int l, bool v) { debugWrite_(l, 3u, 1u, uvec4(uint(v), 0u, 0u, 0u)); }\n"
+    "void debugPrint_(int l, bvec2 v) { debugWrite_(l, 3u, 2u, uvec4(uvec2(v), 0u, 0u)); }\n"
+    "void debugPrint_(int l, bvec3 v) { debugWrite_(l, 3u, 3u, uvec4(uvec3(v), 0u)); }\n"
+    "void debugPrint_(int l, bvec4 v) { debugWrite_(l, 3u, 4u, uvec4(v)); }\n"
+    // Some drivers count __LINE__ from the first string rather than the user's.
+    "#line 1\n";
+
+// The fragment header followed by debug_print_src, for the caller to free.
+static char *debug_print_header(const char *header)
+{
+    size_t a = strlen(header), b = strlen(debug_print_src);
+    char *s = xmalloc(a + b + 1);
+    memcpy(s, header, a);
+    memcpy(s + a, debug_print_src, b + 1);
+    return s;
+}
+
+static void debug_print_destroy(debug_print_t *d)
+{
+    readback_destroy(&d->ring);
+    array_free(d->text);
+    memset(d, 0, sizeof *d);
+}
+
+static void debug_print_init(debug_print_t *d)
+{
+    memset(d, 0, sizeof *d);
+    readback_init(&d->ring, GL_SHADER_STORAGE_BUFFER, DEBUG_PRINT_BUFFERS);
+}
+
+static void debug_print_append(debug_print_t *d, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void debug_print_append(debug_print_t *d, const char *fmt, ...)
+{
+    char buf[160];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof buf, fmt, args);
+    va_end(args);
+    if (len < 0) return;
+    if ((size_t)len >= sizeof buf) len = sizeof buf - 1;
+    for (int i = 0; i < len; i++)
+        array_push_back(d->text, buf[i]);
+}
+
+// Formats the records of a buffer whose fence has signalled.
+static void debug_print_format(void *user, int index, const void *data, GLsizeiptr size)
+{
+    (void)size;
+    debug_print_t *d = user;
+    const debug_print_result_t *r = data;
+    static const char *types[4][4] = {
+        { "float", "vec2", "vec3", "vec4" },
+        { "int", "ivec2", "ivec3", "ivec4" },
+        { "uint", "uvec2", "uvec3", "uvec4" },
+        { "bool", "bvec2", "bvec3", "bvec4" },
+    };
+    array_clear(d->text);
+    debug_print_append(d, "debugPrint at %d, %d\n", d->pixels[index][0], d->pixels[index][1]);
+    uint32_t count = r->count < DEBUG_PRINT_RECORDS ? r->count : DEBUG_PRINT_RECORDS;
+    for (uint32_t i = 0; i < count; i++) {
+        const debug_record_t *rec = &r->records[i];
+        if (rec->type > DEBUG_PRINT_BOOL || rec->count < 1 || rec->count > 4) continue;
+        debug_print_append(d, "line %u: %s%s", rec->line, types[rec->type][rec->count - 1], rec->count > 1 ? "(" : " ");
+        for (uint32_t c = 0; c < rec->count; c++) {
+            const char *sep = c + 1 < rec->count ? ", " : rec->count > 1 ? ")\n" : "\n";
+            uint32_t bits = rec->values[c];
+            float f;
+            switch (rec->type) {
+                case DEBUG_PRINT_FLOAT: memcpy(&f, &bits, sizeof f); debug_print_append(d, "%g%s", (double)f, sep); break;
+                case DEBUG_PRINT_INT: debug_print_append(d, "%d%s", (int32_t)bits, sep); break;
+                case DEBUG_PRINT_UINT: debug_print_append(d, "%u%s", bits, sep); break;
+                default: debug_print_append(d, "%s%s", bits ? "true" : "false", sep); break;
+            }
+        }
+    }
+    if (r->count > DEBUG_PRINT_RECORDS)
+        debug_print_append(d, "%u more\n", r->count - DEBUG_PRINT_RECORDS);
+}
+
+/*
+ * Binds a cleared buffer for the pixel at x, y, in fragment coordinates,
+ * and sets iDebugPixel of the bound program. Call before the draw.
+ */
+static void debug_print_begin(debug_print_t *d, int x, int y)
+{
+    readback_collect(&d->ring, debug_print_format, d);
+    int index = readback_begin(&d->ring, sizeof(debug_print_result_t));
+    d->issued = index >= 0;
+    if (!d->issued) {
+        // No pixel matches, the buffer is never touched.
+        glUniform2f(ULOC_DEBUG_PIXEL, -1.0f, -1.0f);
+        return;
+    }
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DEBUG_PRINT_BINDING, d->ring.buffers[index]);
+    glUniform2f(ULOC_DEBUG_PIXEL, (float)x, (float)y);
+    d->pixels[index][0] = x;
+    d->pixels[index][1] = y;
+}
+
+// Fences the records of the draw since debug_print_begin().
+static void debug_print_end(debug_print_t *d)
+{
+    if (!d->issued) return;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    readback_end(&d->ring);
+    d->issued = false;
+}
+
+#endif
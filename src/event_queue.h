@@ -0,0 +1,64 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+/*
+ * Single-producer single-consumer queue of platform events, from the thread
+ * reading the window system to the render thread. Each index is written by
+ * one side only and published with a release store that the other side
+ * loads with acquire, so neither ever waits on a lock. Each side caches the
+ * other's index on its own cache line and only reloads it when the queue
+ * looks full or empty.
+ */
+
+#include "platform.h"
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define EVENT_QUEUE_SIZE    256     // Power of two
+
+typedef struct
+{
+    alignas(64) atomic_size_t head;     // Next to pop, written by the consumer
+    size_t tail_cache;
+    alignas(64) atomic_size_t tail;     // Next to push, written by the producer
+    size_t head_cache;
+    alignas(64) platform_event_t events[EVENT_QUEUE_SIZE];
+} event_queue_t;
+
+static void event_queue_init(event_queue_t *q)
+{
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    q->tail_cache = 0;
+    q->head_cache = 0;
+}
+
+// Producer side, false if the queue is full.
+static inline bool event_queue_push(event_queue_t *q, const platform_event_t *e)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail - q->head_cache == EVENT_QUEUE_SIZE) {
+        q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (tail - q->head_cache == EVENT_QUEUE_SIZE) return false;
+    }
+    q->events[tail & (EVENT_QUEUE_SIZE - 1)] = *e;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// Consumer side, false if the queue is empty.
+static inline bool event_queue_pop(event_queue_t *q, platform_event_t *e)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head == q->tail_cache) {
+        q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (head == q->tail_cache) return false;
+    }
+    *e = q->events[head & (EVENT_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
+
+#endif
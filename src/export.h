@@ -0,0 +1,194 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+/*
+ * Frame export through a POSIX shared memory ring. The segment starts with
+ * an export_header_t followed by num_slots payloads of slot_size bytes at
+ * data_offset. Frames are read back through a readback_ring_t of pixel pack
+ * buffers, so the render loop never waits on the GPU or on consumers.
+ *
+ * Consumers map the segment read-only and wait on the futex word, which is
+ * bumped after every publish. A slot is consistent if its sequence reads
+ * the same non-zero value before and after the payload is used. When the
+ * frame size outgrows slot_size the segment is grown, consumers should
+ * remap once slot_size changes.
+ */
+
+#include "gl.h"
+#include "readback.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define EXPORT_MAGIC        0x58455354 // "TSEX"
+#define EXPORT_VERSION      1
+#define EXPORT_SLOTS        4
+#define EXPORT_PBOS         3
+
+#define EXPORT_FORMAT_RGBA8 1
+#define EXPORT_FLAG_BOTTOM_UP 1 // Rows are stored bottom to top, as GL returns them
+
+typedef struct
+{
+    _Atomic uint64_t sequence; // Frame number, 0 while the slot is being written
+    uint64_t timestamp_ns;     // CLOCK_MONOTONIC at readback
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+    uint32_t flags;
+    uint32_t size;
+} export_slot_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t slot_size;
+    uint64_t data_offset;
+    _Atomic uint64_t sequence; // Last published frame
+    _Atomic uint32_t futex;
+    uint32_t reserved;
+    export_slot_t slots[EXPORT_SLOTS];
+} export_header_t;
+
+typedef struct
+{
+    int width;
+    int height;
+    uint64_t timestamp_ns;
+} export_frame_t;
+
+typedef struct
+{
+    int fd;
+    char name[NAME_MAX];
+    export_header_t *header;
+    size_t map_size;
+    uint64_t sequence;
+
+    readback_ring_t ring;
+    export_frame_t frames[EXPORT_PBOS];    // What each buffer of the ring holds
+} export_t;
+
+static bool export_resize(export_t *ex, uint32_t slot_size)
+{
+    uint64_t data_offset = (sizeof(export_header_t) + 4095) & ~(uint64_t)4095;
+    size_t size = (size_t)data_offset + (size_t)slot_size*EXPORT_SLOTS;
+    if (ftruncate(ex->fd, (off_t)size)) {
+        perror("ftruncate");
+        return false;
+    }
+
+    if (ex->header) munmap(ex->header, ex->map_size);
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, ex->fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        ex->header = NULL;
+        return false;
+    }
+
+    ex->header = p;
+    ex->map_size = size;
+    ex->header->magic = EXPORT_MAGIC;
+    ex->header->version = EXPORT_VERSION;
+    ex->header->num_slots = EXPORT_SLOTS;
+    ex->header->data_offset = data_offset;
+    ex->header->slot_size = slot_size;
+    return true;
+}
+
+static bool export_open(export_t *ex, const char *name)
+{
+    memset(ex, 0, sizeof *ex);
+    if (strlen(name) >= sizeof ex->name) return false;
+
+    ex->fd = shm_open(name, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (ex->fd < 0) {
+        perror(name);
+        return false;
+    }
+    strcpy(ex->name, name);
+
+    if (!export_resize(ex, 0)) {
+        close(ex->fd);
+        shm_unlink(name);
+        ex->fd = -1;
+        return false;
+    }
+
+    readback_init(&ex->ring, GL_PIXEL_PACK_BUFFER, EXPORT_PBOS);
+    return true;
+}
+
+static void export_close(export_t *ex)
+{
+    if (!ex->header) return;
+    readback_destroy(&ex->ring);
+    munmap(ex->header, ex->map_size);
+    close(ex->fd);
+    shm_unlink(ex->name);
+    ex->header = NULL;
+}
+
+static void export_publish(void *user, int index, const void *pixels, GLsizeiptr mapped)
+{
+    export_t *ex = user;
+    const export_frame_t *f = &ex->frames[index];
+    uint32_t size = (uint32_t)mapped;
+    if (size > ex->header->slot_size && !export_resize(ex, size)) return;
+
+    export_header_t *h = ex->header;
+    uint64_t seq = ++ex->sequence;
+    export_slot_t *slot = &h->slots[seq % EXPORT_SLOTS];
+
+    atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy((char *)h + h->data_offset + (size_t)(seq % EXPORT_SLOTS)*h->slot_size, pixels, size);
+    slot->timestamp_ns = f->timestamp_ns;
+    slot->width = (uint32_t)f->width;
+    slot->height = (uint32_t)f->height;
+    slot->stride = (uint32_t)f->width*4;
+    slot->format = EXPORT_FORMAT_RGBA8;
+    slot->flags = EXPORT_FLAG_BOTTOM_UP;
+    slot->size = size;
+    atomic_store_explicit(&slot->sequence, seq, memory_order_release);
+    atomic_store_explicit(&h->sequence, seq, memory_order_release);
+
+    atomic_fetch_add_explicit(&h->futex, 1, memory_order_release);
+    syscall(SYS_futex, &h->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Starts an asynchronous readback of the bound read framebuffer.
+static void export_frame(export_t *ex, int width, int height)
+{
+    if (!ex->header) return;
+
+    readback_collect(&ex->ring, export_publish, ex);
+    int index = readback_begin(&ex->ring, (GLsizeiptr)width*height*4);
+    if (index < 0) return;
+
+    export_frame_t *f = &ex->frames[index];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    f->timestamp_ns = (uint64_t)now.tv_sec*1000000000u + (uint64_t)now.tv_nsec;
+    f->width = width;
+    f->height = height;
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback_end(&ex->ring);
+}
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef FFT_H
+#define FFT_H
+
+/*
+ * Complex FFT of a power of two size on split real and imaginary arrays.
+ * It is a Stockham autosort transform: each radix-4 stage reads one buffer
+ * and writes the other in order, so there is no bit reversal pass, and a
+ * radix-2 stage finishes odd powers of two. With SSE, every butterfly loop
+ * runs four at a time: the later stages along their contiguous stride, the
+ * first one, whose stride is 1, along the twiddle index with the outputs
+ * transposed into place.
+ */
+
+#include "memory.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#define FFT_SSE 1
+#endif
+
+typedef struct
+{
+    int n;
+    float *twiddles;    // Per radix-4 stage of length m: w, w^2, w^3 for p < m/4, real parts then imaginary
+    float *scratch;     // 2*n, the buffers the stages alternate with
+} fft_t;
+
+// n must be a power of two of at least 4.
+static void fft_init(fft_t *f, int n)
+{
+    f->n = n;
+    size_t size = 0;
+    for (int m = n; m >= 4; m /= 4)
+        size += (size_t)(m/4)*6;
+    f->twiddles = xmalloc(size*sizeof *f->twiddles);
+    f->scratch = xmalloc((size_t)n*2*sizeof *f->scratch);
+
+    float *tw = f->twiddles;
+    for (int m = n; m >= 4; m /= 4) {
+        int q = m/4;
+        for (int p = 0; p < q; p++) {
+            for (int k = 1; k <= 3; k++) {
+                double a = -2.0*M_PI*(double)(k*p)/(double)m;
+                tw[(k-1)*2*q + p] = (float)cos(a);
+                tw[(k-1)*2*q + q + p] = (float)sin(a);
+            }
+        }
+        tw += q*6;
+    }
+}
+
+static void fft_destroy(fft_t *f)
+{
+    free(f->twiddles);
+    free(f->scratch);
+    memset(f, 0, sizeof *f);
+}
+
+#ifdef FFT_SSE
+static inline void fft_cmul4(__m128 ar, __m128 ai, __m128 wr, __m128 wi, __m128 *r, __m128 *i)
+{
+    *r = _mm_sub_ps(_mm_mul_ps(ar, wr), _mm_mul_ps(ai, wi));
+    *i = _mm_add_ps(_mm_mul_ps(ar, wi), _mm_mul_ps(ai, wr));
+}
+#endif
+
+/*
+ * One radix-4 stage over sequences of length m with stride s: element
+ * q + s*p of each quarter goes to q + s*(4p + k), times w^(k*p).
+ */
+static void fft_radix4(int m, int s, const float *tw, const float *xr, const float *xi, float *yr, float *yi)
+{
+    const int q4 = m/4;
+    const float *w1r = tw, *w1i = tw + q4, *w2r = tw + 2*q4, *w2i = tw + 3*q4, *w3r = tw + 4*q4, *w3i = tw + 5*q4;
+    const int n1 = s*q4;
+    int p = 0;
+#ifdef FFT_SSE
+    if (s == 1) {
+        for (; p + 4 <= q4; p += 4) {
+            __m128 ar = _mm_loadu_ps(xr + p), ai = _mm_loadu_ps(xi + p);
+            __m128 br = _mm_loadu_ps(xr + p + n1), bi = _mm_loadu_ps(xi + p + n1);
+            __m128 cr = _mm_loadu_ps(xr + p + 2*n1), ci = _mm_loadu_ps(xi + p + 2*n1);
+            __m128 dr = _mm_loadu_ps(xr + p + 3*n1), di = _mm_loadu_ps(xi + p + 3*n1);
+            __m128 apcr = _mm_add_ps(ar, cr), apci = _mm_add_ps(ai, ci);
+            __m128 amcr = _mm_sub_ps(ar, cr), amci = _mm_sub_ps(ai, ci);
+            __m128 bpdr = _mm_add_ps(br, dr), bpdi = _mm_add_ps(bi, di);
+            // j*(b - d)
+            __m128 jr = _mm_sub_ps(di, bi), ji = _mm_sub_ps(br, dr);
+            __m128 y0r = _mm_add_ps(apcr, bpdr), y0i = _mm_add_ps(apci, bpdi);
+            __m128 y1r, y1i, y2r, y2i, y3r, y3i;
+            fft_cmul4(_mm_sub_ps(amcr, jr), _mm_sub_ps(amci, ji), _mm_loadu_ps(w1r + p), _mm_loadu_ps(w1i + p), &y1r, &y1i);
+            fft_cmul4(_mm_sub_ps(apcr, bpdr), _mm_sub_ps(apci, bpdi), _mm_loadu_ps(w2r + p), _mm_loadu_ps(w2i + p), &y2r, &y2i);
+            fft_cmul4(_mm_add_ps(amcr, jr), _mm_add_ps(amci, ji), _mm_loadu_ps(w3r + p), _mm_loadu_ps(w3i + p), &y3r, &y3i);
+            // Lane l of yk belongs at 4*(p + l) + k.
+            _MM_TRANSPOSE4_PS(y0r, y1r, y2r, y3r);
+            _MM_TRANSPOSE4_PS(y0i, y1i, y2i, y3i);
+            _mm_storeu_ps(yr + 4*p, y0r);
+            _mm_storeu_ps(yr + 4*p + 4, y1r);
+            _mm_storeu_ps(yr + 4*p + 8, y2r);
+            _mm_storeu_ps(yr + 4*p + 12, y3r);
+            _mm_storeu_ps(yi + 4*p, y0i);
+            _mm_storeu_ps(yi + 4*p + 4, y1i);
+            _mm_storeu_ps(yi + 4*p + 8, y2i);
+            _mm_storeu_ps(yi + 4*p + 12, y3i);
+        }
+    }
+#endif
+    for (; p < q4; p++) {
+        const float w1[2] = { w1r[p], w1i[p] }, w2[2] = { w2r[p], w2i[p] }, w3[2] = { w3r[p], w3i[p] };
+        const float *ar = xr + s*p, *ai = xi + s*p;
+        float *zr = yr + s*4*p, *zi = yi + s*4*p;
+        int q = 0;
+#ifdef FFT_SSE
+        const __m128 v1r = _mm_set1_ps(w1[0]), v1i = _mm_set1_ps(w1[1]);
+        const __m128 v2r = _mm_set1_ps(w2[0]), v2i = _mm_set1_ps(w2[1]);
+        const __m128 v3r = _mm_set1_ps(w3[0]), v3i = _mm_set1_ps(w3[1]);
+        for (; q + 4 <= s; q += 4) {
+            __m128 a_r = _mm_loadu_ps(ar + q), a_i = _mm_loadu_ps(ai + q);
+            __m128 b_r = _mm_loadu_ps(ar + q + n1), b_i = _mm_loadu_ps(ai + q + n1);
+            __m128 c_r = _mm_loadu_ps(ar + q + 2*n1), c_i = _mm_loadu_ps(ai + q + 2*n1);
+            __m128 d_r = _mm_loadu_ps(ar + q + 3*n1), d_i = _mm_loadu_ps(ai + q + 3*n1);
+            __m128 apcr = _mm_add_ps(a_r, c_r), apci = _mm_add_ps(a_i, c_i);
+            __m128 amcr = _mm_sub_ps(a_r, c_r), amci = _mm_sub_ps(a_i, c_i);
+            __m128 bpdr = _mm_add_ps(b_r, d_r), bpdi = _mm_add_ps(b_i, d_i);
+            __m128 jr = _mm_sub_ps(d_i, b_i), ji = _mm_sub_ps(b_r, d_r);
+            __m128 r, i;
+            _mm_storeu_ps(zr + q, _mm_add_ps(apcr, bpdr));
+            _mm_storeu_ps(zi + q, _mm_add_ps(apci, bpdi));
+            fft_cmul4(_mm_sub_ps(amcr, jr), _mm_sub_ps(amci, ji), v1r, v1i, &r, &i);
+            _mm_storeu_ps(zr + s + q, r);
+            _mm_storeu_ps(zi + s + q, i);
+            fft_cmul4(_mm_sub_ps(apcr, bpdr), _mm_sub_ps(apci, bpdi), v2r, v2i, &r, &i);
+            _mm_storeu_ps(zr + 2*s + q, r);
+            _mm_storeu_ps(zi + 2*s + q, i);
+            fft_cmul4(_mm_add_ps(amcr, jr), _mm_add_ps(amci, ji), v3r, v3i, &r, &i);
+            _mm_storeu_ps(zr + 3*s + q, r);
+            _mm_storeu_ps(zi + 3*s + q, i);
+        }
+#endif
+        for (; q < s; q++) {
+            float apcr = ar[q] + ar[q + 2*n1], apci = ai[q] + ai[q + 2*n1];
+            float amcr = ar[q] - ar[q + 2*n1], amci = ai[q] - ai[q + 2*n1];
+            float bpdr = ar[q + n1] + ar[q + 3*n1], bpdi = ai[q + n1] + ai[q + 3*n1];
+            float jr = ai[q + 3*n1] - ai[q + n1], ji = ar[q + n1] - ar[q + 3*n1];
+            float tr, ti;
+            zr[q] = apcr + bpdr;
+            zi[q] = apci + bpdi;
+            tr = amcr - jr, ti = amci - ji;
+            zr[s + q] = tr*w1[0] - ti*w1[1];
+            zi[s + q] = tr*w1[1] + ti*w1[0];
+            tr = apcr - bpdr, ti = apci - bpdi;
+            zr[2*s + q] = tr*w2[0] - ti*w2[1];
+            zi[2*s + q] = tr*w2[1] + ti*w2[0];
+            tr = amcr + jr, ti = amci + ji;
+            zr[3*s + q] = tr*w3[0] - ti*w3[1];
+            zi[3*s + q] = tr*w3[1] + ti*w3[0];
+        }
+    }
+}
+
+// The last stage of odd powers of two, length 2 with stride s.
+static void fft_radix2(int s, const float *xr, const float *xi, float *yr, float *yi)
+{
+    int q = 0;
+#ifdef FFT_SSE
+    for (; q + 4 <= s; q += 4) {
+        __m128 ar = _mm_loadu_ps(xr + q), ai = _mm_loadu_ps(xi + q);
+        __m128 br = _mm_loadu_ps(xr + q + s), bi = _mm_loadu_ps(xi + q + s);
+        _mm_storeu_ps(yr + q, _mm_add_ps(ar, br));
+        _mm_storeu_ps(yi + q, _mm_add_ps(ai, bi));
+        _mm_storeu_ps(yr + q + s, _mm_sub_ps(ar, br));
+        _mm_storeu_ps(yi + q + s, _mm_sub_ps(ai, bi));
+    }
+#endif
+    for (; q < s; q++) {
+        float ar = xr[q], ai = xi[q], br = xr[q + s], bi = xi[q + s];
+        yr[q] = ar + br;
+        yi[q] = ai + bi;
+        yr[q + s] = ar - br;
+        yi[q + s] = ai - bi;
+    }
+}
+
+// Forward transform of n complex values in place, unscaled: X[k] = sum x[j] e^(-2 pi i jk/n).
+static void fft_forward(fft_t *f, float *re, float *im)
+{
+    float *xr = re, *xi = im;
+    float *yr = f->scratch, *yi = f->scratch + f->n;
+    const float *tw = f->twiddles;
+    int m = f->n, s = 1;
+    for (; m >= 4; m /= 4, s *= 4) {
+        fft_radix4(m, s, tw, xr, xi, yr, yi);
+        tw += (m/4)*6;
+        float *t = xr; xr = yr; yr = t;
+        t = xi; xi = yi; yi = t;
+    }
+    if (m == 2) {
+        fft_radix2(s, xr, xi, yr, yi);
+        float *t = xr; xr = yr; yr = t;
+        t = xi; xi = yi; yi = t;
+    }
+    if (xr != re) {
+        memcpy(re, xr, (size_t)f->n*sizeof *re);
+        memcpy(im, xi, (size_t)f->n*sizeof *im);
+    }
+}
+
+#endif
@@ -660,10 +660,12 @@ static const uint8_t font_data[20224] = {
 
 static const glyph_t *glyph_data = (const glyph_t*)font_data;
 
+// Bytes outside 32...127 map to the first glyph, whether char is signed or not.
 static inline const glyph_t *get_glyph(char c)
 {
-    if (c < 32) return &glyph_data[0];
-    return &glyph_data[(int)c-32];
+    unsigned char u = (unsigned char)c;
+    if (u < 32 || u >= 32 + NUM_GLYPHS) return &glyph_data[0];
+    return &glyph_data[u - 32];
 }
 
 #endif
@@ -0,0 +1,382 @@
+#ifndef GALLERY_H
+#define GALLERY_H
+
+/*
+ * Gallery of every shader in a directory, each drawn into its own tile of
+ * the window. All programs share the context, vertex shader and VAO; a
+ * tile holds its program, a framebuffer of the tile size and a timer
+ * query. One inotify watch on the directory reports saved, added and
+ * removed files, and content hashes skip saves that changed nothing.
+ *
+ * Drawing is time sliced. Each frame the tiles most overdue are drawn
+ * until their estimated GPU time fills the budget, the others show their
+ * last image. Tiles on screen are due every frame, the one under the
+ * pointer first; tiles scrolled out of view are due once a second and
+ * shaders that read none of iTime, iTimeDelta and iFrame are drawn once
+ * after each build, and while the pointer is over them if they read iMouse.
+ */
+
+#include "common.h"
+#include "gl.h"
+#include "memory.h"
+#include "shader.h"
+#include "source.h"
+#include <dirent.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define GALLERY_TILE_WIDTH      320
+#define GALLERY_TILE_HEIGHT     180
+#define GALLERY_GAP             8       // Pixels between tiles, the label goes in the gap below
+#define GALLERY_SCROLL_STEP     60      // Pixels per wheel step
+#define GALLERY_OFFSCREEN_INTERVAL 1.0  // Seconds between draws of tiles out of view
+#define GALLERY_BUILD_MS        8.0     // CPU time spent submitting builds per frame
+#define GALLERY_DEFAULT_COST    1.0     // GPU ms assumed for a tile not timed yet
+#define GALLERY_COST_WEIGHT     0.2     // Weight of the newest sample in a tile's GPU time
+
+typedef struct
+{
+    char *path;
+    const char *name;           // File name within path
+    uint64_t hash;              // Of the source the program was built from
+    bool stale;                 // The file changed since it was last read
+    bool building;
+    program_job_t job;
+    GLuint program;
+    bool animated;              // Reads iTime, iTimeDelta or iFrame
+    bool interactive;           // Reads iMouse
+    bool drawn;                 // The framebuffer holds an image of program
+    char error[96];             // First line of the last failed build
+    GLuint fbo;
+    GLuint texture;
+    GLuint timer;
+    bool timer_pending;
+    double cost_ms;
+    double last_draw;           // Seconds, on the gallery_draw() clock
+    int frames;
+} gallery_tile_t;
+
+typedef struct
+{
+    const char *dir;
+    int inotify_fd;
+    gallery_tile_t *tiles;      // Sorted by name
+    int tile_width;
+    int tile_height;
+    int label_height;           // Of the gap below each tile
+    double budget_ms;
+    int scroll;                 // Pixels the grid is scrolled up
+    int drawn;                  // Tiles drawn in the last frame
+} gallery_t;
+
+static bool gallery_is_shader(const char *name)
+{
+    size_t len = strlen(name);
+    return name[0] != '.' && len > 5 && (!strcmp(name + len - 5, ".glsl") || !strcmp(name + len - 5, ".frag"));
+}
+
+static void gallery_tile_free(gallery_tile_t *t)
+{
+    if (t->building) program_cancel(&t->job);
+    if (t->program) glDeleteProgram(t->program);
+    if (t->fbo) glDeleteFramebuffers(1, &t->fbo);
+    if (t->texture) glDeleteTextures(1, &t->texture);
+    if (t->timer) glDeleteQueries(1, &t->timer);
+    free(t->path);
+}
+
+static int gallery_find(const gallery_t *g, const char *name)
+{
+    for (size_t i = 0; i < array_size(g->tiles); i++)
+        if (!strcmp(g->tiles[i].name, name)) return (int)i;
+    return -1;
+}
+
+// Marks the tile of name stale, adding it in name order if it is new.
+static void gallery_add(gallery_t *g, const char *name)
+{
+    int i = gallery_find(g, name);
+    if (i >= 0) {
+        g->tiles[i].stale = true;
+        return;
+    }
+
+    size_t at = 0, n = array_size(g->tiles);
+    while (at < n && strcmp(g->tiles[at].name, name) < 0) at++;
+    (void)array_reserve(g->tiles, 1);
+    memmove(&g->tiles[at + 1], &g->tiles[at], (n - at)*sizeof *g->tiles);
+
+    gallery_tile_t *t = &g->tiles[at];
+    *t = (gallery_tile_t){ .stale = true, .cost_ms = GALLERY_DEFAULT_COST };
+    size_t dir_len = strlen(g->dir), name_len = strlen(name);
+    t->path = xmalloc(dir_len + name_len + 2);
+    memcpy(t->path, g->dir, dir_len);
+    t->path[dir_len] = '/';
+    memcpy(t->path + dir_len + 1, name, name_len + 1);
+    t->name = t->path + dir_len + 1;
+}
+
+static void gallery_remove(gallery_t *g, const char *name)
+{
+    int i = gallery_find(g, name);
+    if (i < 0) return;
+    gallery_tile_free(&g->tiles[i]);
+    size_t n = array_size(g->tiles);
+    memmove(&g->tiles[i], &g->tiles[i + 1], (n - (size_t)i - 1)*sizeof *g->tiles);
+    array_header(g->tiles)->size--;
+}
+
+static void gallery_close(gallery_t *g)
+{
+    for (size_t i = 0; i < array_size(g->tiles); i++)
+        gallery_tile_free(&g->tiles[i]);
+    array_free(g->tiles);
+    if (g->inotify_fd >= 0) close(g->inotify_fd);
+    memset(g, 0, sizeof *g);
+    g->inotify_fd = -1;
+}
+
+// The watch is set up before the directory is listed, so no file slips between them.
+static bool gallery_open(gallery_t *g, const char *dir, int tile_width, int tile_height, double budget_ms)
+{
+    *g = (gallery_t){ .dir = dir, .tile_width = tile_width, .tile_height = tile_height, .budget_ms = budget_ms };
+    g->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g->inotify_fd < 0) {
+        perror("inotify_init1");
+        return false;
+    }
+    if (inotify_add_watch(g->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+        perror(dir);
+        gallery_close(g);
+        return false;
+    }
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        gallery_close(g);
+        return false;
+    }
+    struct dirent *e;
+    while ((e = readdir(d)))
+        if (gallery_is_shader(e->d_name)) gallery_add(g, e->d_name);
+    closedir(d);
+
+    if (!array_size(g->tiles)) fprintf(stderr, "%s: no .glsl or .frag files yet.\n", dir);
+    return true;
+}
+
+static double gallery_ms_since(const struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double)(t1.tv_sec - t0->tv_sec)*1e3 + (double)(t1.tv_nsec - t0->tv_nsec)/1e6;
+}
+
+static void gallery_built(gallery_tile_t *t)
+{
+    GLuint program = program_finish(&t->job);
+    t->building = false;
+    if (!program) {
+        // The last good program keeps drawing, the label shows the error.
+        size_t len = array_size(log_buffer);
+        const char *eol = len ? memchr(log_buffer, '\n', len) : NULL;
+        if (eol) len = (size_t)(eol - log_buffer);
+        if (len >= sizeof t->error) len = sizeof t->error - 1;
+        memcpy(t->error, log_buffer ? log_buffer : "", len);
+        t->error[len] = 0;
+        if (!t->error[0]) snprintf(t->error, sizeof t->error, "failed to build");
+        return;
+    }
+
+    if (t->program) glDeleteProgram(t->program);
+    t->program = program;
+    t->error[0] = 0;
+    t->animated = glGetUniformLocation(program, "iTime") >= 0 || glGetUniformLocation(program, "iTimeDelta") >= 0 ||
+                  glGetUniformLocation(program, "iFrame") >= 0;
+    t->interactive = glGetUniformLocation(program, "iMouse") >= 0;
+    t->drawn = false;
+    t->frames = 0;
+}
+
+/*
+ * Takes in file changes, submits builds for stale tiles for up to
+ * GALLERY_BUILD_MS and picks up finished builds and timer results.
+ */
+static void gallery_poll(gallery_t *g, GLuint vs)
+{
+    // Events never straddle a read, and the buffer holds at least one.
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t len;
+    while ((len = read(g->inotify_fd, buf, sizeof buf)) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *e = (const struct inotify_event *)p;
+            p += sizeof *e + e->len;
+            if (!e->len || !gallery_is_shader(e->name)) continue;
+            if (e->mask & (IN_DELETE | IN_MOVED_FROM)) gallery_remove(g, e->name);
+            else gallery_add(g, e->name);
+        }
+    }
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (size_t i = 0; i < array_size(g->tiles); i++) {
+        gallery_tile_t *t = &g->tiles[i];
+        if (t->stale && !t->building && gallery_ms_since(&t0) < GALLERY_BUILD_MS) {
+            t->stale = false;
+            // Gone again or caught halfway through a save, the next event brings it back.
+            if (!update_file_buffer(t->path) || (t->program && file_hash == t->hash)) continue;
+            t->hash = file_hash;
+            const char *src[3] = { fs_header_src, file_buffer, fs_footer_src };
+            program_submit(&t->job, vs, src, 3);
+            t->building = true;
+        }
+        if (t->building && program_ready(&t->job)) gallery_built(t);
+
+        if (t->timer_pending) {
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(t->timer, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 ns;
+                glGetQueryObjectui64v(t->timer, GL_QUERY_RESULT, &ns);
+                t->cost_ms += ((double)ns/1e6 - t->cost_ms)*GALLERY_COST_WEIGHT;
+                t->timer_pending = false;
+            }
+        }
+    }
+    free_file_buffer();
+}
+
+static int gallery_columns(const gallery_t *g, int window_width)
+{
+    int columns = (window_width - GALLERY_GAP) / (g->tile_width + GALLERY_GAP);
+    return columns > 1 ? columns : 1;
+}
+
+// Where tile i is shown, in window pixels from the top left.
+static rect_t gallery_rect(const gallery_t *g, int i, int window_width)
+{
+    int columns = gallery_columns(g, window_width);
+    int row_height = g->tile_height + GALLERY_GAP + g->label_height;
+    return make_rect((float)(GALLERY_GAP + (i % columns)*(g->tile_width + GALLERY_GAP)),
+                     (float)(GALLERY_GAP + (i / columns)*row_height - g->scroll),
+                     (float)g->tile_width, (float)g->tile_height);
+}
+
+static void gallery_scroll(gallery_t *g, int delta, int window_width, int window_height)
+{
+    int columns = gallery_columns(g, window_width);
+    int rows = ((int)array_size(g->tiles) + columns - 1) / columns;
+    int content = GALLERY_GAP + rows*(g->tile_height + GALLERY_GAP + g->label_height);
+    int max = content > window_height ? content - window_height : 0;
+    g->scroll += delta;
+    g->scroll = g->scroll < 0 ? 0 : g->scroll > max ? max : g->scroll;
+}
+
+static bool gallery_visible(rect_t r, int window_width, int window_height)
+{
+    return r.x < (float)window_width && r.x + r.w > 0.0f && r.y < (float)window_height && r.y + r.h > 0.0f;
+}
+
+// How overdue the tile is, 0 if it is not due. The tile under the pointer beats all others.
+static double gallery_lateness(const gallery_tile_t *t, bool visible, bool hovered, double now)
+{
+    if (!t->program || !t->fbo) return 0.0;
+    if (!t->drawn) return 1e9;
+    if (hovered && (t->animated || t->interactive)) return 1e6;
+    if (!t->animated) return 0.0;
+    double interval = visible ? 1.0/60.0 : GALLERY_OFFSCREEN_INTERVAL;
+    double late = (now - t->last_draw) / interval;
+    return late >= 1.0 ? late : 0.0;
+}
+
+static void gallery_draw_tile(gallery_t *g, gallery_tile_t *t, double time, double now, int mouse_x, int mouse_y)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+    glViewport(0, 0, g->tile_width, g->tile_height);
+    glUseProgram(t->program);
+    double dt = t->drawn ? now - t->last_draw : 0.0;
+    set_user_uniforms(g->tile_width, g->tile_height, time, dt, t->frames, mouse_x, mouse_y);
+    // A query still pending is simply restarted, its result no longer matters.
+    glBeginQuery(GL_TIME_ELAPSED, t->timer);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEndQuery(GL_TIME_ELAPSED);
+    t->timer_pending = true;
+    t->drawn = true;
+    t->last_draw = now;
+    t->frames++;
+}
+
+/*
+ * Draws the tiles that fit the budget and copies every visible tile into
+ * framebuffer. now is a clock in seconds, time is iTime. The pointer is in
+ * window pixels.
+ */
+static void gallery_draw(gallery_t *g, GLuint framebuffer, int window_width, int window_height,
+                         double time, double now, int mouse_x, int mouse_y)
+{
+    // The window may have grown or the tiles gone since the last scroll.
+    gallery_scroll(g, 0, window_width, window_height);
+
+    size_t n = array_size(g->tiles);
+    for (size_t i = 0; i < n; i++) {
+        gallery_tile_t *t = &g->tiles[i];
+        if (t->fbo || !t->program) continue;
+        glGenTextures(1, &t->texture);
+        glBindTexture(GL_TEXTURE_2D, t->texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, g->tile_width, g->tile_height);
+        glGenFramebuffers(1, &t->fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t->texture, 0);
+        glGenQueries(1, &t->timer);
+    }
+
+    // Picks the most overdue tile until the budget is spent, always at least one.
+    double spent = 0.0;
+    g->drawn = 0;
+    for (;;) {
+        int best = -1;
+        double best_late = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            gallery_tile_t *t = &g->tiles[i];
+            if (t->drawn && t->last_draw == now) continue;
+            rect_t r = gallery_rect(g, (int)i, window_width);
+            bool hovered = mouse_x >= r.x && mouse_x < r.x + r.w && mouse_y >= r.y && mouse_y < r.y + r.h;
+            double late = gallery_lateness(t, gallery_visible(r, window_width, window_height), hovered, now);
+            if (late > best_late) {
+                best = (int)i;
+                best_late = late;
+            }
+        }
+        if (best < 0 || (g->drawn > 0 && spent + g->tiles[best].cost_ms > g->budget_ms)) break;
+
+        gallery_tile_t *t = &g->tiles[best];
+        rect_t r = gallery_rect(g, best, window_width);
+        bool hovered = mouse_x >= r.x && mouse_x < r.x + r.w && mouse_y >= r.y && mouse_y < r.y + r.h;
+        gallery_draw_tile(g, t, time, now, hovered ? mouse_x - (int)r.x : -1, hovered ? mouse_y - (int)r.y : -1);
+        spent += t->cost_ms;
+        g->drawn++;
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    for (size_t i = 0; i < n; i++) {
+        gallery_tile_t *t = &g->tiles[i];
+        rect_t r = gallery_rect(g, (int)i, window_width);
+        if (!t->drawn || !gallery_visible(r, window_width, window_height)) continue;
+        // Window rows run top to bottom, GL's bottom to top.
+        int x0 = (int)r.x, y0 = window_height - (int)(r.y + r.h);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, t->fbo);
+        glBlitFramebuffer(0, 0, g->tile_width, g->tile_height, x0, y0, x0 + g->tile_width, y0 + g->tile_height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef GL_H
+#define GL_H
+
+#include <stdbool.h>
+#include <string.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+static PFNGLGENVERTEXARRAYSPROC glGenVertexArrays;
+static PFNGLDELETEVERTEXARRAYSPROC glDeleteVertexArrays;
+static PFNGLBINDVERTEXARRAYPROC glBindVertexArray;
+static PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray;
+static PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointer;
+static PFNGLVERTEXATTRIBIPOINTERPROC glVertexAttribIPointer;
+static PFNGLVERTEXATTRIBDIVISORPROC glVertexAttribDivisor;
+static PFNGLDRAWARRAYSINSTANCEDPROC glDrawArraysInstanced;
+static PFNGLGENBUFFERSPROC glGenBuffers;
+static PFNGLDELETEBUFFERSPROC glDeleteBuffers;
+static PFNGLBINDBUFFERPROC glBindBuffer;
+static PFNGLBUFFERDATAPROC glBufferData;
+static PFNGLMAPBUFFERRANGEPROC glMapBufferRange;
+static PFNGLUNMAPBUFFERPROC glUnmapBuffer;
+static PFNGLFENCESYNCPROC glFenceSync;
+static PFNGLCLIENTWAITSYNCPROC glClientWaitSync;
+static PFNGLDELETESYNCPROC glDeleteSync;
+static PFNGLTEXSTORAGE2DPROC glTexStorage2D;
+static PFNGLTEXSTORAGE3DPROC glTexStorage3D;
+static PFNGLBUFFERSTORAGEPROC glBufferStorage;
+static PFNGLCLEARTEXIMAGEPROC glClearTexImage;
+static PFNGLBINDTEXTUREUNITPROC glBindTextureUnit;
+static PFNGLCREATESHADERPROC glCreateShader;
+static PFNGLSHADERSOURCEPROC glShaderSource;
+static PFNGLCOMPILESHADERPROC glCompileShader;
+static PFNGLGETSHADERIVPROC glGetShaderiv;
+static PFNGLGETSHADERINFOLOGPROC glGetShaderInfoLog;
+static PFNGLATTACHSHADERPROC glAttachShader;
+static PFNGLDETACHSHADERPROC glDetachShader;
+static PFNGLDELETESHADERPROC glDeleteShader;
+static PFNGLCREATEPROGRAMPROC glCreateProgram;
+static PFNGLLINKPROGRAMPROC glLinkProgram;
+static PFNGLDELETEPROGRAMPROC glDeleteProgram;
+static PFNGLGETPROGRAMIVPROC glGetProgramiv;
+static PFNGLGETPROGRAMINFOLOGPROC glGetProgramInfoLog;
+static PFNGLUSEPROGRAMPROC glUseProgram;
+static PFNGLGETUNIFORMLOCATIONPROC glGetUniformLocation;
+static PFNGLGETACTIVEUNIFORMPROC glGetActiveUniform;
+static PFNGLUNIFORM1FPROC glUniform1f;
+static PFNGLUNIFORM1IPROC glUniform1i;
+static PFNGLUNIFORM2FPROC glUniform2f;
+static PFNGLUNIFORM3FPROC glUniform3f;
+static PFNGLUNIFORM4FPROC glUniform4f;
+static PFNGLGETSTRINGIPROC glGetStringi;
+static PFNGLGENQUERIESPROC glGenQueries;
+static PFNGLDELETEQUERIESPROC glDeleteQueries;
+static PFNGLBEGINQUERYPROC glBeginQuery;
+static PFNGLENDQUERYPROC glEndQuery;
+static PFNGLGETQUERYOBJECTUI64VPROC glGetQueryObjectui64v;
+static PFNGLGETQUERYOBJECTUIVPROC glGetQueryObjectuiv;
+static PFNGLQUERYCOUNTERPROC glQueryCounter;
+static PFNGLGETINTEGER64VPROC glGetInteger64v;
+static PFNGLGENFRAMEBUFFERSPROC glGenFramebuffers;
+static PFNGLDELETEFRAMEBUFFERSPROC glDeleteFramebuffers;
+static PFNGLBINDFRAMEBUFFERPROC glBindFramebuffer;
+static PFNGLFRAMEBUFFERTEXTURE2DPROC glFramebufferTexture2D;
+static PFNGLCHECKFRAMEBUFFERSTATUSPROC glCheckFramebufferStatus;
+static PFNGLPROGRAMPARAMETERIPROC glProgramParameteri;
+static PFNGLGETPROGRAMBINARYPROC glGetProgramBinary;
+static PFNGLPROGRAMBINARYPROC glProgramBinary;
+static PFNGLBLITFRAMEBUFFERPROC glBlitFramebuffer;
+static PFNGLDISPATCHCOMPUTEPROC glDispatchCompute;
+static PFNGLMEMORYBARRIERPROC glMemoryBarrier;
+static PFNGLBINDBUFFERBASEPROC glBindBufferBase;
+static PFNGLCLEARBUFFERDATAPROC glClearBufferData;
+static PFNGLBINDIMAGETEXTUREPROC glBindImageTexture;
+static PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR;
+
+// Set by the platform backend that created the context.
+static void *(*gl_get_proc_address)(const char *name);
+
+static inline void *get_proc(const char *name)
+{
+    return gl_get_proc_address(name);
+}
+
+static bool has_extension(const char *name)
+{
+    GLint n = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+    for (GLint i = 0; i < n; i++) {
+        const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (ext && strcmp(ext, name) == 0) return true;
+    }
+    return false;
+}
+
+static void get_procs(void)
+{
+    glGetStringi = (PFNGLGETSTRINGIPROC)get_proc("glGetStringi");
+    glCreateShader = (PFNGLCREATESHADERPROC)get_proc("glCreateShader");
+    glGenVertexArrays = (PFNGLGENVERTEXARRAYSPROC)get_proc("glGenVertexArrays");
+    glDeleteVertexArrays = (PFNGLDELETEVERTEXARRAYSPROC)get_proc("glDeleteVertexArrays");
+    glBindVertexArray = (PFNGLBINDVERTEXARRAYPROC)get_proc("glBindVertexArray");
+    glEnableVertexAttribArray = (PFNGLENABLEVERTEXATTRIBARRAYPROC)get_proc("glEnableVertexAttribArray");
+    glVertexAttribPointer = (PFNGLVERTEXATTRIBPOINTERPROC)get_proc("glVertexAttribPointer");
+    glVertexAttribIPointer = (PFNGLVERTEXATTRIBIPOINTERPROC)get_proc("glVertexAttribIPointer");
+    glVertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORPROC)get_proc("glVertexAttribDivisor");
+    glDrawArraysInstanced = (PFNGLDRAWARRAYSINSTANCEDPROC)get_proc("glDrawArraysInstanced");
+    glGenBuffers = (PFNGLGENBUFFERSPROC)get_proc("glGenBuffers");
+    glDeleteBuffers = (PFNGLDELETEBUFFERSPROC)get_proc("glDeleteBuffers");
+    glBindBuffer = (PFNGLBINDBUFFERPROC)get_proc("glBindBuffer");
+    glBufferData = (PFNGLBUFFERDATAPROC)get_proc("glBufferData");
+    glMapBufferRange = (PFNGLMAPBUFFERRANGEPROC)get_proc("glMapBufferRange");
+    glUnmapBuffer = (PFNGLUNMAPBUFFERPROC)get_proc("glUnmapBuffer");
+    glFenceSync = (PFNGLFENCESYNCPROC)get_proc("glFenceSync");
+    glClientWaitSync = (PFNGLCLIENTWAITSYNCPROC)get_proc("glClientWaitSync");
+    glDeleteSync = (PFNGLDELETESYNCPROC)get_proc("glDeleteSync");
+    glTexStorage2D = (PFNGLTEXSTORAGE2DPROC)get_proc("glTexStorage2D");
+    glTexStorage3D = (PFNGLTEXSTORAGE3DPROC)get_proc("glTexStorage3D");
+    glBufferStorage = (PFNGLBUFFERSTORAGEPROC)get_proc("glBufferStorage");
+    glClearTexImage = (PFNGLCLEARTEXIMAGEPROC)get_proc("glClearTexImage");
+    glBindTextureUnit = (PFNGLBINDTEXTUREUNITPROC)get_proc("glBindTextureUnit");
+    glShaderSource = (PFNGLSHADERSOURCEPROC)get_proc("glShaderSource");
+    glCompileShader = (PFNGLCOMPILESHADERPROC)get_proc("glCompileShader");
+    glGetShaderiv = (PFNGLGETSHADERIVPROC)get_proc("glGetShaderiv");
+    glGetShaderInfoLog = (PFNGLGETSHADERINFOLOGPROC)get_proc("glGetShaderInfoLog");
+    glAttachShader = (PFNGLATTACHSHADERPROC)get_proc("glAttachShader");
+    glDetachShader = (PFNGLDETACHSHADERPROC)get_proc("glDetachShader");
+    glDeleteShader = (PFNGLDELETESHADERPROC)get_proc("glDeleteShader");
+    glCreateProgram = (PFNGLCREATEPROGRAMPROC)get_proc("glCreateProgram");
+    glLinkProgram = (PFNGLLINKPROGRAMPROC)get_proc("glLinkProgram");
+    glDeleteProgram = (PFNGLDELETEPROGRAMPROC)get_proc("glDeleteProgram");
+    glGetProgramiv = (PFNGLGETPROGRAMIVPROC)get_proc("glGetProgramiv");
+    glGetProgramInfoLog = (PFNGLGETPROGRAMINFOLOGPROC)get_proc("glGetProgramInfoLog");
+    glUseProgram = (PFNGLUSEPROGRAMPROC)get_proc("glUseProgram");
+    glGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)get_proc("glGetUniformLocation");
+    glGetActiveUniform = (PFNGLGETACTIVEUNIFORMPROC)get_proc("glGetActiveUniform");
+    glUniform1f = (PFNGLUNIFORM1FPROC)get_proc("glUniform1f");
+    glUniform1i = (PFNGLUNIFORM1IPROC)get_proc("glUniform1i");
+    glUniform2f = (PFNGLUNIFORM2FPROC)get_proc("glUniform2f");
+    glUniform3f = (PFNGLUNIFORM3FPROC)get_proc("glUniform3f");
+    glUniform4f = (PFNGLUNIFORM4FPROC)get_proc("glUniform4f");
+    glGenQueries = (PFNGLGENQUERIESPROC)get_proc("glGenQueries");
+    glDeleteQueries = (PFNGLDELETEQUERIESPROC)get_proc("glDeleteQueries");
+    glBeginQuery = (PFNGLBEGINQUERYPROC)get_proc("glBeginQuery");
+    glEndQuery = (PFNGLENDQUERYPROC)get_proc("glEndQuery");
+    glGetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC)get_proc("glGetQueryObjectui64v");
+    glGetQueryObjectuiv = (PFNGLGETQUERYOBJECTUIVPROC)get_proc("glGetQueryObjectuiv");
+    glQueryCounter = (PFNGLQUERYCOUNTERPROC)get_proc("glQueryCounter");
+    glGetInteger64v = (PFNGLGETINTEGER64VPROC)get_proc("glGetInteger64v");
+    glGenFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)get_proc("glGenFramebuffers");
+    glDeleteFramebuffers = (PFNGLDELETEFRAMEBUFFERSPROC)get_proc("glDeleteFramebuffers");
+    glBindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)get_proc("glBindFramebuffer");
+    glFramebufferTexture2D = (PFNGLFRAMEBUFFERTEXTURE2DPROC)get_proc("glFramebufferTexture2D");
+    glCheckFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)get_proc("glCheckFramebufferStatus");
+    glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)get_proc("glProgramParameteri");
+    glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)get_proc("glGetProgramBinary");
+    glProgramBinary = (PFNGLPROGRAMBINARYPROC)get_proc("glProgramBinary");
+    glBlitFramebuffer = (PFNGLBLITFRAMEBUFFERPROC)get_proc("glBlitFramebuffer");
+    glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)get_proc("glDispatchCompute");
+    glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)get_proc("glMemoryBarrier");
+    glBindBufferBase = (PFNGLBINDBUFFERBASEPROC)get_proc("glBindBufferBase");
+    glClearBufferData = (PFNGLCLEARBUFFERDATAPROC)get_proc("glClearBufferData");
+    glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)get_proc("glBindImageTexture");
+
+    // Optional, only present with KHR_parallel_shader_compile.
+    if (has_extension("GL_KHR_parallel_shader_compile"))
+        glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)get_proc("glMaxShaderCompilerThreadsKHR");
+}
+
+#endif
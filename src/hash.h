@@ -0,0 +1,139 @@
+#ifndef HASH_H
+#define HASH_H
+
+/*
+ * Fast non-cryptographic 64-bit hash for sources and cache keys, built like
+ * XXH3: eight 64-bit accumulators take a 64 byte stripe at a time, each adds
+ * its neighbour's input word and the 32x32 bit product of the halves of its
+ * own word xored with a key. Every 16 stripes the accumulators are
+ * scrambled, and at the end they are folded with 128-bit multiplies and
+ * avalanched. The SSE2 path keeps two accumulators per register and gives
+ * the same hash as the scalar one. It is not XXH3 and hashes differ from
+ * it, they only need to be stable within a build.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HASH_SSE 1
+#endif
+
+#define HASH_STRIPE         64
+#define HASH_BLOCK_STRIPES  16
+
+static const uint64_t hash_keys[8] = {
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+    0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+};
+
+#define HASH_PRIME32        0x9e3779b1ull
+#define HASH_PRIME64_1      0x9e3779b185ebca87ull
+#define HASH_PRIME64_2      0xc2b2ae3d27d4eb4full
+#define HASH_PRIME64_3      0x165667b19e3779f9ull
+
+static inline uint64_t hash_read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static inline void hash_stripe(uint64_t acc[8], const unsigned char *p)
+{
+    for (int j = 0; j < 8; j++) {
+        uint64_t d = hash_read64(p + 8*j);
+        uint64_t k = d ^ hash_keys[j];
+        acc[j ^ 1] += d;
+        acc[j] += (k & 0xffffffffu) * (k >> 32);
+    }
+}
+
+static inline void hash_scramble(uint64_t acc[8])
+{
+    for (int j = 0; j < 8; j++) {
+        acc[j] ^= acc[j] >> 47;
+        acc[j] ^= hash_keys[j];
+        acc[j] *= HASH_PRIME32;
+    }
+}
+
+// Stripes of whole blocks, the rest is left to the scalar loop.
+static size_t hash_blocks(uint64_t acc[8], const unsigned char *p, size_t size)
+{
+    const size_t block = HASH_STRIPE*HASH_BLOCK_STRIPES;
+    size_t done = 0;
+#ifdef HASH_SSE
+    __m128i a[4], key[4];
+    for (int j = 0; j < 4; j++) {
+        a[j] = _mm_loadu_si128((const __m128i *)(acc + 2*j));
+        key[j] = _mm_loadu_si128((const __m128i *)(hash_keys + 2*j));
+    }
+    const __m128i prime = _mm_set1_epi32((int)HASH_PRIME32);
+    for (; done + block <= size; done += block) {
+        for (int s = 0; s < HASH_BLOCK_STRIPES; s++) {
+            const unsigned char *stripe = p + done + (size_t)s*HASH_STRIPE;
+            for (int j = 0; j < 4; j++) {
+                __m128i d = _mm_loadu_si128((const __m128i *)(stripe + 16*j));
+                __m128i k = _mm_xor_si128(d, key[j]);
+                // Low half of each word times its high half.
+                __m128i product = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(2, 3, 0, 1)));
+                __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+                a[j] = _mm_add_epi64(a[j], _mm_add_epi64(swapped, product));
+            }
+        }
+        for (int j = 0; j < 4; j++) {
+            __m128i x = _mm_xor_si128(a[j], _mm_srli_epi64(a[j], 47));
+            x = _mm_xor_si128(x, key[j]);
+            // 64 by 32 bit multiply from two 32x32 bit ones.
+            __m128i lo = _mm_mul_epu32(x, prime);
+            __m128i hi = _mm_mul_epu32(_mm_srli_epi64(x, 32), prime);
+            a[j] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+        }
+    }
+    for (int j = 0; j < 4; j++)
+        _mm_storeu_si128((__m128i *)(acc + 2*j), a[j]);
+#endif
+    for (; done + block <= size; done += block) {
+        for (int s = 0; s < HASH_BLOCK_STRIPES; s++)
+            hash_stripe(acc, p + done + (size_t)s*HASH_STRIPE);
+        hash_scramble(acc);
+    }
+    return done;
+}
+
+static inline uint64_t hash_fold(uint64_t a, uint64_t b)
+{
+    unsigned __int128 m = (unsigned __int128)a * b;
+    return (uint64_t)m ^ (uint64_t)(m >> 64);
+}
+
+static uint64_t hash_bytes(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *p = data;
+    uint64_t acc[8] = {
+        HASH_PRIME32, HASH_PRIME64_1, HASH_PRIME64_2, HASH_PRIME64_3,
+        HASH_PRIME64_1 ^ seed, HASH_PRIME64_2 + seed, HASH_PRIME64_3 - seed, HASH_PRIME32 ^ seed,
+    };
+    size_t done = hash_blocks(acc, p, size);
+    for (; done + HASH_STRIPE <= size; done += HASH_STRIPE)
+        hash_stripe(acc, p + done);
+    // The last partial stripe is zero padded, the length below tells it apart.
+    if (done < size) {
+        unsigned char last[HASH_STRIPE] = {0};
+        memcpy(last, p + done, size - done);
+        hash_stripe(acc, last);
+    }
+
+    uint64_t h = (uint64_t)size * HASH_PRIME64_1;
+    for (int j = 0; j < 8; j += 2)
+        h += hash_fold(acc[j] ^ hash_keys[(j + 3) & 7], acc[j + 1] ^ hash_keys[(j + 5) & 7]);
+    h ^= h >> 37;
+    h *= HASH_PRIME64_2;
+    h ^= h >> 32;
+    return h;
+}
+
+#endif
@@ -0,0 +1,614 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/*
+ * Image encoders for frame dumps. Input is always RGBA as returned by
+ * glReadPixels(), bottom row first; the alpha channel is dropped and rows
+ * are written top to bottom. PNG output is built from independently
+ * deflated row bands (each flushed to a byte boundary, as pigz does) so
+ * the bands can be compressed in parallel and simply concatenated.
+ */
+
+#include "memory.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+typedef enum
+{
+    IMAGE_PPM,
+    IMAGE_QOI,
+    IMAGE_PNG,
+} image_format_t;
+
+static image_format_t image_format_from_path(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (ext && strcmp(ext, ".qoi") == 0) return IMAGE_QOI;
+    if (ext && strcmp(ext, ".png") == 0) return IMAGE_PNG;
+    return IMAGE_PPM;
+}
+
+// Writes bottom-up RGBA pixels, as returned by glReadPixels(), as a binary PPM.
+static bool write_ppm(const char *path, const uint8_t *rgba, int width, int height)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    uint8_t row[3*4096];
+    bool ok = true;
+    for (int y = height-1; y >= 0 && ok; y--) {
+        const uint8_t *src = rgba + (size_t)y*(size_t)width*4;
+        for (int x = 0; x < width; ) {
+            int n = width - x < 4096 ? width - x : 4096;
+            for (int i = 0; i < n; i++, x++) {
+                row[3*i+0] = src[4*x+0];
+                row[3*i+1] = src[4*x+1];
+                row[3*i+2] = src[4*x+2];
+            }
+            ok = fwrite(row, 3, (size_t)n, fp) == (size_t)n;
+        }
+    }
+
+    return fclose(fp) == 0 && ok;
+}
+
+// QOI, https://qoiformat.org/qoi-specification.pdf, written as 3 channel sRGB.
+
+#define QOI_OP_INDEX    0x00
+#define QOI_OP_DIFF     0x40
+#define QOI_OP_LUMA     0x80
+#define QOI_OP_RUN      0xc0
+#define QOI_OP_RGB      0xfe
+
+static inline size_t qoi_max_size(int width, int height)
+{
+    return (size_t)width*(size_t)height*4 + 14 + 8;
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// out must hold qoi_max_size() bytes. Returns the encoded size.
+static size_t encode_qoi(uint8_t *out, const uint8_t *rgba, int width, int height)
+{
+    uint8_t *p = out;
+    memcpy(p, "qoif", 4);
+    put_be32(p + 4, (uint32_t)width);
+    put_be32(p + 8, (uint32_t)height);
+    p[12] = 3;
+    p[13] = 0;
+    p += 14;
+
+    uint32_t index[64] = {0};
+    uint8_t pr = 0, pg = 0, pb = 0;
+    int run = 0;
+    for (int y = height-1; y >= 0; y--) {
+        const uint8_t *px = rgba + (size_t)y*(size_t)width*4;
+        for (int x = 0; x < width; x++, px += 4) {
+            uint8_t r = px[0], g = px[1], b = px[2];
+            if (r == pr && g == pg && b == pb) {
+                if (++run == 62) {
+                    *p++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *p++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+
+            uint32_t v = (uint32_t)r << 24 | (uint32_t)g << 16 | (uint32_t)b << 8 | 0xff;
+            int hash = (r*3 + g*5 + b*7 + 255*11) % 64;
+            if (index[hash] == v) {
+                *p++ = (uint8_t)(QOI_OP_INDEX | hash);
+            } else {
+                index[hash] = v;
+                int8_t dr = (int8_t)(r - pr), dg = (int8_t)(g - pg), db = (int8_t)(b - pb);
+                int8_t dr_dg = (int8_t)(dr - dg), db_dg = (int8_t)(db - dg);
+                if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+                    *p++ = (uint8_t)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                } else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8) {
+                    *p++ = (uint8_t)(QOI_OP_LUMA | (dg + 32));
+                    *p++ = (uint8_t)((dr_dg + 8) << 4 | (db_dg + 8));
+                } else {
+                    *p++ = QOI_OP_RGB;
+                    *p++ = r;
+                    *p++ = g;
+                    *p++ = b;
+                }
+            }
+            pr = r;
+            pg = g;
+            pb = b;
+        }
+    }
+    if (run) *p++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+
+    static const uint8_t padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    memcpy(p, padding, sizeof padding);
+    return (size_t)(p - out) + sizeof padding;
+}
+
+// PNG
+
+#define PNG_MAX_BANDS   32
+
+typedef struct
+{
+    z_stream z;
+    bool ready;
+    uint8_t *row;       // Filtered scanline
+    int row_cap;
+    uint8_t *out;       // Raw deflate output of the band
+    size_t out_cap;
+    size_t out_len;
+    uLong adler;        // Adler-32 of the band's uncompressed scanlines
+    uLong raw_len;
+} png_band_t;
+
+static void png_band_free(png_band_t *b)
+{
+    if (b->ready) deflateEnd(&b->z);
+    free(b->row);
+    free(b->out);
+    memset(b, 0, sizeof *b);
+}
+
+/*
+ * Filters and deflates output rows y0..y1 of the image into b->out. Every
+ * band but the last ends with a sync flush so the streams concatenate into
+ * one valid deflate stream. Buffers and the deflate state are kept in b
+ * and reused by later frames.
+ */
+static bool png_band_encode(png_band_t *b, const uint8_t *rgba, int width, int height, int y0, int y1, bool last)
+{
+    if (!b->ready) {
+        // Level 1: compression speed matters far more than size for frame dumps.
+        if (deflateInit2(&b->z, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+        b->ready = true;
+    } else {
+        deflateReset(&b->z);
+    }
+
+    int row_size = 1 + width*3;
+    if (b->row_cap < row_size) {
+        b->row = xrealloc(b->row, (size_t)row_size);
+        b->row_cap = row_size;
+    }
+
+    b->raw_len = (uLong)row_size*(uLong)(y1 - y0);
+    size_t bound = deflateBound(&b->z, b->raw_len) + 64;
+    if (b->out_cap < bound) {
+        b->out = xrealloc(b->out, bound);
+        b->out_cap = bound;
+    }
+
+    b->adler = adler32(0, NULL, 0);
+    b->z.next_out = b->out;
+    b->z.avail_out = (uInt)b->out_cap;
+    for (int y = y0; y < y1; y++) {
+        // Up filter, output row y is input row height-1-y.
+        const uint8_t *cur = rgba + (size_t)(height-1-y)*(size_t)width*4;
+        const uint8_t *prev = y > 0 ? cur + (size_t)width*4 : NULL;
+        uint8_t *dst = b->row;
+        *dst++ = prev ? 2 : 0;
+        if (prev) {
+            for (int x = 0; x < width; x++, cur += 4, prev += 4) {
+                *dst++ = (uint8_t)(cur[0] - prev[0]);
+                *dst++ = (uint8_t)(cur[1] - prev[1]);
+                *dst++ = (uint8_t)(cur[2] - prev[2]);
+            }
+        } else {
+            for (int x = 0; x < width; x++, cur += 4) {
+                *dst++ = cur[0];
+                *dst++ = cur[1];
+                *dst++ = cur[2];
+            }
+        }
+
+        b->adler = adler32(b->adler, b->row, (uInt)row_size);
+        b->z.next_in = b->row;
+        b->z.avail_in = (uInt)row_size;
+        int flush = y + 1 < y1 ? Z_NO_FLUSH : last ? Z_FINISH : Z_SYNC_FLUSH;
+        int r = deflate(&b->z, flush);
+        if (r == Z_STREAM_ERROR || b->z.avail_in != 0) return false;
+    }
+    if (y0 == y1 && deflate(&b->z, last ? Z_FINISH : Z_SYNC_FLUSH) == Z_STREAM_ERROR) return false;
+
+    b->out_len = b->out_cap - b->z.avail_out;
+    return true;
+}
+
+static bool png_chunk(FILE *fp, const char *type, const uint8_t *const *parts, const size_t *sizes, int num_parts)
+{
+    size_t len = 0;
+    for (int i = 0; i < num_parts; i++) len += sizes[i];
+
+    uint8_t header[8];
+    put_be32(header, (uint32_t)len);
+    memcpy(header + 4, type, 4);
+    uLong crc = crc32(0, header + 4, 4);
+    bool ok = fwrite(header, 1, 8, fp) == 8;
+    for (int i = 0; i < num_parts && ok; i++) {
+        crc = crc32(crc, parts[i], (uInt)sizes[i]);
+        ok = fwrite(parts[i], 1, sizes[i], fp) == sizes[i];
+    }
+
+    uint8_t trailer[4];
+    put_be32(trailer, (uint32_t)crc);
+    return ok && fwrite(trailer, 1, 4, fp) == 4;
+}
+
+// Writes a PNG from bands encoded by png_band_encode(), in order.
+static bool write_png_bands(const char *path, int width, int height, const png_band_t *bands, int num_bands)
+{
+    if (num_bands > PNG_MAX_BANDS) return false;
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    uint8_t ihdr[13];
+    put_be32(ihdr, (uint32_t)width);
+    put_be32(ihdr + 4, (uint32_t)height);
+    ihdr[8] = 8;    // Bit depth
+    ihdr[9] = 2;    // RGB
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+
+    // zlib wrapper around the concatenated raw streams: header, bands, Adler-32.
+    static const uint8_t zlib_header[2] = { 0x78, 0x01 };
+    uLong adler = adler32(0, NULL, 0);
+    for (int i = 0; i < num_bands; i++)
+        adler = adler32_combine(adler, bands[i].adler, (z_off_t)bands[i].raw_len);
+    uint8_t zlib_trailer[4];
+    put_be32(zlib_trailer, (uint32_t)adler);
+
+    const uint8_t *parts[2 + PNG_MAX_BANDS];
+    size_t sizes[2 + PNG_MAX_BANDS];
+    int n = 0;
+    parts[n] = zlib_header;
+    sizes[n++] = sizeof zlib_header;
+    for (int i = 0; i < num_bands; i++) {
+        parts[n] = bands[i].out;
+        sizes[n++] = bands[i].out_len;
+    }
+    parts[n] = zlib_trailer;
+    sizes[n++] = sizeof zlib_trailer;
+
+    const uint8_t *ihdr_part = ihdr;
+    size_t ihdr_size = sizeof ihdr;
+    bool ok = fwrite(signature, 1, sizeof signature, fp) == sizeof signature &&
+              png_chunk(fp, "IHDR", &ihdr_part, &ihdr_size, 1) &&
+              png_chunk(fp, "IDAT", parts, sizes, n) &&
+              png_chunk(fp, "IEND", NULL, NULL, 0);
+
+    return fclose(fp) == 0 && ok;
+}
+
+// Encodes and writes an image in the format given by the path's extension, on the calling thread.
+static bool write_image(const char *path, const uint8_t *rgba, int width, int height)
+{
+    switch (image_format_from_path(path)) {
+        case IMAGE_QOI: {
+            uint8_t *out = xmalloc(qoi_max_size(width, height));
+            size_t size = encode_qoi(out, rgba, width, height);
+            FILE *fp = fopen(path, "wb");
+            bool ok = fp && fwrite(out, 1, size, fp) == size;
+            ok = fp && fclose(fp) == 0 && ok;
+            free(out);
+            return ok;
+        }
+
+        case IMAGE_PNG: {
+            png_band_t band = {0};
+            bool ok = png_band_encode(&band, rgba, width, height, 0, height, true) &&
+                      write_png_bands(path, width, height, &band, 1);
+            png_band_free(&band);
+            return ok;
+        }
+
+        default:
+            return write_ppm(path, rgba, width, height);
+    }
+}
+
+// Readers, for reference images. Pixels are returned as RGBA, bottom row first like glReadPixels().
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    uint8_t *data = NULL;
+    size_t cap = 0;
+    *size = 0;
+    for (;;) {
+        if (*size == cap) {
+            cap = cap ? cap*2 : 1 << 20;
+            data = xrealloc(data, cap);
+        }
+        size_t n = fread(data + *size, 1, cap - *size, fp);
+        if (!n) break;
+        *size += n;
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    if (!ok) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static inline bool ppm_space(uint8_t c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/*
+ * Parses a binary PPM header with 8 bit samples. Returns the offset of
+ * the pixels, or 0 if the header is invalid or does not end within size.
+ */
+static size_t ppm_header(const uint8_t *data, size_t size, int *width, int *height)
+{
+    // Header fields are separated by whitespace and may be interleaved with comments.
+    size_t i = 2;
+    int fields[3];
+    for (int f = 0; f < 3; f++) {
+        for (;;) {
+            while (i < size && ppm_space(data[i])) i++;
+            if (i < size && data[i] == '#') {
+                while (i < size && data[i] != '\n') i++;
+                continue;
+            }
+            break;
+        }
+        fields[f] = 0;
+        if (i >= size || data[i] < '0' || data[i] > '9') return 0;
+        while (i < size && data[i] >= '0' && data[i] <= '9' && fields[f] < 1 << 16)
+            fields[f] = fields[f]*10 + data[i++] - '0';
+    }
+    // Exactly one whitespace byte separates the header from the pixels.
+    if (i >= size || !ppm_space(data[i])) return 0;
+    i++;
+    int w = fields[0], h = fields[1];
+    if (fields[2] != 255 || w <= 0 || h <= 0 || w > 1 << 15 || h > 1 << 15) return 0;
+    *width = w;
+    *height = h;
+    return i;
+}
+
+// Reads the dimensions from the image header without decoding it.
+static bool image_info(const char *path, int *width, int *height)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    // Room for the comments image editors put in PPM headers.
+    uint8_t header[1024];
+    size_t n = fread(header, 1, sizeof header, fp);
+    fclose(fp);
+    if (n >= 24 && memcmp(header, "\x89PNG", 4) == 0) {
+        *width = (int)get_be32(header + 16);
+        *height = (int)get_be32(header + 20);
+    } else if (n >= 14 && memcmp(header, "qoif", 4) == 0) {
+        *width = (int)get_be32(header + 4);
+        *height = (int)get_be32(header + 8);
+    } else if (n >= 2 && memcmp(header, "P6", 2) == 0) {
+        if (!ppm_header(header, n, width, height)) return false;
+    } else {
+        return false;
+    }
+    return *width > 0 && *height > 0 && *width <= 1 << 15 && *height <= 1 << 15;
+}
+
+static void ensure_pixels(uint8_t **pixels, size_t *cap, int width, int height)
+{
+    size_t size = (size_t)width*(size_t)height*4;
+    if (*cap < size) {
+        *pixels = xrealloc(*pixels, size);
+        *cap = size;
+    }
+}
+
+static bool decode_ppm(const uint8_t *data, size_t size, uint8_t **pixels, size_t *cap, int *width, int *height)
+{
+    int w, h;
+    size_t i = ppm_header(data, size, &w, &h);
+    if (!i || size - i < (size_t)w*(size_t)h*3) return false;
+
+    ensure_pixels(pixels, cap, w, h);
+    for (int y = 0; y < h; y++) {
+        const uint8_t *src = data + i + (size_t)y*(size_t)w*3;
+        uint8_t *dst = *pixels + (size_t)(h-1-y)*(size_t)w*4;
+        for (int x = 0; x < w; x++, src += 3, dst += 4) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst[3] = 255;
+        }
+    }
+    *width = w;
+    *height = h;
+    return true;
+}
+
+static bool decode_qoi(const uint8_t *data, size_t size, uint8_t **pixels, size_t *cap, int *width, int *height)
+{
+    if (size < 14 + 8) return false;
+    uint32_t w = get_be32(data + 4), h = get_be32(data + 8);
+    if (w == 0 || h == 0 || w > 1 << 15 || h > 1 << 15) return false;
+
+    ensure_pixels(pixels, cap, (int)w, (int)h);
+    uint8_t index[64][4] = {{0}};
+    uint8_t px[4] = { 0, 0, 0, 255 };
+    size_t p = 14, end = size - 8;
+    int run = 0;
+    for (uint32_t y = 0; y < h; y++) {
+        uint8_t *dst = *pixels + (size_t)(h-1-y)*w*4;
+        for (uint32_t x = 0; x < w; x++, dst += 4) {
+            if (run) {
+                run--;
+            } else if (p < end) {
+                uint8_t b = data[p++];
+                if (b == QOI_OP_RGB) {
+                    if (end - p < 3) return false;
+                    px[0] = data[p++];
+                    px[1] = data[p++];
+                    px[2] = data[p++];
+                } else if (b == 0xff) {
+                    if (end - p < 4) return false;
+                    memcpy(px, data + p, 4);
+                    p += 4;
+                } else if ((b & 0xc0) == QOI_OP_INDEX) {
+                    memcpy(px, index[b], 4);
+                } else if ((b & 0xc0) == QOI_OP_DIFF) {
+                    px[0] += ((b >> 4) & 3) - 2;
+                    px[1] += ((b >> 2) & 3) - 2;
+                    px[2] += (b & 3) - 2;
+                } else if ((b & 0xc0) == QOI_OP_LUMA) {
+                    if (p >= end) return false;
+                    uint8_t b2 = data[p++];
+                    int dg = (b & 0x3f) - 32;
+                    px[0] += dg - 8 + (b2 >> 4);
+                    px[1] += dg;
+                    px[2] += dg - 8 + (b2 & 0x0f);
+                } else {
+                    run = b & 0x3f;
+                }
+                memcpy(index[(px[0]*3 + px[1]*5 + px[2]*7 + px[3]*11) % 64], px, 4);
+            } else {
+                return false;
+            }
+            dst[0] = px[0];
+            dst[1] = px[1];
+            dst[2] = px[2];
+            dst[3] = 255;
+        }
+    }
+    *width = (int)w;
+    *height = (int)h;
+    return true;
+}
+
+static inline uint8_t paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return (uint8_t)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+// 8-bit, non-interlaced gray, gray+alpha, RGB and RGBA PNGs.
+static bool decode_png(const uint8_t *data, size_t size, uint8_t **pixels, size_t *cap, int *width, int *height)
+{
+    uint32_t w = 0, h = 0;
+    int channels = 0;
+    uint8_t *idat = NULL;
+    size_t idat_size = 0;
+    bool ok = false;
+    for (size_t i = 8; size - i >= 12; ) {
+        uint32_t len = get_be32(data + i);
+        const uint8_t *type = data + i + 4, *chunk = data + i + 8;
+        if (len > size - i - 12) break;
+        if (memcmp(type, "IHDR", 4) == 0 && len >= 13) {
+            w = get_be32(chunk);
+            h = get_be32(chunk + 4);
+            static const int color_channels[7] = { 1, 0, 3, 0, 2, 0, 4 };
+            if (chunk[8] != 8 || chunk[9] > 6 || !color_channels[chunk[9]] || chunk[12] != 0) break;
+            channels = color_channels[chunk[9]];
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            idat = xrealloc(idat, idat_size + len);
+            memcpy(idat + idat_size, chunk, len);
+            idat_size += len;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            ok = channels != 0;
+            break;
+        }
+        i += 12 + (size_t)len;
+    }
+    if (!ok || w == 0 || h == 0 || w > 1 << 15 || h > 1 << 15) {
+        free(idat);
+        return false;
+    }
+
+    size_t stride = (size_t)w*(size_t)channels;
+    uLongf raw_size = (uLongf)((stride + 1)*h);
+    uint8_t *raw = xmalloc(raw_size);
+    ok = uncompress(raw, &raw_size, idat, (uLong)idat_size) == Z_OK && raw_size == (stride + 1)*h;
+    free(idat);
+
+    ensure_pixels(pixels, cap, (int)w, (int)h);
+    int bpp = channels;
+    for (uint32_t y = 0; y < h && ok; y++) {
+        uint8_t *row = raw + y*(stride + 1);
+        uint8_t *cur = row + 1;
+        const uint8_t *prev = y > 0 ? cur - (stride + 1) : NULL;
+        for (size_t x = 0; x < stride; x++) {
+            int a = x >= (size_t)bpp ? cur[x - bpp] : 0;
+            int b = prev ? prev[x] : 0;
+            int c = prev && x >= (size_t)bpp ? prev[x - bpp] : 0;
+            switch (row[0]) {
+                case 0: break;
+                case 1: cur[x] += a; break;
+                case 2: cur[x] += b; break;
+                case 3: cur[x] += (a + b) / 2; break;
+                case 4: cur[x] += paeth(a, b, c); break;
+                default: ok = false; break;
+            }
+        }
+
+        uint8_t *dst = *pixels + (size_t)(h-1-y)*w*4;
+        for (uint32_t x = 0; x < w; x++, dst += 4) {
+            const uint8_t *src = cur + x*channels;
+            dst[0] = src[0];
+            dst[1] = channels >= 3 ? src[1] : src[0];
+            dst[2] = channels >= 3 ? src[2] : src[0];
+            dst[3] = 255;
+        }
+    }
+    free(raw);
+    *width = (int)w;
+    *height = (int)h;
+    return ok;
+}
+
+/*
+ * Reads a PNG, QOI or PPM image into *pixels, growing the buffer as needed.
+ * Alpha is ignored, every pixel is opaque.
+ */
+static bool read_image(const char *path, uint8_t **pixels, size_t *cap, int *width, int *height)
+{
+    size_t size;
+    uint8_t *data = read_file(path, &size);
+    if (!data) return false;
+
+    bool ok = false;
+    if (size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0)
+        ok = decode_png(data, size, pixels, cap, width, height);
+    else if (size >= 4 && memcmp(data, "qoif", 4) == 0)
+        ok = decode_qoi(data, size, pixels, cap, width, height);
+    else if (size >= 2 && memcmp(data, "P6", 2) == 0)
+        ok = decode_ppm(data, size, pixels, cap, width, height);
+    free(data);
+    return ok;
+}
+
+#endif
@@ -1,11 +1,21 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stdalign.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#ifdef TADERSHOY_BENCH
+// Heap calls through xmalloc/xrealloc, reported per operation by the benchmarks.
+static unsigned long long memory_allocs;
+#define memory_count_alloc() (memory_allocs++)
+#else
+#define memory_count_alloc() ((void)0)
+#endif
+
 static void *xmalloc(size_t size)
 {
+    memory_count_alloc();
     void *p = malloc(size);
     if (!p) {
         perror("malloc");
@@ -16,6 +26,7 @@ static void *xmalloc(size_t size)
 
 static void *xrealloc(void *p, size_t size)
 {
+    memory_count_alloc();
     p = realloc(p, size);
     if (!p) {
         perror("realloc");
@@ -43,11 +54,22 @@ typedef struct
 #define array_push_back(a, item) \
     (array_full((a)) ? (a) = array_resize((a), array_size((a))*2, sizeof(*(a))) : 0, \
     (a)[array_header((a))->size++] = (item))
+// Appends n uninitialized elements with one capacity check, evaluates to a pointer to the first.
+#define array_reserve(a, n) \
+    ((!(a) || array_cap((a)) < array_size((a)) + (n)) ? \
+        (a) = array_resize((a), array_grow_cap(array_cap((a)), array_size((a)) + (n)), sizeof(*(a))) : 0, \
+    array_header((a))->size += (n), \
+    (a) + array_size((a)) - (n))
 #define array_clear(a) \
     ((a) ? array_header((a))->size = 0 : 0)
 #define array_free(a) \
     if ((a)) do { free(array_header((a))); } while(0)
 
+static inline size_t array_grow_cap(size_t cap, size_t min)
+{
+    return cap*2 > min ? cap*2 : min;
+}
+
 static inline void *array_resize(void *p, size_t size, size_t element_size)
 {
     if (size == 0) size = 1;
@@ -63,4 +85,83 @@ static inline void *array_resize(void *p, size_t size, size_t element_size)
     return (void*)((char*)header + sizeof *header);
 }
 
+/*
+ * Linear allocator for data that lives for one frame. Allocations bump a
+ * pointer and are all released by arena_reset(). A frame that outgrows the
+ * block chains more blocks; the next reset replaces them with one block
+ * that holds the whole frame, so the steady state never touches the heap.
+ */
+
+#define ARENA_ALIGN         16
+#define ARENA_MIN_BLOCK     (64*1024)
+
+typedef struct arena_block
+{
+    struct arena_block *prev;
+    size_t cap;
+    size_t used;
+    alignas(ARENA_ALIGN) char data[];
+} arena_block_t;
+
+typedef struct
+{
+    arena_block_t *block;
+    size_t used;    // Over all blocks, this frame
+} arena_t;
+
+static arena_block_t *arena_new_block(arena_block_t *prev, size_t cap)
+{
+    arena_block_t *b = xmalloc(sizeof *b + cap);
+    b->prev = prev;
+    b->cap = cap;
+    b->used = 0;
+    return b;
+}
+
+static void *arena_alloc(arena_t *a, size_t size)
+{
+    size = (size + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1);
+    arena_block_t *b = a->block;
+    if (!b || b->cap - b->used < size) {
+        size_t cap = b ? b->cap*2 : ARENA_MIN_BLOCK;
+        a->block = b = arena_new_block(b, cap > size ? cap : size);
+    }
+    void *p = b->data + b->used;
+    b->used += size;
+    a->used += size;
+    return p;
+}
+
+#define arena_push(a, type, n) \
+    ((type *)arena_alloc((a), sizeof(type)*(n)))
+
+static void arena_reset(arena_t *a)
+{
+    arena_block_t *b = a->block;
+    if (b && b->prev) {
+        size_t cap = b->cap;
+        while (cap < a->used) cap *= 2;
+        while (b) {
+            arena_block_t *prev = b->prev;
+            free(b);
+            b = prev;
+        }
+        a->block = arena_new_block(NULL, cap);
+    } else if (b) {
+        b->used = 0;
+    }
+    a->used = 0;
+}
+
+static void arena_free(arena_t *a)
+{
+    for (arena_block_t *b = a->block; b; ) {
+        arena_block_t *prev = b->prev;
+        free(b);
+        b = prev;
+    }
+    a->block = NULL;
+    a->used = 0;
+}
+
 #endif
@@ -0,0 +1,331 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/*
+ * Image comparison metrics over the RGB channels of two RGBA images of the
+ * same size: max absolute channel error, MSE/PSNR, and SSIM of the luma
+ * over 8x8 windows placed every 4 pixels. The inner kernels have SSE2 and
+ * AVX2 versions picked at runtime. Error and window sums are integers, so
+ * the paths agree up to the order the window SSIMs are averaged in.
+ */
+
+#include "memory.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define METRICS_X86 1
+#endif
+
+#define SSIM_WINDOW 8
+#define SSIM_STEP   4
+
+typedef struct
+{
+    int max_error;
+    double mse;
+    double psnr;    // INFINITY for identical images
+    double ssim;
+} image_metrics_t;
+
+// Sums of one SSIM window: a, b, a*a, b*b, a*b.
+typedef struct
+{
+    uint32_t a, b, aa, bb, ab;
+} ssim_sums_t;
+
+static void diff_stats_scalar(const uint8_t *a, const uint8_t *b, size_t num_pixels, int *max_error, uint64_t *sse)
+{
+    int max = 0;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < num_pixels*4; i++) {
+        if ((i & 3) == 3) continue;
+        int d = abs((int)a[i] - (int)b[i]);
+        if (d > max) max = d;
+        sum += (uint64_t)(d*d);
+    }
+    *max_error = max;
+    *sse = sum;
+}
+
+#ifdef METRICS_X86
+
+// Partial 32-bit sums are moved to 64 bits before they can overflow.
+#define DIFF_FLUSH_BLOCKS 4096
+
+static void diff_stats_sse2(const uint8_t *a, const uint8_t *b, size_t num_pixels, int *max_error, uint64_t *sse)
+{
+    const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i max = zero, total = zero;
+    size_t n = num_pixels / 4, i = 0;
+    while (i < n) {
+        size_t end = n - i > DIFF_FLUSH_BLOCKS ? i + DIFF_FLUSH_BLOCKS : n;
+        __m128i acc = zero;
+        for (; i < end; i++) {
+            __m128i va = _mm_and_si128(_mm_loadu_si128((const __m128i *)a + i), rgb);
+            __m128i vb = _mm_and_si128(_mm_loadu_si128((const __m128i *)b + i), rgb);
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            max = _mm_max_epu8(max, d);
+            __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        total = _mm_add_epi64(total, _mm_add_epi64(_mm_unpacklo_epi32(acc, zero), _mm_unpackhi_epi32(acc, zero)));
+    }
+
+    uint8_t lanes[16];
+    uint64_t sums[2];
+    _mm_storeu_si128((__m128i *)lanes, max);
+    _mm_storeu_si128((__m128i *)sums, total);
+    int m;
+    uint64_t tail;
+    diff_stats_scalar(a + n*16, b + n*16, num_pixels - n*4, &m, &tail);
+    for (int j = 0; j < 16; j++)
+        if (lanes[j] > m) m = lanes[j];
+    *max_error = m;
+    *sse = sums[0] + sums[1] + tail;
+}
+
+__attribute__((target("avx2")))
+static void diff_stats_avx2(const uint8_t *a, const uint8_t *b, size_t num_pixels, int *max_error, uint64_t *sse)
+{
+    const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i max = zero, total = zero;
+    size_t n = num_pixels / 8, i = 0;
+    while (i < n) {
+        size_t end = n - i > DIFF_FLUSH_BLOCKS ? i + DIFF_FLUSH_BLOCKS : n;
+        __m256i acc = zero;
+        for (; i < end; i++) {
+            __m256i va = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)a + i), rgb);
+            __m256i vb = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)b + i), rgb);
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            max = _mm256_max_epu8(max, d);
+            __m256i lo = _mm256_unpacklo_epi8(d, zero), hi = _mm256_unpackhi_epi8(d, zero);
+            acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+        }
+        total = _mm256_add_epi64(total, _mm256_add_epi64(_mm256_unpacklo_epi32(acc, zero),
+                                                         _mm256_unpackhi_epi32(acc, zero)));
+    }
+
+    uint8_t lanes[32];
+    uint64_t sums[4];
+    _mm256_storeu_si256((__m256i *)lanes, max);
+    _mm256_storeu_si256((__m256i *)sums, total);
+    int m;
+    uint64_t tail;
+    diff_stats_sse2(a + n*32, b + n*32, num_pixels - n*8, &m, &tail);
+    for (int j = 0; j < 32; j++)
+        if (lanes[j] > m) m = lanes[j];
+    *max_error = m;
+    *sse = sums[0] + sums[1] + sums[2] + sums[3] + tail;
+}
+
+static inline ssim_sums_t ssim_reduce_sse2(__m128i sa, __m128i sb, __m128i saa, __m128i sbb, __m128i sab)
+{
+    uint32_t v[5][4];
+    _mm_storeu_si128((__m128i *)v[0], sa);
+    _mm_storeu_si128((__m128i *)v[1], sb);
+    _mm_storeu_si128((__m128i *)v[2], saa);
+    _mm_storeu_si128((__m128i *)v[3], sbb);
+    _mm_storeu_si128((__m128i *)v[4], sab);
+    return (ssim_sums_t){
+        v[0][0] + v[0][1] + v[0][2] + v[0][3],
+        v[1][0] + v[1][1] + v[1][2] + v[1][3],
+        v[2][0] + v[2][1] + v[2][2] + v[2][3],
+        v[3][0] + v[3][1] + v[3][2] + v[3][3],
+        v[4][0] + v[4][1] + v[4][2] + v[4][3],
+    };
+}
+
+static ssim_sums_t ssim_window_sse2(const uint8_t *a, const uint8_t *b, int stride)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sa = zero, sb = zero, saa = zero, sbb = zero, sab = zero;
+    for (int y = 0; y < SSIM_WINDOW; y++, a += stride, b += stride) {
+        __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)a), zero);
+        __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)b), zero);
+        sa = _mm_add_epi32(sa, _mm_madd_epi16(va, ones));
+        sb = _mm_add_epi32(sb, _mm_madd_epi16(vb, ones));
+        saa = _mm_add_epi32(saa, _mm_madd_epi16(va, va));
+        sbb = _mm_add_epi32(sbb, _mm_madd_epi16(vb, vb));
+        sab = _mm_add_epi32(sab, _mm_madd_epi16(va, vb));
+    }
+    return ssim_reduce_sse2(sa, sb, saa, sbb, sab);
+}
+
+// Two horizontally adjacent windows at once, one per 128-bit lane.
+__attribute__((target("avx2")))
+static void ssim_window_pair_avx2(const uint8_t *a, const uint8_t *b, int stride, ssim_sums_t out[2])
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sa = _mm256_setzero_si256(), sb = sa, saa = sa, sbb = sa, sab = sa;
+    for (int y = 0; y < SSIM_WINDOW; y++, a += stride, b += stride) {
+        __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)a));
+        __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)b));
+        sa = _mm256_add_epi32(sa, _mm256_madd_epi16(va, ones));
+        sb = _mm256_add_epi32(sb, _mm256_madd_epi16(vb, ones));
+        saa = _mm256_add_epi32(saa, _mm256_madd_epi16(va, va));
+        sbb = _mm256_add_epi32(sbb, _mm256_madd_epi16(vb, vb));
+        sab = _mm256_add_epi32(sab, _mm256_madd_epi16(va, vb));
+    }
+    out[0] = ssim_reduce_sse2(_mm256_castsi256_si128(sa), _mm256_castsi256_si128(sb), _mm256_castsi256_si128(saa),
+                              _mm256_castsi256_si128(sbb), _mm256_castsi256_si128(sab));
+    out[1] = ssim_reduce_sse2(_mm256_extracti128_si256(sa, 1), _mm256_extracti128_si256(sb, 1),
+                              _mm256_extracti128_si256(saa, 1), _mm256_extracti128_si256(sbb, 1),
+                              _mm256_extracti128_si256(sab, 1));
+}
+
+#else
+
+static ssim_sums_t ssim_window_scalar(const uint8_t *a, const uint8_t *b, int stride)
+{
+    ssim_sums_t s = {0};
+    for (int y = 0; y < SSIM_WINDOW; y++, a += stride, b += stride) {
+        for (int x = 0; x < SSIM_WINDOW; x++) {
+            s.a += a[x];
+            s.b += b[x];
+            s.aa += (uint32_t)(a[x]*a[x]);
+            s.bb += (uint32_t)(b[x]*b[x]);
+            s.ab += (uint32_t)(a[x]*b[x]);
+        }
+    }
+    return s;
+}
+
+#endif
+
+static double ssim_from_sums(ssim_sums_t s, double n)
+{
+    const double c1 = (0.01*255)*(0.01*255);
+    const double c2 = (0.03*255)*(0.03*255);
+    double mu_a = s.a / n, mu_b = s.b / n;
+    double var_a = s.aa / n - mu_a*mu_a;
+    double var_b = s.bb / n - mu_b*mu_b;
+    double cov = s.ab / n - mu_a*mu_b;
+    return ((2*mu_a*mu_b + c1)*(2*cov + c2)) / ((mu_a*mu_a + mu_b*mu_b + c1)*(var_a + var_b + c2));
+}
+
+static bool metrics_have_avx2(void)
+{
+#ifdef METRICS_X86
+    static int avx2 = -1;
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") != 0;
+    }
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+static void diff_stats(const uint8_t *a, const uint8_t *b, size_t num_pixels, int *max_error, uint64_t *sse)
+{
+#ifdef METRICS_X86
+    if (metrics_have_avx2())
+        diff_stats_avx2(a, b, num_pixels, max_error, sse);
+    else
+        diff_stats_sse2(a, b, num_pixels, max_error, sse);
+#else
+    diff_stats_scalar(a, b, num_pixels, max_error, sse);
+#endif
+}
+
+// Rec. 601 luma of the RGB channels.
+static void rgba_to_luma(uint8_t *dst, const uint8_t *rgba, size_t num_pixels)
+{
+    for (size_t i = 0; i < num_pixels; i++, rgba += 4)
+        dst[i] = (uint8_t)((77*rgba[0] + 150*rgba[1] + 29*rgba[2] + 128) >> 8);
+}
+
+// Mean SSIM of two luma planes. Images smaller than a window are treated as a single window.
+static double luma_ssim(const uint8_t *a, const uint8_t *b, int width, int height)
+{
+    if (width < SSIM_WINDOW || height < SSIM_WINDOW) {
+        ssim_sums_t s = {0};
+        for (size_t i = 0; i < (size_t)width*(size_t)height; i++) {
+            s.a += a[i];
+            s.b += b[i];
+            s.aa += (uint32_t)(a[i]*a[i]);
+            s.bb += (uint32_t)(b[i]*b[i]);
+            s.ab += (uint32_t)(a[i]*b[i]);
+        }
+        return ssim_from_sums(s, (double)width*height);
+    }
+
+#ifdef METRICS_X86
+    bool avx2 = metrics_have_avx2();
+#endif
+    double total = 0.0;
+    long count = 0;
+    for (int y = 0; y + SSIM_WINDOW <= height; y += SSIM_STEP) {
+        const uint8_t *ra = a + (size_t)y*(size_t)width, *rb = b + (size_t)y*(size_t)width;
+        int x = 0;
+#ifdef METRICS_X86
+        // Windows x and x+8 share one 16 byte load; x+4 and x+12 follow, then skip to x+16.
+        if (avx2) {
+            for (; x + 16 + SSIM_STEP <= width; x += 16) {
+                ssim_sums_t s[2];
+                ssim_window_pair_avx2(ra + x, rb + x, width, s);
+                total += ssim_from_sums(s[0], 64.0) + ssim_from_sums(s[1], 64.0);
+                ssim_window_pair_avx2(ra + x + SSIM_STEP, rb + x + SSIM_STEP, width, s);
+                total += ssim_from_sums(s[0], 64.0) + ssim_from_sums(s[1], 64.0);
+                count += 4;
+            }
+        }
+#endif
+        for (; x + SSIM_WINDOW <= width; x += SSIM_STEP) {
+#ifdef METRICS_X86
+            total += ssim_from_sums(ssim_window_sse2(ra + x, rb + x, width), 64.0);
+#else
+            total += ssim_from_sums(ssim_window_scalar(ra + x, rb + x, width), 64.0);
+#endif
+            count++;
+        }
+    }
+    return total / (double)count;
+}
+
+/*
+ * Computes the metrics of two bottom-up RGBA images. luma must hold
+ * 2*width*height bytes of scratch space.
+ */
+static image_metrics_t image_metrics(const uint8_t *a, const uint8_t *b, int width, int height, uint8_t *luma)
+{
+    image_metrics_t m;
+    size_t n = (size_t)width*(size_t)height;
+    uint64_t sse;
+    diff_stats(a, b, n, &m.max_error, &sse);
+    m.mse = (double)sse / (double)(n*3);
+    m.psnr = sse ? 10.0*log10(255.0*255.0 / m.mse) : INFINITY;
+
+    rgba_to_luma(luma, a, n);
+    rgba_to_luma(luma + n, b, n);
+    m.ssim = luma_ssim(luma, luma + n, width, height);
+    return m;
+}
+
+// Builds a visualization of the differences: the reference dimmed, with errors in red.
+static void make_diff_image(uint8_t *dst, const uint8_t *image, const uint8_t *reference, int width, int height)
+{
+    for (size_t i = 0; i < (size_t)width*(size_t)height; i++, dst += 4, image += 4, reference += 4) {
+        int d = 0;
+        for (int c = 0; c < 3; c++) {
+            int e = abs((int)image[c] - (int)reference[c]);
+            if (e > d) d = e;
+        }
+        int gray = (77*reference[0] + 150*reference[1] + 29*reference[2]) >> 10;
+        int red = gray + d*8;
+        dst[0] = (uint8_t)(red > 255 ? 255 : red);
+        dst[1] = (uint8_t)(d ? 0 : gray);
+        dst[2] = (uint8_t)(d ? 0 : gray);
+        dst[3] = 255;
+    }
+}
+
+#endif
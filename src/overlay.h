@@ -0,0 +1,194 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+/*
+ * Overlay geometry. Every rectangle and glyph is one quad instance with
+ * its corners, texture coordinates and color; the vertex shader expands
+ * it into two triangles. That is 36 bytes per quad where six vertices
+ * were 120, and building text is mostly writing those bytes.
+ */
+
+#include "common.h"
+#include "font.h"
+#include "memory.h"
+#include <math.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OVERLAY_SSE 1
+#endif
+
+#define TEXT_LINE_HEIGHT    20.0f
+#define TEXT_BATCH          64
+
+#define make_rect(x, y, w, h) (rect_t){(x), (y), (w), (h)}
+
+#pragma pack(push, 1)
+typedef struct
+{
+    float left, top, right, bottom;
+    float u0, v0, u1, v1;
+    uint32_t color;
+} overlay_quad_t;
+#pragma pack(pop)
+
+static overlay_quad_t *quad_buffer;
+
+static inline overlay_quad_t make_quad(rect_t r, rect_t uv, uint32_t color)
+{
+    return (overlay_quad_t){ r.x, r.y, r.x+r.w, r.y+r.h, uv.x, uv.y, uv.x+uv.w, uv.y+uv.h, color };
+}
+
+static inline void push_quad(rect_t r, rect_t uv, uint32_t color)
+{
+    *array_reserve(quad_buffer, 1) = make_quad(r, uv, color);
+}
+
+/*
+ * Copy of the glyph metrics laid out for batched layout, indexed by byte:
+ * the advances as a plain array for the prefix sum, the rest as one vector
+ * per glyph in the order of a quad's fields. Bytes without a glyph map to
+ * the first one, as in get_glyph(), on either signedness of char.
+ */
+typedef struct
+{
+    float advance[256];
+    alignas(16) float offset[256][4];  // offset_x, -offset_y, offset_x, -offset_y
+    alignas(16) float size[256][4];    // -0, -0, width, height (-0 keeps the sign of zero corners)
+    alignas(16) float uv[256][4];      // u0, v0, u1, v1
+    float max_advance;
+    // Whole pixel advances sum exactly in any order, which the vector prefix sum relies on.
+    bool integral;
+    bool ready;
+} glyph_metrics_t;
+
+static glyph_metrics_t glyph_metrics;
+
+static void glyph_metrics_init(void)
+{
+    glyph_metrics_t *m = &glyph_metrics;
+    m->integral = true;
+    for (int c = 0; c < 256; c++) {
+        const glyph_t *g = c < 32 || c >= 32 + NUM_GLYPHS ? &glyph_data[0] : &glyph_data[c - 32];
+        m->advance[c] = g->advance_x;
+        m->offset[c][0] = m->offset[c][2] = (float)g->offset_x;
+        m->offset[c][1] = m->offset[c][3] = -(float)g->offset_y;
+        m->size[c][0] = m->size[c][1] = -0.0f;
+        m->size[c][2] = (float)g->width;
+        m->size[c][3] = (float)g->height;
+        m->uv[c][0] = g->uv.x;
+        m->uv[c][1] = g->uv.y;
+        m->uv[c][2] = g->uv.x + g->uv.w;
+        m->uv[c][3] = g->uv.y + g->uv.h;
+        if (g->advance_x != floorf(g->advance_x)) m->integral = false;
+        if (fabsf(g->advance_x) > m->max_advance) m->max_advance = fabsf(g->advance_x);
+    }
+    m->ready = true;
+}
+
+/*
+ * Pen positions of n characters starting at x: pen[i] = x + sum of the
+ * advances before i. With exact set, they are computed four at a time
+ * with an in-register prefix sum, which adds in a different order than
+ * one character at a time. Returns the pen position after the last one.
+ */
+static float layout_pens(const unsigned char *str, int n, float x, float *pen, bool exact)
+{
+    const float *adv = glyph_metrics.advance;
+    int i = 0;
+#ifdef OVERLAY_SSE
+    __m128 carry = _mm_set1_ps(x);
+    for (; exact && i + 4 <= n; i += 4) {
+        __m128 a = _mm_setr_ps(adv[str[i]], adv[str[i+1]], adv[str[i+2]], adv[str[i+3]]);
+        // Exclusive prefix sum: shift in zeros, then add shifted by one and two lanes.
+        __m128 e = _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(a), 4));
+        e = _mm_add_ps(e, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(e), 4)));
+        e = _mm_add_ps(e, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(e), 8)));
+        __m128 p = _mm_add_ps(carry, e);
+        _mm_storeu_ps(pen + i, p);
+        carry = _mm_shuffle_ps(_mm_add_ps(p, a), _mm_add_ps(p, a), _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    x = _mm_cvtss_f32(carry);
+#endif
+    for (; i < n; i++) {
+        pen[i] = x;
+        x += adv[str[i]];
+    }
+    return x;
+}
+
+// Emits the quads of n characters of one line, given their pen positions.
+static void layout_batch(overlay_quad_t *q, const unsigned char *str, int n, const float *pen, float y, uint32_t color)
+{
+    const glyph_metrics_t *m = &glyph_metrics;
+#ifdef OVERLAY_SSE
+    const __m128 vy = _mm_set1_ps(y);
+    for (int i = 0; i < n; i++, q++) {
+        const unsigned char c = str[i];
+        // (pen, y, pen, y) + (ox, -oy, ox, -oy) + (-0, -0, w, h) adds exactly like make_quad().
+        __m128 p = _mm_unpacklo_ps(_mm_set1_ps(pen[i]), vy);
+        p = _mm_add_ps(_mm_add_ps(p, _mm_load_ps(m->offset[c])), _mm_load_ps(m->size[c]));
+        _mm_storeu_ps(&q->left, p);
+        _mm_storeu_ps(&q->u0, _mm_load_ps(m->uv[c]));
+        q->color = color;
+    }
+#else
+    for (int i = 0; i < n; i++, q++) {
+        const unsigned char c = str[i];
+        q->left = pen[i] + m->offset[c][0];
+        q->top = y + m->offset[c][1];
+        q->right = q->left + m->size[c][2];
+        q->bottom = q->top + m->size[c][3];
+        memcpy(&q->u0, m->uv[c], sizeof m->uv[c]);
+        q->color = color;
+    }
+#endif
+}
+
+/*
+ * Lays the string out line by line in batches: pen positions from a
+ * vector prefix sum of the advances, then each glyph's corners from one
+ * vector add. The quads are identical to laying out one character at a
+ * time. Sums of whole pixels below 2^24 are exact in any order; lines that
+ * could leave that range, or start between pixels, get their pen
+ * positions summed one at a time.
+ */
+static void push_text(const char *str, size_t len, float x, float y)
+{
+    if (!len) return;
+    if (!glyph_metrics.ready) glyph_metrics_init();
+
+    size_t num_glyphs = len;
+    for (const char *p = str; (p = memchr(p, '\n', len - (size_t)(p - str))); p++)
+        num_glyphs--;
+
+    overlay_quad_t *q = array_reserve(quad_buffer, num_glyphs);
+    const unsigned char *line = (const unsigned char *)str, *end = line + len;
+    float pen[TEXT_BATCH];
+    for (;;) {
+        const unsigned char *eol = memchr(line, '\n', (size_t)(end - line));
+        if (!eol) eol = end;
+
+        bool exact = glyph_metrics.integral && x == floorf(x) &&
+                     fabsf(x) + (float)(eol - line)*glyph_metrics.max_advance < 16777216.0f;
+        float pen_x = x;
+        for (const unsigned char *c = line; c < eol; ) {
+            int n = eol - c < TEXT_BATCH ? (int)(eol - c) : TEXT_BATCH;
+            pen_x = layout_pens(c, n, pen_x, pen, exact);
+            layout_batch(q, c, n, pen, y, 0xFFFFFFFF);
+            q += n;
+            c += n;
+        }
+
+        if (eol == end) break;
+        y += TEXT_LINE_HEIGHT;
+        line = eol + 1;
+    }
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef PACING_H
+#define PACING_H
+
+/*
+ * Frame pacing from present timing. With vsync, a frame that starts right
+ * after a vblank and finishes early waits for the next one, and its input
+ * ages all the while. The pacer instead sleeps until delay after a vblank,
+ * so input is read and the frame drawn just before the vblank it is meant
+ * for. Each presented frame is checked once its swap is done: if it made
+ * its vblank the delay grows a little, if it missed the delay backs off by
+ * an eighth of the refresh period. The same timing gives the latency from
+ * reading input to the frame reaching the screen.
+ */
+
+#include "platform.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define PACING_FRAMES       8           // Presented frames waiting for their timing
+#define PACING_STEP_NS      25000       // Delay growth per frame that made its vblank
+#define PACING_MARGIN_NS    1000000     // Slack always left before the vblank
+#define PACING_MIN_PERIOD   1000000     // Refresh periods outside these are ignored
+#define PACING_MAX_PERIOD   100000000
+
+typedef struct
+{
+    int64_t swap;           // platform_t.swaps after its present()
+    int64_t input_ns;       // When its input was read
+    int64_t target_msc;     // Vblank it was drawn for
+} pacing_frame_t;
+
+typedef struct
+{
+    bool active;            // Backend reports present timing
+    bool auto_delay;
+    int64_t delay_ns;       // Frame start after a vblank
+    int64_t period_ns;
+    int64_t vblank_ns;
+    int64_t msc;
+    int64_t target_msc;
+    pacing_frame_t frames[PACING_FRAMES];
+    int num_frames;
+    double latency_ms;      // Input to present, smoothed
+    uint64_t presented;
+    uint64_t missed;
+} frame_pacer_t;
+
+static inline int64_t pacing_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+// A negative delay_ms tunes the delay automatically.
+static void pacing_init(frame_pacer_t *f, platform_t *p, double delay_ms)
+{
+    platform_timing_t t;
+    *f = (frame_pacer_t){0};
+    f->active = p->timing(p, &t);
+    f->auto_delay = delay_ms < 0.0;
+    f->delay_ns = f->auto_delay ? 0 : (int64_t)(delay_ms*1e6);
+}
+
+static void pacing_result(frame_pacer_t *f, const pacing_frame_t *frame, const platform_timing_t *t)
+{
+    double latency = (double)(t->swap_ns - frame->input_ns) / 1e6;
+    f->latency_ms = f->presented ? f->latency_ms*0.9 + latency*0.1 : latency;
+    f->presented++;
+
+    bool missed = t->swap_msc > frame->target_msc;
+    if (missed) f->missed++;
+    if (!f->auto_delay || !f->period_ns) return;
+    if (missed) f->delay_ns -= f->period_ns/8;
+    else f->delay_ns += PACING_STEP_NS;
+    int64_t max_delay = f->period_ns - PACING_MARGIN_NS;
+    if (f->delay_ns > max_delay) f->delay_ns = max_delay;
+    if (f->delay_ns < 0) f->delay_ns = 0;
+}
+
+/*
+ * Picks up the timing of finished frames and sleeps until the next frame
+ * should start. Only the last completed swap has a known time, frames
+ * that finished before it are dropped unmeasured.
+ */
+static void pacing_wait(frame_pacer_t *f, platform_t *p)
+{
+    platform_timing_t t;
+    if (!f->active || !p->timing(p, &t)) return;
+
+    if (f->msc && t.msc > f->msc) {
+        int64_t period = (t.vblank_ns - f->vblank_ns) / (t.msc - f->msc);
+        if (period >= PACING_MIN_PERIOD && period <= PACING_MAX_PERIOD)
+            f->period_ns = f->period_ns ? (f->period_ns*7 + period)/8 : period;
+    }
+    f->vblank_ns = t.vblank_ns;
+    f->msc = t.msc;
+
+    int kept = 0;
+    for (int i = 0; i < f->num_frames; i++) {
+        const pacing_frame_t *frame = &f->frames[i];
+        if (frame->swap == t.sbc && t.swap_ns) pacing_result(f, frame, &t);
+        else if (frame->swap > t.sbc) f->frames[kept++] = *frame;
+    }
+    f->num_frames = kept;
+
+    f->target_msc = t.msc + 1;
+    if (!f->period_ns) return;
+    int64_t start = t.vblank_ns + f->delay_ns;
+    int64_t now = pacing_now();
+    // Late frames start at once and aim for whichever vblank is next by then.
+    if (start <= now) {
+        f->target_msc += (now - t.vblank_ns) / f->period_ns;
+        return;
+    }
+    struct timespec ts = { (time_t)(start / 1000000000), (long)(start % 1000000000) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+// Records a presented frame whose input was read at input_ns.
+static void pacing_presented(frame_pacer_t *f, const platform_t *p, int64_t input_ns)
+{
+    if (!f->active) return;
+    if (f->num_frames == PACING_FRAMES) {
+        memmove(f->frames, f->frames + 1, (PACING_FRAMES - 1)*sizeof *f->frames);
+        f->num_frames--;
+    }
+    f->frames[f->num_frames++] = (pacing_frame_t){ p->swaps, input_ns, f->target_msc };
+}
+
+#endif
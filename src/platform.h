@@ -0,0 +1,117 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+/*
+ * Window system backends. A backend owns the GL context and hands the
+ * render loop a framebuffer to draw into each frame, along with its input
+ * as platform events. The X11 backend draws into a GLX window, the EGL
+ * backend into an FBO on a surfaceless context without any display server.
+ */
+
+#include "gl.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <EGL/egl.h>
+#include <GL/glx.h>
+#include <X11/Xlib.h>
+
+#define PLATFORM_KEY_F12        1
+#define PLATFORM_BUTTON_LEFT    1
+// Wheel steps come as presses without a release.
+#define PLATFORM_BUTTON_WHEEL_UP    4
+#define PLATFORM_BUTTON_WHEEL_DOWN  5
+
+typedef enum
+{
+    PLATFORM_EVENT_QUIT,
+    PLATFORM_EVENT_RESIZE,
+    PLATFORM_EVENT_MOTION,
+    PLATFORM_EVENT_BUTTON_PRESS,
+    PLATFORM_EVENT_BUTTON_RELEASE,
+    PLATFORM_EVENT_KEY_PRESS,
+} platform_event_type_t;
+
+typedef struct
+{
+    platform_event_type_t type;
+    int x;      // Pointer position, or the new size on resize
+    int y;
+    int button;
+    int key;
+} platform_event_t;
+
+// Present timing, times are CLOCK_MONOTONIC nanoseconds.
+typedef struct
+{
+    int64_t vblank_ns;  // Last vblank
+    int64_t msc;        // Vblanks counted so far
+    int64_t sbc;        // Swaps completed so far
+    int64_t swap_ns;    // When the last completed swap reached the screen
+    int64_t swap_msc;   // At which vblank
+} platform_timing_t;
+
+// How presented frames reach the screen.
+typedef enum
+{
+    PLATFORM_FLIP_OFFSCREEN,    // Not at all
+    PLATFORM_FLIP_COMPOSITED,   // Copied by a compositing manager
+    PLATFORM_FLIP_BYPASS,       // Fullscreen with the compositor asked to unredirect it
+    PLATFORM_FLIP_DIRECT,       // No compositing manager running
+} platform_flip_t;
+
+typedef struct platform platform_t;
+typedef struct x11_events x11_events_t;
+
+struct platform
+{
+    const char *name;
+    // Creates a GL 4.5 core context and makes it current. Invisible
+    // windows are used by modes that only render offscreen.
+    bool (*init)(platform_t *p, int width, int height, bool visible);
+    void (*destroy)(platform_t *p);
+    bool (*next_event)(platform_t *p, platform_event_t *event);
+    // Framebuffer the frame should be drawn into, valid until present().
+    GLuint (*begin_frame)(platform_t *p);
+    void (*present)(platform_t *p);
+    // Pointer position right now, false if it is outside the window and no button is held.
+    bool (*query_pointer)(platform_t *p, int *x, int *y);
+    // False if the backend cannot tell when frames reach the screen.
+    bool (*timing)(platform_t *p, platform_timing_t *t);
+    platform_flip_t (*flip_mode)(platform_t *p);
+
+    int width;
+    int height;
+    float scale;    // Overlay pixels per logical pixel, from the display's DPI
+    bool headless;
+    bool fullscreen;    // Set before init(), covers the screen and bypasses the compositor
+    int64_t swaps;  // Swaps issued, counted like platform_timing_t.sbc
+
+    union
+    {
+        struct
+        {
+            Display *display;       // The render thread's, for GLX and queries
+            Window window;
+            GLXContext ctx;
+            x11_events_t *events;   // The event thread and its connection
+            bool oml;   // GLX_OML_sync_control
+            Atom net_wm_state;
+            Atom net_wm_state_fullscreen;
+            Atom net_wm_cm;             // Selection owned by the compositing manager
+            platform_flip_t flip;
+            bool flip_valid;            // Cleared when the window state may have changed
+        } x11;
+
+        struct
+        {
+            EGLDisplay display;
+            EGLContext ctx;
+            GLuint fbo;
+            GLuint texture;
+            int fbo_width;
+            int fbo_height;
+        } egl;
+    };
+};
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef PLATFORM_EGL_H
+#define PLATFORM_EGL_H
+
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+static void *egl_get_proc(const char *name)
+{
+    return (void *)eglGetProcAddress(name);
+}
+
+static bool egl_has_extension(EGLDisplay display, const char *name)
+{
+    const char *exts = eglQueryString(display, EGL_EXTENSIONS);
+    size_t len = strlen(name);
+    for (const char *p = exts; p && (p = strstr(p, name)); p += len) {
+        if ((p == exts || p[-1] == ' ') && (p[len] == ' ' || p[len] == 0)) return true;
+    }
+    return false;
+}
+
+// Prefers Mesa's surfaceless platform and falls back to the first EGL device.
+static EGLDisplay egl_open_display(void)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!eglGetPlatformDisplayEXT) return EGL_NO_DISPLAY;
+
+    EGLint major, minor;
+    if (egl_has_extension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")) {
+        EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor)) return display;
+    }
+
+    PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+    if (eglQueryDevicesEXT && egl_has_extension(EGL_NO_DISPLAY, "EGL_EXT_platform_device")) {
+        EGLDeviceEXT device;
+        EGLint num_devices = 0;
+        if (eglQueryDevicesEXT(1, &device, &num_devices) && num_devices > 0) {
+            EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+            if (display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor)) return display;
+        }
+    }
+
+    return EGL_NO_DISPLAY;
+}
+
+static bool egl_init(platform_t *p, int width, int height, bool visible)
+{
+    (void)visible;
+
+    static const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION,          4,
+        EGL_CONTEXT_MINOR_VERSION,          5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK,    EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
+        EGL_NONE
+    };
+
+    EGLDisplay display = egl_open_display();
+    if (display == EGL_NO_DISPLAY) {
+        fprintf(stderr, "Cannot open a surfaceless EGL display.\n");
+        return false;
+    }
+
+    if (!egl_has_extension(display, "EGL_KHR_surfaceless_context") || !eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "EGL display lacks surfaceless desktop GL support.\n");
+        eglTerminate(display);
+        return false;
+    }
+
+    // Nothing is ever drawn to an EGL surface, so any config will do if one is required.
+    EGLConfig config = EGL_NO_CONFIG_KHR;
+    if (!egl_has_extension(display, "EGL_KHR_no_config_context")) {
+        static const EGLint config_attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLint num_configs = 0;
+        if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs == 0) {
+            eglTerminate(display);
+            return false;
+        }
+    }
+
+    EGLContext ctx = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if (ctx == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+        fprintf(stderr, "Cannot create a GL 4.5 core context (0x%x).\n", eglGetError());
+        if (ctx != EGL_NO_CONTEXT) eglDestroyContext(display, ctx);
+        eglTerminate(display);
+        return false;
+    }
+    gl_get_proc_address = egl_get_proc;
+
+    p->egl.display = display;
+    p->egl.ctx = ctx;
+    p->egl.fbo = 0;
+    p->egl.texture = 0;
+    p->egl.fbo_width = 0;
+    p->egl.fbo_height = 0;
+    p->width = width;
+    p->height = height;
+    p->scale = 1.0f;
+    return true;
+}
+
+static void egl_destroy(platform_t *p)
+{
+    if (p->egl.fbo) {
+        glDeleteFramebuffers(1, &p->egl.fbo);
+        glDeleteTextures(1, &p->egl.texture);
+    }
+    eglMakeCurrent(p->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(p->egl.display, p->egl.ctx);
+    eglTerminate(p->egl.display);
+}
+
+static bool egl_next_event(platform_t *p, platform_event_t *e)
+{
+    (void)p;
+    (void)e;
+    return false;
+}
+
+static bool egl_query_pointer(platform_t *p, int *x, int *y)
+{
+    (void)p;
+    (void)x;
+    (void)y;
+    return false;
+}
+
+static bool egl_timing(platform_t *p, platform_timing_t *t)
+{
+    (void)p;
+    (void)t;
+    return false;
+}
+
+static platform_flip_t egl_flip_mode(platform_t *p)
+{
+    (void)p;
+    return PLATFORM_FLIP_OFFSCREEN;
+}
+
+// The target is created on first use, once the GL entry points are loaded.
+static GLuint egl_begin_frame(platform_t *p)
+{
+    if (!p->egl.fbo || p->egl.fbo_width != p->width || p->egl.fbo_height != p->height) {
+        if (!p->egl.fbo) glGenFramebuffers(1, &p->egl.fbo);
+        if (p->egl.texture) glDeleteTextures(1, &p->egl.texture);
+        glGenTextures(1, &p->egl.texture);
+        glBindTexture(GL_TEXTURE_2D, p->egl.texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, p->width, p->height);
+        glBindFramebuffer(GL_FRAMEBUFFER, p->egl.fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, p->egl.texture, 0);
+        p->egl.fbo_width = p->width;
+        p->egl.fbo_height = p->height;
+    }
+    return p->egl.fbo;
+}
+
+static void egl_present(platform_t *p)
+{
+    (void)p;
+    glFlush();
+}
+
+static const platform_t platform_egl = {
+    .name = "egl",
+    .init = egl_init,
+    .destroy = egl_destroy,
+    .next_event = egl_next_event,
+    .begin_frame = egl_begin_frame,
+    .present = egl_present,
+    .query_pointer = egl_query_pointer,
+    .timing = egl_timing,
+    .flip_mode = egl_flip_mode,
+    .headless = true,
+};
+
+#endif
@@ -0,0 +1,418 @@
+#ifndef PLATFORM_X11_H
+#define PLATFORM_X11_H
+
+#include "event_queue.h"
+#include "platform.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <GL/glx.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+
+static PFNGLXSWAPINTERVALEXTPROC glXSwapIntervalEXT;
+static PFNGLXGETSYNCVALUESOMLPROC glXGetSyncValuesOML;
+static PFNGLXWAITFORSBCOMLPROC glXWaitForSbcOML;
+
+static void *x11_get_proc(const char *name)
+{
+    return (void *)glXGetProcAddress((const GLubyte *)name);
+}
+
+/*
+ * The window is created on a second connection that only the event thread
+ * reads, turning X events into platform events on a queue to the render
+ * thread. A blocked swap or a slow compile leaves events waiting in the
+ * queue instead of the socket, and a burst of events never delays a frame.
+ * The render thread keeps the first connection for GLX and its queries, so
+ * no Display is used from two threads and Xlib needs no locking.
+ */
+struct x11_events
+{
+    Display *display;
+    Window window;
+    Atom wm_delete_window;
+    Atom net_wm_state;
+    int wake_fd;                // Stops the thread
+    atomic_bool stop;
+    atomic_bool flip_stale;     // The window state changed
+    pthread_t thread;
+    event_queue_t queue;
+};
+
+static bool x11_translate(x11_events_t *ev, const XEvent *event, platform_event_t *e)
+{
+    switch (event->type) {
+        case MotionNotify: {
+            *e = (platform_event_t){ .type = PLATFORM_EVENT_MOTION, .x = event->xmotion.x, .y = event->xmotion.y };
+        } return true;
+
+        case ButtonPress:
+        case ButtonRelease: {
+            int button;
+            if (event->xbutton.button == Button1) button = PLATFORM_BUTTON_LEFT;
+            else if (event->xbutton.button == Button4 && event->type == ButtonPress) button = PLATFORM_BUTTON_WHEEL_UP;
+            else if (event->xbutton.button == Button5 && event->type == ButtonPress) button = PLATFORM_BUTTON_WHEEL_DOWN;
+            else break;
+            *e = (platform_event_t){
+                .type = event->type == ButtonPress ? PLATFORM_EVENT_BUTTON_PRESS : PLATFORM_EVENT_BUTTON_RELEASE,
+                .x = event->xbutton.x, .y = event->xbutton.y, .button = button
+            };
+        } return true;
+
+        case ClientMessage: {
+            if ((Atom)event->xclient.data.l[0] != ev->wm_delete_window) break;
+            *e = (platform_event_t){ .type = PLATFORM_EVENT_QUIT };
+        } return true;
+
+        case PropertyNotify: {
+            if (event->xproperty.atom == ev->net_wm_state) atomic_store(&ev->flip_stale, true);
+        } break;
+
+        case ConfigureNotify: {
+            atomic_store(&ev->flip_stale, true);
+            *e = (platform_event_t){ .type = PLATFORM_EVENT_RESIZE, .x = event->xconfigure.width,
+                                     .y = event->xconfigure.height };
+        } return true;
+
+        case KeyPress: {
+            // XLookupKeysym() takes a non-const event.
+            XKeyEvent key = event->xkey;
+            if (XLookupKeysym(&key, 0) != XK_F12) break;
+            *e = (platform_event_t){ .type = PLATFORM_EVENT_KEY_PRESS, .key = PLATFORM_KEY_F12 };
+        } return true;
+    }
+    return false;
+}
+
+/*
+ * Motion is dropped when the render thread falls that far behind, the
+ * pointer is read again before each frame anyway. Anything else waits for
+ * room.
+ */
+static void x11_queue_event(x11_events_t *ev, const platform_event_t *e)
+{
+    while (!event_queue_push(&ev->queue, e)) {
+        if (e->type == PLATFORM_EVENT_MOTION || atomic_load(&ev->stop)) return;
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void *x11_event_thread(void *arg)
+{
+    x11_events_t *ev = arg;
+    struct pollfd fds[2] = { { ConnectionNumber(ev->display), POLLIN, 0 }, { ev->wake_fd, POLLIN, 0 } };
+    while (!atomic_load(&ev->stop)) {
+        // XPending() reads whatever arrived into Xlib's queue, poll() then waits for more.
+        while (XPending(ev->display)) {
+            XEvent event;
+            platform_event_t e;
+            XNextEvent(ev->display, &event);
+            if (x11_translate(ev, &event, &e)) x11_queue_event(ev, &e);
+        }
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+    }
+    return NULL;
+}
+
+static void x11_events_destroy(x11_events_t *ev)
+{
+    if (ev->wake_fd >= 0) close(ev->wake_fd);
+    if (ev->window) XDestroyWindow(ev->display, ev->window);
+    XCloseDisplay(ev->display);
+    free(ev);
+}
+
+/*
+ * With opaque set, the config must have a visual of the root window's
+ * depth: compositors blend windows with 32 bit visuals and will not
+ * unredirect them.
+ */
+static GLXContext create_context(Display *display, bool opaque, GLXFBConfig *config_out)
+{
+    static const int visual_attribs[] = {
+        GLX_X_RENDERABLE,   True,
+        GLX_DRAWABLE_TYPE,  GLX_WINDOW_BIT,
+        GLX_RENDER_TYPE,    GLX_RGBA_BIT,
+        GLX_X_VISUAL_TYPE,  GLX_TRUE_COLOR,
+        GLX_RED_SIZE,       8,
+        GLX_GREEN_SIZE,     8,
+        GLX_BLUE_SIZE,      8,
+        GLX_ALPHA_SIZE,     8,
+        GLX_DEPTH_SIZE,     24,
+        GLX_DOUBLEBUFFER,   True,
+        None
+    };
+
+    static const int context_attribs[] = {
+        GLX_CONTEXT_MAJOR_VERSION_ARB,  4,
+        GLX_CONTEXT_MINOR_VERSION_ARB,  5,
+        GLX_CONTEXT_FLAGS_ARB,          GLX_CONTEXT_FORWARD_COMPATIBLE_BIT_ARB,
+        GLX_CONTEXT_PROFILE_MASK_ARB,   GLX_CONTEXT_CORE_PROFILE_BIT_ARB,
+        None
+    };
+    
+    int num_configs;
+    GLXFBConfig *configs = glXChooseFBConfig(display, DefaultScreen(display), visual_attribs, &num_configs);
+    if (!configs || !num_configs) return NULL;
+
+    GLXFBConfig config = configs[0];
+    XVisualInfo *vi = glXGetVisualFromFBConfig(display, config);
+    for (int i = 1; opaque && vi && vi->depth != DefaultDepth(display, DefaultScreen(display)) && i < num_configs; i++) {
+        XVisualInfo *other = glXGetVisualFromFBConfig(display, configs[i]);
+        if (!other) continue;
+        XFree(vi);
+        vi = other;
+        config = configs[i];
+    }
+    XFree(configs);
+    if (!vi) return NULL;
+
+    GLXContext ctx = glXCreateContext(display, vi, 0, GL_TRUE);
+    XFree(vi);
+    if (!ctx) return NULL;
+
+    PFNGLXCREATECONTEXTATTRIBSARBPROC glXCreateContextAttribsARB = (PFNGLXCREATECONTEXTATTRIBSARBPROC)x11_get_proc("glXCreateContextAttribsARB");
+    glXSwapIntervalEXT = (PFNGLXSWAPINTERVALEXTPROC)x11_get_proc("glXSwapIntervalEXT");
+    glXGetSyncValuesOML = (PFNGLXGETSYNCVALUESOMLPROC)x11_get_proc("glXGetSyncValuesOML");
+    glXWaitForSbcOML = (PFNGLXWAITFORSBCOMLPROC)x11_get_proc("glXWaitForSbcOML");
+    glXDestroyContext(display, ctx);
+
+    ctx = glXCreateContextAttribsARB(display, config, NULL, GL_TRUE, context_attribs);
+    if (!ctx) return NULL;
+
+    *config_out = config;
+    return ctx;
+}
+
+static bool x11_init(platform_t *p, int width, int height, bool visible)
+{
+    Display *display = XOpenDisplay(NULL);
+    if (!display) {
+        fprintf(stderr, "Cannot open display, use --headless to run without X.\n");
+        return false;
+    }
+
+    GLXFBConfig config;
+    GLXContext ctx = create_context(display, p->fullscreen, &config);
+    if (!ctx) {
+        XCloseDisplay(display);
+        return false;
+    }
+
+    x11_events_t *ev = aligned_alloc(alignof(x11_events_t), sizeof *ev);
+    if (!ev) {
+        glXDestroyContext(display, ctx);
+        XCloseDisplay(display);
+        return false;
+    }
+    memset(ev, 0, sizeof *ev);
+    ev->wake_fd = -1;
+    atomic_init(&ev->stop, false);
+    atomic_init(&ev->flip_stale, false);
+    event_queue_init(&ev->queue);
+    ev->display = XOpenDisplay(NULL);
+    if (!ev->display) {
+        free(ev);
+        glXDestroyContext(display, ctx);
+        XCloseDisplay(display);
+        return false;
+    }
+
+    int screen = DefaultScreen(display);
+    if (p->fullscreen) {
+        width = DisplayWidth(display, screen);
+        height = DisplayHeight(display, screen);
+    }
+
+    XSetWindowAttributes attr = {0};
+    attr.event_mask = ExposureMask|StructureNotifyMask|PointerMotionMask|KeyPressMask|ButtonPressMask|ButtonReleaseMask|
+                      PropertyChangeMask;
+    // Messages from the window manager go to the connection that created the window.
+    Window window = XCreateWindow(ev->display, DefaultRootWindow(ev->display), 0, 0, (unsigned)width,
+                                  (unsigned)height, 0, CopyFromParent, InputOutput, CopyFromParent, CWEventMask, &attr);
+    ev->window = window;
+    ev->wm_delete_window = XInternAtom(ev->display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(ev->display, window, &ev->wm_delete_window, 1);
+    p->x11.net_wm_state = XInternAtom(display, "_NET_WM_STATE", False);
+    ev->net_wm_state = p->x11.net_wm_state;
+    p->x11.net_wm_state_fullscreen = XInternAtom(display, "_NET_WM_STATE_FULLSCREEN", False);
+    char cm_name[32];
+    snprintf(cm_name, sizeof cm_name, "_NET_WM_CM_S%d", screen);
+    p->x11.net_wm_cm = XInternAtom(display, cm_name, False);
+    p->x11.flip_valid = false;
+    if (p->fullscreen) {
+        // Window managers read the initial state when the window is mapped.
+        XChangeProperty(ev->display, window, p->x11.net_wm_state, XA_ATOM, 32, PropModeReplace,
+                        (const unsigned char *)&p->x11.net_wm_state_fullscreen, 1);
+        long bypass = 1;
+        XChangeProperty(ev->display, window, XInternAtom(ev->display, "_NET_WM_BYPASS_COMPOSITOR", False),
+                        XA_CARDINAL, 32, PropModeReplace, (const unsigned char *)&bypass, 1);
+    }
+    if (visible) XMapWindow(ev->display, window);
+    // The window must exist on the server before the other connection draws to it.
+    XSync(ev->display, False);
+
+    ev->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (ev->wake_fd < 0 || pthread_create(&ev->thread, NULL, x11_event_thread, ev) != 0) {
+        x11_events_destroy(ev);
+        glXDestroyContext(display, ctx);
+        XCloseDisplay(display);
+        return false;
+    }
+
+    glXMakeCurrent(display, window, ctx);
+    if (glXSwapIntervalEXT) glXSwapIntervalEXT(display, window, 1);
+    gl_get_proc_address = x11_get_proc;
+
+    p->x11.display = display;
+    p->x11.window = window;
+    p->x11.ctx = ctx;
+    p->x11.events = ev;
+    p->x11.oml = false;
+    p->swaps = 0;
+    // Entry points resolve whether or not the server supports them, the extension string decides.
+    const char *exts = glXQueryExtensionsString(display, DefaultScreen(display));
+    int64_t ust, msc, sbc;
+    if (exts && strstr(exts, "GLX_OML_sync_control") && glXGetSyncValuesOML && glXWaitForSbcOML &&
+        visible && glXGetSyncValuesOML(display, window, &ust, &msc, &sbc)) {
+        p->x11.oml = true;
+        p->swaps = sbc;
+    }
+    p->width = width;
+    p->height = height;
+    // Desktops put their scale factor in Xft.dpi, 96 is unscaled.
+    const char *dpi = XGetDefault(display, "Xft", "dpi");
+    p->scale = dpi && atof(dpi) > 0.0 ? (float)(atof(dpi) / 96.0) : 1.0f;
+    return true;
+}
+
+static void x11_destroy(platform_t *p)
+{
+    x11_events_t *ev = p->x11.events;
+    atomic_store(&ev->stop, true);
+    uint64_t one = 1;
+    if (write(ev->wake_fd, &one, sizeof one) != sizeof one) perror("eventfd");
+    pthread_join(ev->thread, NULL);
+
+    glXMakeCurrent(p->x11.display, None, NULL);
+    glXDestroyContext(p->x11.display, p->x11.ctx);
+    x11_events_destroy(ev);
+    XCloseDisplay(p->x11.display);
+}
+
+static bool x11_next_event(platform_t *p, platform_event_t *e)
+{
+    if (!event_queue_pop(&p->x11.events->queue, e)) return false;
+    if (e->type == PLATFORM_EVENT_RESIZE) {
+        p->width = e->x;
+        p->height = e->y;
+    }
+    return true;
+}
+
+static GLuint x11_begin_frame(platform_t *p)
+{
+    (void)p;
+    return 0;
+}
+
+static void x11_present(platform_t *p)
+{
+    glXSwapBuffers(p->x11.display, p->x11.window);
+    p->swaps++;
+}
+
+static bool x11_query_pointer(platform_t *p, int *x, int *y)
+{
+    Window root, child;
+    int root_x, root_y, win_x, win_y;
+    unsigned mask;
+    if (!XQueryPointer(p->x11.display, p->x11.window, &root, &child, &root_x, &root_y, &win_x, &win_y, &mask))
+        return false;
+    // Outside the window the pointer only counts while dragging, as with motion events.
+    bool inside = win_x >= 0 && win_y >= 0 && win_x < p->width && win_y < p->height;
+    if (!inside && !(mask & (Button1Mask|Button2Mask|Button3Mask))) return false;
+    *x = win_x;
+    *y = win_y;
+    return true;
+}
+
+// Mesa reports UST in microseconds of CLOCK_MONOTONIC.
+static bool x11_timing(platform_t *p, platform_timing_t *t)
+{
+    int64_t ust, msc, sbc;
+    if (!p->x11.oml || !glXGetSyncValuesOML(p->x11.display, p->x11.window, &ust, &msc, &sbc)) return false;
+    t->vblank_ns = ust*1000;
+    t->msc = msc;
+    t->sbc = sbc;
+    t->swap_ns = 0;
+    t->swap_msc = 0;
+    // Swaps up to sbc are done, so this returns the time of the last one without blocking.
+    if (sbc > 0 && glXWaitForSbcOML(p->x11.display, p->x11.window, sbc, &ust, &msc, &sbc)) {
+        t->swap_ns = ust*1000;
+        t->swap_msc = msc;
+        t->sbc = sbc;
+    }
+    return true;
+}
+
+static bool x11_is_fullscreen(platform_t *p)
+{
+    Atom type;
+    int format;
+    unsigned long count, after;
+    unsigned char *data = NULL;
+    bool fullscreen = false;
+    if (XGetWindowProperty(p->x11.display, p->x11.window, p->x11.net_wm_state, 0, 64, False, XA_ATOM,
+                           &type, &format, &count, &after, &data) == Success && data) {
+        if (type == XA_ATOM && format == 32) {
+            const Atom *atoms = (const Atom *)data;
+            for (unsigned long i = 0; i < count; i++)
+                if (atoms[i] == p->x11.net_wm_state_fullscreen) fullscreen = true;
+        }
+        XFree(data);
+    }
+    return fullscreen;
+}
+
+/*
+ * Without a compositing manager frames flip straight to the screen. With
+ * one, only a window the window manager made fullscreen and that asks for
+ * bypass is expected to be unredirected; whether the compositor honours it
+ * cannot be seen from here. Compositors may start or stop at any time, so
+ * their selection is checked again every call.
+ */
+static platform_flip_t x11_flip_mode(platform_t *p)
+{
+    if (XGetSelectionOwner(p->x11.display, p->x11.net_wm_cm) == None) return PLATFORM_FLIP_DIRECT;
+    if (atomic_exchange(&p->x11.events->flip_stale, false)) p->x11.flip_valid = false;
+    if (!p->x11.flip_valid) {
+        p->x11.flip = p->fullscreen && x11_is_fullscreen(p) ? PLATFORM_FLIP_BYPASS : PLATFORM_FLIP_COMPOSITED;
+        p->x11.flip_valid = true;
+    }
+    return p->x11.flip;
+}
+
+static const platform_t platform_x11 = {
+    .name = "x11",
+    .init = x11_init,
+    .destroy = x11_destroy,
+    .next_event = x11_next_event,
+    .begin_frame = x11_begin_frame,
+    .present = x11_present,
+    .query_pointer = x11_query_pointer,
+    .timing = x11_timing,
+    .flip_mode = x11_flip_mode,
+};
+
+#endif
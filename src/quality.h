@@ -0,0 +1,187 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+/*
+ * Quality ladder. The shader is built once per level with QUALITY defined
+ * from 0, the cheapest, up to num_levels-1; a shader picks its costs with
+ * it like with any other #define:
+ *
+ *     #if QUALITY >= 2
+ *     #define MAX_STEPS 128
+ *     #endif
+ *
+ * The level in use is built at once and the rest in the background where
+ * the driver compiles in parallel, ahead of time otherwise, so switching
+ * levels is only a different program. The controller averages the GPU
+ * time of the current level over a window of frames, steps down when it is
+ * over budget and up when it is well under. Stepping up again right after
+ * stepping down waits, longer every time it bounces, so a level just over
+ * the budget is not retried every few frames.
+ */
+
+#include "gl.h"
+#include "shader.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define QUALITY_MAX_LEVELS  8
+#define QUALITY_WINDOW      30      // GPU time samples averaged per decision
+#define QUALITY_SETTLE      4       // Samples dropped after a switch
+#define QUALITY_HEADROOM    0.6     // Steps up only below this share of the budget
+#define QUALITY_UP_DELAY    120     // Samples after stepping down before stepping up, doubled per bounce
+#define QUALITY_MAX_BOUNCES 5
+#define QUALITY_STABLE      600     // Samples on one level that forgive the bounces
+
+typedef struct
+{
+    int num_levels;         // 1 without a ladder, then QUALITY is not defined
+    bool ladder;
+    int level;
+    double budget_ms;
+    program_job_t jobs[QUALITY_MAX_LEVELS];
+    GLuint programs[QUALITY_MAX_LEVELS];
+    bool built[QUALITY_MAX_LEVELS];     // Nothing pending, programs[] is final and possibly 0
+
+    double sum_ms;
+    int samples;
+    int skip;
+    int hold;               // Samples before stepping up is allowed
+    int bounces;
+    int stable;             // Samples since the last switch
+    double average_ms;      // Last full window
+} quality_t;
+
+// levels of 0 builds the shader as is, without a ladder.
+static void quality_init(quality_t *q, int levels, double budget_ms)
+{
+    *q = (quality_t){0};
+    q->ladder = levels > 0;
+    q->num_levels = q->ladder ? levels : 1;
+    q->level = q->num_levels - 1;
+    q->budget_ms = budget_ms;
+    for (int i = 0; i < QUALITY_MAX_LEVELS; i++)
+        q->built[i] = true;
+}
+
+static void quality_clear(quality_t *q)
+{
+    for (int i = 0; i < q->num_levels; i++) {
+        if (q->built[i]) {
+            if (q->programs[i]) glDeleteProgram(q->programs[i]);
+        } else {
+            program_cancel(&q->jobs[i]);
+        }
+        q->programs[i] = 0;
+        q->built[i] = true;
+    }
+}
+
+static void quality_destroy(quality_t *q)
+{
+    quality_clear(q);
+}
+
+/*
+ * Builds every level of header, source and footer, see program_submit().
+ * Returns the program of the current level, or 0 with log_buffer set if it
+ * failed. The other levels become available as quality_poll() finds them
+ * done, or are dropped if the current level failed so its error stays.
+ */
+static GLuint quality_build(quality_t *q, GLuint vs, const char *header, const char *source, const char *footer)
+{
+    quality_clear(q);
+    if (glMaxShaderCompilerThreadsKHR && q->num_levels > 1)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+
+    char defines[QUALITY_MAX_LEVELS][48];
+    for (int i = 0; i < q->num_levels; i++) {
+        // The current level goes first, the driver may well work in submission order.
+        int level = (q->level + i) % q->num_levels;
+        // The define must not move the user's line numbers, in logs and __LINE__.
+        if (q->ladder) snprintf(defines[level], sizeof defines[level], "#define QUALITY %d\n#line 1\n", level);
+        else defines[level][0] = 0;
+        const char *src[4] = { header, defines[level], source, footer };
+        program_submit(&q->jobs[level], vs, src, 4);
+        q->built[level] = false;
+    }
+
+    q->programs[q->level] = program_finish(&q->jobs[q->level]);
+    q->built[q->level] = true;
+    GLuint program = q->programs[q->level];
+    if (!program) {
+        quality_clear(q);
+        return 0;
+    }
+    // Without parallel compilation, finishing later would stall a frame, so it is done now.
+    for (int i = 0; i < q->num_levels && !glMaxShaderCompilerThreadsKHR; i++) {
+        if (q->built[i]) continue;
+        q->programs[i] = program_finish(&q->jobs[i]);
+        q->built[i] = true;
+        if (!q->programs[i]) fprintf(stderr, "QUALITY %d failed to build.\n", i);
+    }
+    q->samples = 0;
+    q->sum_ms = 0.0;
+    q->skip = QUALITY_SETTLE;
+    return program;
+}
+
+// Collects levels that finished building in the background.
+static void quality_poll(quality_t *q)
+{
+    for (int i = 0; i < q->num_levels; i++) {
+        if (q->built[i] || !program_ready(&q->jobs[i])) continue;
+        q->programs[i] = program_finish(&q->jobs[i]);
+        q->built[i] = true;
+        if (!q->programs[i]) fprintf(stderr, "QUALITY %d failed to build.\n", i);
+    }
+}
+
+static inline GLuint quality_program(const quality_t *q)
+{
+    return q->programs[q->level];
+}
+
+static void quality_switch(quality_t *q, int level)
+{
+    q->level = level;
+    q->skip = QUALITY_SETTLE;
+    q->stable = 0;
+}
+
+/*
+ * Feeds the GPU time of a frame drawn at level. Returns true if the level
+ * changed, the caller then moves to quality_program().
+ */
+static bool quality_sample(quality_t *q, int level, double ms)
+{
+    if (!q->ladder || level != q->level) return false;
+    if (q->skip > 0) {
+        q->skip--;
+        return false;
+    }
+    if (q->hold > 0) q->hold--;
+    if (++q->stable >= QUALITY_STABLE) q->bounces = 0;
+
+    q->sum_ms += ms;
+    if (++q->samples < QUALITY_WINDOW) return false;
+    q->average_ms = q->sum_ms / q->samples;
+    q->sum_ms = 0.0;
+    q->samples = 0;
+
+    int down = q->level - 1, up = q->level + 1;
+    if (q->average_ms > q->budget_ms && down >= 0 && q->built[down] && q->programs[down]) {
+        q->hold = QUALITY_UP_DELAY << q->bounces;
+        if (q->bounces < QUALITY_MAX_BOUNCES) q->bounces++;
+        quality_switch(q, down);
+        return true;
+    }
+    if (q->average_ms < q->budget_ms*QUALITY_HEADROOM && up < q->num_levels && !q->hold &&
+        q->built[up] && q->programs[up]) {
+        quality_switch(q, up);
+        return true;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef READBACK_H
+#define READBACK_H
+
+/*
+ * Ring of buffers read back without stalling. The caller fills the buffer
+ * readback_begin() returns, readback_end() fences it, and readback_collect()
+ * maps it for a callback once the fence has signalled, a frame or more
+ * later, so the render loop never waits on the GPU. While every buffer is
+ * still in flight readback_begin() returns -1 and the frame is dropped.
+ */
+
+#include "gl.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define READBACK_MAX_BUFFERS 4
+
+typedef struct
+{
+    GLenum target;  // Binding the buffers are filled through
+    GLuint buffers[READBACK_MAX_BUFFERS];
+    GLsizeiptr sizes[READBACK_MAX_BUFFERS];
+    GLsync fences[READBACK_MAX_BUFFERS];
+    int num_buffers;
+    int head; // Next buffer to issue
+    int tail; // Oldest buffer in flight
+    int in_flight;
+    uint64_t dropped;
+} readback_ring_t;
+
+// Gets the slot, mapped contents and size of a buffer whose fence has signalled.
+typedef void (*readback_fn)(void *user, int slot, const void *data, GLsizeiptr size);
+
+static void readback_init(readback_ring_t *r, GLenum target, int num_buffers)
+{
+    memset(r, 0, sizeof *r);
+    if (num_buffers > READBACK_MAX_BUFFERS) num_buffers = READBACK_MAX_BUFFERS;
+    r->target = target;
+    r->num_buffers = num_buffers;
+    glGenBuffers(num_buffers, r->buffers);
+}
+
+static void readback_destroy(readback_ring_t *r)
+{
+    for (int i = 0; i < r->num_buffers; i++) {
+        if (r->fences[i]) glDeleteSync(r->fences[i]);
+    }
+    if (r->num_buffers) glDeleteBuffers(r->num_buffers, r->buffers);
+    memset(r, 0, sizeof *r);
+}
+
+// Hands every buffer whose fence has signalled to fn, oldest first, without waiting.
+static void readback_collect(readback_ring_t *r, readback_fn fn, void *user)
+{
+    while (r->in_flight > 0) {
+        int slot = r->tail;
+        GLenum status = glClientWaitSync(r->fences[slot], 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+        glDeleteSync(r->fences[slot]);
+        r->fences[slot] = 0;
+
+        glBindBuffer(r->target, r->buffers[slot]);
+        const void *p = glMapBufferRange(r->target, 0, r->sizes[slot], GL_MAP_READ_BIT);
+        if (p) {
+            fn(user, slot, p, r->sizes[slot]);
+            glUnmapBuffer(r->target);
+        }
+        glBindBuffer(r->target, 0);
+
+        r->tail = (r->tail + 1) % r->num_buffers;
+        r->in_flight--;
+    }
+}
+
+/*
+ * Returns the slot of the next buffer, at least size bytes and left bound
+ * to the ring's target, or -1 if every buffer is in flight.
+ */
+static int readback_begin(readback_ring_t *r, GLsizeiptr size)
+{
+    if (r->in_flight == r->num_buffers) {
+        r->dropped++;
+        return -1;
+    }
+    int slot = r->head;
+    glBindBuffer(r->target, r->buffers[slot]);
+    if (r->sizes[slot] != size) {
+        glBufferData(r->target, size, NULL, GL_STREAM_READ);
+        r->sizes[slot] = size;
+    }
+    return slot;
+}
+
+// Fences the commands filling the buffer from readback_begin().
+static void readback_end(readback_ring_t *r)
+{
+    r->fences[r->head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r->head = (r->head + 1) % r->num_buffers;
+    r->in_flight++;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef SDF_H
+#define SDF_H
+
+/*
+ * Signed distance fields for overlay text. A glyph's coverage bitmap is
+ * upsampled with bilinear filtering and the exact Euclidean distance
+ * transform of the result is sampled back at texel centers. Partly covered
+ * cells start at their distance from half coverage, so features thinner
+ * than a texel, like the dot of an i, keep some weight. The result is
+ * stored with 0.5 on the outline, more inside, less outside, reaching 0
+ * and 1 at the padding distance. Texture filtering then interpolates
+ * distances rather than coverage, so a glyph scales up without blurring
+ * and the shader can draw outlines and shadows from the same texels.
+ */
+
+#include "common.h"
+#include "font.h"
+#include "memory.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SDF_UPSAMPLE        4
+#define SDF_INF             1e20f
+#define SDF_FONT_PADDING    4       // Texels of distance around each built-in glyph
+#define SDF_FONT_WIDTH      256
+#define SDF_FONT_HEIGHT     256
+
+// Squared distance transform of one row or column in place (Felzenszwalb and Huttenlocher).
+static void sdf_edt_1d(float *f, int n, int stride, float *d, int *v, float *z)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = -SDF_INF;
+    z[1] = SDF_INF;
+    for (int q = 1; q < n; q++) {
+        float fq = f[q*stride];
+        float s;
+        for (;;) {
+            int p = v[k];
+            s = ((fq + (float)(q*q)) - (f[p*stride] + (float)(p*p))) / (float)(2*q - 2*p);
+            if (s > z[k] || k == 0) break;
+            k--;
+        }
+        if (s <= z[k]) s = z[k];
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k+1] = SDF_INF;
+    }
+    for (int q = 0, j = 0; q < n; q++) {
+        while (z[j+1] < (float)q) j++;
+        float r = (float)(q - v[j]);
+        d[q] = r*r + f[v[j]*stride];
+    }
+    for (int q = 0; q < n; q++)
+        f[q*stride] = d[q];
+}
+
+// Squared distance from every cell of a w*h grid to the nearest cell that starts at 0.
+static void sdf_edt(float *grid, int w, int h)
+{
+    int n = w > h ? w : h;
+    float *d = xmalloc((size_t)n*sizeof *d);
+    float *z = xmalloc((size_t)(n+1)*sizeof *z);
+    int *v = xmalloc((size_t)n*sizeof *v);
+    for (int x = 0; x < w; x++)
+        sdf_edt_1d(grid + x, h, w, d, v, z);
+    for (int y = 0; y < h; y++)
+        sdf_edt_1d(grid + (size_t)y*(size_t)w, w, 1, d, v, z);
+    free(d);
+    free(z);
+    free(v);
+}
+
+static float sdf_coverage(const uint8_t *src, int w, int h, int stride, int x, int y)
+{
+    if (x < 0 || y < 0 || x >= w || y >= h) return 0.0f;
+    return (float)src[(size_t)y*(size_t)stride + (size_t)x] / 255.0f;
+}
+
+/*
+ * Writes the distance field of a w*h coverage bitmap, with pad texels
+ * added on every side, to (w + 2*pad)*(h + 2*pad) texels at dst.
+ */
+static void sdf_generate(const uint8_t *src, int w, int h, int src_stride, int pad, uint8_t *dst, int dst_stride)
+{
+    int ow = w + 2*pad, oh = h + 2*pad;
+    int fw = ow*SDF_UPSAMPLE, fh = oh*SDF_UPSAMPLE;
+    size_t cells = (size_t)fw*(size_t)fh;
+    float *inside = xmalloc(cells*sizeof *inside);
+    float *outside = xmalloc(cells*sizeof *outside);
+    for (int fy = 0; fy < fh; fy++) {
+        float sy = ((float)fy + 0.5f) / SDF_UPSAMPLE - (float)pad - 0.5f;
+        int y0 = (int)floorf(sy);
+        float ty = sy - (float)y0;
+        for (int fx = 0; fx < fw; fx++) {
+            float sx = ((float)fx + 0.5f) / SDF_UPSAMPLE - (float)pad - 0.5f;
+            int x0 = (int)floorf(sx);
+            float tx = sx - (float)x0;
+            float top = sdf_coverage(src, w, h, src_stride, x0, y0)*(1.0f - tx) +
+                        sdf_coverage(src, w, h, src_stride, x0+1, y0)*tx;
+            float bottom = sdf_coverage(src, w, h, src_stride, x0, y0+1)*(1.0f - tx) +
+                           sdf_coverage(src, w, h, src_stride, x0+1, y0+1)*tx;
+            float a = top*(1.0f - ty) + bottom*ty;
+            size_t i = (size_t)fy*(size_t)fw + (size_t)fx;
+            // Distance to the inside is measured from outside cells and the other way around.
+            float in = a > 0.5f ? 0.0f : (0.5f - a)*SDF_UPSAMPLE;
+            float out = a < 0.5f ? 0.0f : (a - 0.5f)*SDF_UPSAMPLE;
+            inside[i] = a >= 1.0f ? 0.0f : a <= 0.0f ? SDF_INF : in*in;
+            outside[i] = a <= 0.0f ? 0.0f : a >= 1.0f ? SDF_INF : out*out;
+        }
+    }
+    sdf_edt(inside, fw, fh);
+    sdf_edt(outside, fw, fh);
+
+    const int c = SDF_UPSAMPLE/2;
+    for (int y = 0; y < oh; y++) {
+        for (int x = 0; x < ow; x++) {
+            // Texel centers fall between fine cells, the four around each are averaged.
+            float d = 0.0f;
+            for (int j = -1; j <= 0; j++) {
+                for (int i = -1; i <= 0; i++) {
+                    size_t k = (size_t)(y*SDF_UPSAMPLE + c + j)*(size_t)fw + (size_t)(x*SDF_UPSAMPLE + c + i);
+                    d += sqrtf(outside[k]) - sqrtf(inside[k]);
+                }
+            }
+            d /= 4.0f*SDF_UPSAMPLE;
+            float v = 0.5f + d/(2.0f*(float)pad);
+            v = v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+            dst[(size_t)y*(size_t)dst_stride + (size_t)x] = (uint8_t)(v*255.0f + 0.5f);
+        }
+    }
+    free(inside);
+    free(outside);
+}
+
+static glyph_t font_sdf_glyphs[NUM_GLYPHS];
+
+/*
+ * Converts the built-in font to distance fields, packed in rows into a
+ * SDF_FONT_WIDTH*SDF_FONT_HEIGHT texture at pixels, and switches
+ * get_glyph() to the padded glyphs. Their quads take in the padding, so
+ * outlines and shadows have room around the glyph.
+ */
+static void font_sdf_init(uint8_t *pixels)
+{
+    memset(pixels, 0, (size_t)SDF_FONT_WIDTH*SDF_FONT_HEIGHT);
+    const uint8_t *src = font_data + NUM_GLYPHS*sizeof(glyph_t);
+    int x = 0, y = 0, row_height = 0;
+    for (int c = 0; c < NUM_GLYPHS; c++) {
+        glyph_t g = glyph_data[c];
+        if (g.width && g.height) {
+            int w = g.width + 2*SDF_FONT_PADDING, h = g.height + 2*SDF_FONT_PADDING;
+            if (x + w > SDF_FONT_WIDTH) {
+                x = 0;
+                y += row_height;
+                row_height = 0;
+            }
+            int sx = (int)lroundf(g.uv.x*FONT_TEXTURE_WIDTH), sy = (int)lroundf(g.uv.y*FONT_TEXTURE_HEIGHT);
+            sdf_generate(src + sy*FONT_TEXTURE_WIDTH + sx, g.width, g.height, FONT_TEXTURE_WIDTH,
+                         SDF_FONT_PADDING, pixels + (size_t)y*SDF_FONT_WIDTH + (size_t)x, SDF_FONT_WIDTH);
+
+            g.uv = (rect_t){ (float)x / SDF_FONT_WIDTH, (float)y / SDF_FONT_HEIGHT,
+                             (float)w / SDF_FONT_WIDTH, (float)h / SDF_FONT_HEIGHT };
+            g.width = w;
+            g.height = h;
+            g.offset_x -= SDF_FONT_PADDING;
+            g.offset_y += SDF_FONT_PADDING;
+            x += w;
+            if (h > row_height) row_height = h;
+        }
+        font_sdf_glyphs[c] = g;
+    }
+    glyph_data = font_sdf_glyphs;
+}
+
+#endif
@@ -0,0 +1,418 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include "gl.h"
+#include "hash.h"
+#include "memory.h"
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Program binaries are only reused if the header matches
+#define PROGRAM_CACHE_MAGIC 0x43425054 // "TPBC"
+// Least recently used binaries are evicted beyond either limit
+#define PROGRAM_CACHE_MAX_BYTES     (64u*1024*1024)
+#define PROGRAM_CACHE_MAX_ENTRIES   512
+
+// Explicit uniform locations
+#define ULOC_RESOLUTION     0
+#define ULOC_TIME           1
+#define ULOC_TIME_DELTA     2
+#define ULOC_FRAME          3
+#define ULOC_MOUSE          4
+
+static char *log_buffer;
+
+static const char *vs_src =
+    "#version 450 core\n"
+    "const vec2[3] verts = vec2[3](\n"
+    "   vec2(-4.0, -1.0),\n"
+    "   vec2(1.0, -1.0),\n"
+    "   vec2(1.0, 4.0));\n"
+    "void main(void) {\n"
+    "   gl_Position = vec4(verts[gl_VertexID], 0.0, 1.0);\n"
+    "}\n";
+
+static const char *fs_header_src =
+    "#version 450 core\n"
+    "layout(location = 0) out vec4 fragColor;\n"
+    "layout(location = 0) uniform vec2 iResolution;\n"
+    "layout(location = 1) uniform float iTime;\n"
+    "layout(location = 2) uniform float iTimeDelta;\n"
+    "layout(location = 3) uniform int iFrame;\n"
+    "layout(location = 4) uniform vec2 iMouse;\n"
+    "layout(binding = 0) uniform sampler2D iChannel0;\n"
+    "layout(binding = 1) uniform sampler3D iChannel1;\n"
+    "#define debugPrint(v)\n";
+
+static const char *fs_footer_src =
+    "void main(void) {\n"
+    "   mainImage(fragColor, gl_FragCoord.xy);\n"
+    "}\n";
+
+// Uploads the built-in inputs, the user program must be in use.
+static inline void set_user_uniforms(int width, int height, double time, double time_delta, int frame, int mouse_x, int mouse_y)
+{
+    glUniform2f(ULOC_RESOLUTION, (float)width, (float)height);
+    glUniform1f(ULOC_TIME, (float)time);
+    glUniform1f(ULOC_TIME_DELTA, (float)time_delta);
+    glUniform1i(ULOC_FRAME, frame);
+    glUniform2f(ULOC_MOUSE, (float)mouse_x, (float)mouse_y);
+}
+
+static void shader_log(GLuint shader)
+{
+    int len;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
+    if (len > 0) {
+        array_clear(log_buffer);
+        array_ensure(log_buffer, (size_t)len);
+        glGetShaderInfoLog(shader, len, &len, log_buffer);
+        assert(log_buffer);
+        array_header(log_buffer)->size = (size_t)len;
+    }
+}
+
+static void program_log(GLuint program)
+{
+    int len;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
+    if (len > 0) {
+        array_clear(log_buffer);
+        array_ensure(log_buffer, (size_t)len);
+        glGetProgramInfoLog(program, len, &len, log_buffer);
+        assert(log_buffer);
+        array_header(log_buffer)->size = (size_t)len;
+    }
+}
+
+static GLuint create_shader(const char **src, int num_src,  GLenum type)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, num_src, src, NULL);
+    glCompileShader(shader);
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status == GL_FALSE) {
+        shader_log(shader);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+static GLuint link_program(GLuint vs, GLuint fs)
+{
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    glDetachShader(program, vs);
+    glDetachShader(program, fs);
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE) {
+        program_log(program);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+static GLuint link_compute_program(GLuint cs)
+{
+    GLuint program = glCreateProgram();
+    glAttachShader(program, cs);
+    glLinkProgram(program);
+    glDetachShader(program, cs);
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE) {
+        program_log(program);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+// The key covers the driver too, binaries are not portable between them.
+static uint64_t program_key(const char **src, int num_src)
+{
+    // Each string seeds the next, so moving text between them changes the key.
+    uint64_t h = 0;
+    const char *renderer = (const char *)glGetString(GL_RENDERER);
+    const char *version = (const char *)glGetString(GL_VERSION);
+    if (renderer) h = hash_bytes(renderer, strlen(renderer), h);
+    if (version) h = hash_bytes(version, strlen(version), h);
+    h = hash_bytes(vs_src, strlen(vs_src), h);
+    for (int i = 0; i < num_src; i++)
+        h = hash_bytes(src[i], strlen(src[i]), h);
+    return h;
+}
+
+// $XDG_CACHE_HOME/tadershoy or ~/.cache/tadershoy, created on demand. NULL if there is none.
+static const char *program_cache_dir(void)
+{
+    static char dir[512];
+    if (!dir[0]) {
+        const char *xdg = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+        int n;
+        if (xdg && xdg[0]) {
+            n = snprintf(dir, sizeof dir, "%s/tadershoy", xdg);
+        } else if (home && home[0]) {
+            n = snprintf(dir, sizeof dir, "%s/.cache", home);
+            if (n > 0 && (size_t)n < sizeof dir) mkdir(dir, 0755);
+            n = snprintf(dir, sizeof dir, "%s/.cache/tadershoy", home);
+        } else {
+            return NULL;
+        }
+        if (n < 0 || (size_t)n >= sizeof dir || (mkdir(dir, 0755) && errno != EEXIST)) {
+            dir[0] = 0;
+            return NULL;
+        }
+    }
+    return dir;
+}
+
+static bool program_cache_path(char *buf, size_t size, uint64_t key)
+{
+    const char *dir = program_cache_dir();
+    if (!dir) return false;
+    int n = snprintf(buf, size, "%s/%016llx.bin", dir, (unsigned long long)key);
+    return n > 0 && (size_t)n < size;
+}
+
+typedef struct
+{
+    char name[32];
+    struct timespec mtime;
+    off_t size;
+} program_cache_entry_t;
+
+static int program_cache_older(const void *a, const void *b)
+{
+    const struct timespec *x = &((const program_cache_entry_t *)a)->mtime;
+    const struct timespec *y = &((const program_cache_entry_t *)b)->mtime;
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+// Deletes the least recently used binaries until the cache is within its limits.
+static void program_cache_trim(void)
+{
+    const char *dir = program_cache_dir();
+    DIR *d = dir ? opendir(dir) : NULL;
+    if (!d) return;
+
+    program_cache_entry_t *entries = NULL;
+    unsigned long long total = 0;
+    char path[600];
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        size_t len = strlen(e->d_name);
+        struct stat st;
+        // Only finished binaries, temporary files belong to a store in progress.
+        if (len != 20 || strcmp(e->d_name + 16, ".bin")) continue;
+        snprintf(path, sizeof path, "%s/%s", dir, e->d_name);
+        if (stat(path, &st)) continue;
+        program_cache_entry_t entry = { .mtime = st.st_mtim, .size = st.st_size };
+        memcpy(entry.name, e->d_name, len + 1);
+        array_push_back(entries, entry);
+        total += (unsigned long long)st.st_size;
+    }
+    closedir(d);
+
+    size_t n = array_size(entries);
+    if (total > PROGRAM_CACHE_MAX_BYTES || n > PROGRAM_CACHE_MAX_ENTRIES) {
+        qsort(entries, n, sizeof *entries, program_cache_older);
+        for (size_t i = 0; i < n && (total > PROGRAM_CACHE_MAX_BYTES || n - i > PROGRAM_CACHE_MAX_ENTRIES); i++) {
+            snprintf(path, sizeof path, "%s/%s", dir, entries[i].name);
+            if (unlink(path) == 0) total -= (unsigned long long)entries[i].size;
+        }
+    }
+    array_free(entries);
+}
+
+static GLuint program_cache_load(uint64_t key)
+{
+    char path[600];
+    if (!program_cache_path(path, sizeof path, key)) return 0;
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+
+    uint32_t header[2];
+    GLuint program = 0;
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && (size_t)st.st_size > sizeof header &&
+        fread(header, sizeof header, 1, fp) == 1 && header[0] == PROGRAM_CACHE_MAGIC) {
+        size_t size = (size_t)st.st_size - sizeof header;
+        void *binary = xmalloc(size);
+        if (fread(binary, 1, size, fp) == size) {
+            program = glCreateProgram();
+            glProgramBinary(program, (GLenum)header[1], binary, (GLsizei)size);
+            GLint status;
+            glGetProgramiv(program, GL_LINK_STATUS, &status);
+            if (status == GL_FALSE) {
+                // Stale entry, e.g. after a driver update. It gets rewritten on the next link.
+                glDeleteProgram(program);
+                program = 0;
+            } else {
+                // The modification time orders eviction, a hit makes the entry the newest.
+                futimens(fileno(fp), NULL);
+            }
+        }
+        free(binary);
+    }
+    fclose(fp);
+
+    return program;
+}
+
+static void program_cache_store(uint64_t key, GLuint program)
+{
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) return;
+
+    char path[600], tmp[610];
+    if (!program_cache_path(path, sizeof path, key)) return;
+    snprintf(tmp, sizeof tmp, "%s.%d", path, (int)getpid());
+
+    uint32_t header[2] = { PROGRAM_CACHE_MAGIC, 0 };
+    void *binary = xmalloc((size_t)size);
+    GLenum format;
+    glGetProgramBinary(program, size, &size, &format, binary);
+    header[1] = format;
+
+    // Write to a temporary file first so concurrent instances never see a partial binary.
+    FILE *fp = fopen(tmp, "wb");
+    if (fp) {
+        bool ok = fwrite(header, sizeof header, 1, fp) == 1 &&
+                  fwrite(binary, 1, (size_t)size, fp) == (size_t)size;
+        ok = fclose(fp) == 0 && ok;
+        if (!ok || rename(tmp, path)) unlink(tmp);
+    }
+    free(binary);
+    program_cache_trim();
+}
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// A program being built, see program_submit().
+typedef struct
+{
+    GLuint program;
+    GLuint shader;      // 0 once done, or if the program came from the cache
+    GLuint vs;
+    uint64_t key;
+    bool cacheable;
+} program_job_t;
+
+/*
+ * Starts building a fragment program against the shared vertex shader vs,
+ * or a compute program if vs is 0, from the num_src strings in src.
+ * Programs found in the binary cache are ready at once. Otherwise nothing
+ * waits on the driver until program_finish(), so drivers with parallel
+ * shader compilation work on every submitted program concurrently.
+ */
+static void program_submit(program_job_t *job, GLuint vs, const char **src, int num_src)
+{
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    *job = (program_job_t){ .vs = vs, .cacheable = num_formats > 0 };
+    if (job->cacheable) {
+        job->key = program_key(src, num_src);
+        job->program = program_cache_load(job->key);
+        if (job->program) return;
+    }
+
+    job->shader = glCreateShader(vs ? GL_FRAGMENT_SHADER : GL_COMPUTE_SHADER);
+    glShaderSource(job->shader, num_src, src, NULL);
+    glCompileShader(job->shader);
+    job->program = glCreateProgram();
+    if (job->cacheable)
+        glProgramParameteri(job->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    if (vs) glAttachShader(job->program, vs);
+    glAttachShader(job->program, job->shader);
+    glLinkProgram(job->program);
+}
+
+// Whether program_finish() would return without waiting. Always true without KHR_parallel_shader_compile.
+static bool program_ready(const program_job_t *job)
+{
+    if (!job->shader || !glMaxShaderCompilerThreadsKHR) return true;
+    GLint done = GL_TRUE;
+    glGetProgramiv(job->program, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+// Waits for the program, returns 0 and sets log_buffer if it failed to build.
+static GLuint program_finish(program_job_t *job)
+{
+    if (!job->shader) return job->program;
+
+    GLint status;
+    glGetProgramiv(job->program, GL_LINK_STATUS, &status);
+    if (job->vs) glDetachShader(job->program, job->vs);
+    glDetachShader(job->program, job->shader);
+    if (status == GL_FALSE) {
+        glGetShaderiv(job->shader, GL_COMPILE_STATUS, &status);
+        if (status == GL_FALSE) shader_log(job->shader);
+        else program_log(job->program);
+        glDeleteProgram(job->program);
+        job->program = 0;
+    } else if (job->cacheable) {
+        program_cache_store(job->key, job->program);
+    }
+    glDeleteShader(job->shader);
+    job->shader = 0;
+    return job->program;
+}
+
+// Drops a job and its program, built or not.
+static void program_cancel(program_job_t *job)
+{
+    if (job->shader) glDeleteShader(job->shader);
+    if (job->program) glDeleteProgram(job->program);
+    *job = (program_job_t){0};
+}
+
+/*
+ * Builds num_programs programs, program i from the num_src[i] strings in
+ * src[i], as program_submit() does. All of them are submitted before any
+ * status is queried. Failed programs are returned as 0 and log_buffer
+ * holds the error of the last failure.
+ */
+static void load_programs(GLuint vs, const char **src[], const int *num_src, int num_programs, GLuint *programs)
+{
+    program_job_t *jobs = xmalloc((size_t)num_programs*sizeof *jobs);
+    if (glMaxShaderCompilerThreadsKHR && num_programs > 1)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+    for (int i = 0; i < num_programs; i++)
+        program_submit(&jobs[i], vs, src[i], num_src[i]);
+    for (int i = 0; i < num_programs; i++)
+        programs[i] = program_finish(&jobs[i]);
+    free(jobs);
+}
+
+static inline GLuint load_program(GLuint vs, const char **src, int num_src)
+{
+    GLuint program;
+    load_programs(vs, &src, &num_src, 1, &program);
+    return program;
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+/*
+ * The shader source is mapped rather than read. The file is mapped over an
+ * anonymous mapping at least one byte longer, so the source ends in a zero
+ * byte wherever the file does and is used as a string without a copy.
+ * file_hash identifies the content, a file saved unchanged needs no
+ * recompile. A file truncated in place while mapped faults on reads past its
+ * new end; editors that save through a rename leave the mapping alone.
+ * Code that reads the source long after loading it, such as forked batch
+ * workers, copies it first with detach_file_buffer().
+ */
+
+#include "hash.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static char *file_buffer;
+static size_t file_mapping;     // Bytes mapped at file_buffer
+static size_t file_size;
+static uint64_t file_hash;
+
+static void free_file_buffer(void)
+{
+    if (file_buffer) munmap(file_buffer, file_mapping);
+    file_buffer = NULL;
+    file_mapping = 0;
+    file_size = 0;
+}
+
+static bool update_file_buffer(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t length = (size + page) & ~(page - 1);
+    char *base = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    // The rest of the file's last page reads as zeros, like the pages after it.
+    if (size && mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, length);
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    free_file_buffer();
+    file_buffer = base;
+    file_mapping = length;
+    file_size = size;
+    file_hash = hash_bytes(file_buffer, size, 0);
+    return true;
+}
+
+// Replaces the file mapping with a private copy of what file_hash describes.
+static bool detach_file_buffer(void)
+{
+    char *copy = mmap(NULL, file_mapping, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == MAP_FAILED) return false;
+    memcpy(copy, file_buffer, file_size);
+    mprotect(copy, file_mapping, PROT_READ);
+    munmap(file_buffer, file_mapping);
+    file_buffer = copy;
+    return true;
+}
+
+#endif
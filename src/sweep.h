@@ -0,0 +1,296 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "gl.h"
+#include "memory.h"
+#include "shader.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Variant sweep. The parameter space is declared in the shader source, one
+ * parameter per line, values ordered from cheapest to highest quality:
+ *
+ *     // @sweep MAX_STEPS 32 64 128
+ *     #ifndef MAX_STEPS
+ *     #define MAX_STEPS 64
+ *     #endif
+ *
+ * Every combination is compiled with the values injected as #defines,
+ * timed on the GPU at a fixed iTime and compared against the combination
+ * using the last value of every parameter.
+ */
+
+#define SWEEP_MAX_PARAMS    16
+#define SWEEP_MAX_VALUES    16
+#define SWEEP_MAX_VARIANTS  4096
+#define SWEEP_WARMUP        4
+#define SWEEP_FRAMES        16
+#define SWEEP_TIME          1.0f
+
+typedef struct
+{
+    char name[64];
+    char values[SWEEP_MAX_VALUES][32];
+    int num_values;
+} sweep_param_t;
+
+typedef struct
+{
+    char *defines;
+    char *label;
+    GLuint program;
+    double time_ms;
+    double rmse;
+    bool pareto;
+} sweep_variant_t;
+
+static int sweep_parse(const char *src, sweep_param_t *params)
+{
+    int num_params = 0;
+    for (const char *p = strstr(src, "@sweep"); p; p = strstr(p, "@sweep")) {
+        p += 6;
+        if (num_params == SWEEP_MAX_PARAMS) {
+            fprintf(stderr, "sweep: too many parameters, max %d\n", SWEEP_MAX_PARAMS);
+            break;
+        }
+
+        sweep_param_t *param = &params[num_params];
+        memset(param, 0, sizeof *param);
+        for (int tok = 0;; tok++) {
+            while (*p == ' ' || *p == '\t') p++;
+            if (!*p || *p == '\n' || *p == '\r') break;
+            const char *start = p;
+            while (*p && !isspace((unsigned char)*p)) p++;
+            size_t len = (size_t)(p - start);
+
+            char *dst;
+            size_t cap;
+            if (tok == 0) {
+                dst = param->name;
+                cap = sizeof param->name;
+            } else if (param->num_values < SWEEP_MAX_VALUES) {
+                dst = param->values[param->num_values++];
+                cap = sizeof param->values[0];
+            } else {
+                continue;
+            }
+            if (len >= cap) len = cap - 1;
+            memcpy(dst, start, len);
+            dst[len] = 0;
+        }
+
+        if (param->name[0] && param->num_values > 0) num_params++;
+    }
+
+    return num_params;
+}
+
+static void sweep_draw(GLuint program, int width, int height)
+{
+    glUseProgram(program);
+    set_user_uniforms(width, height, SWEEP_TIME, 1.0/60.0, 0, -1, -1);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Median GPU time of SWEEP_FRAMES draws in milliseconds.
+static double sweep_time(GLuint program, int width, int height, const GLuint *queries)
+{
+    for (int i = 0; i < SWEEP_WARMUP; i++)
+        sweep_draw(program, width, height);
+
+    for (int i = 0; i < SWEEP_FRAMES; i++) {
+        glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+        sweep_draw(program, width, height);
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+
+    uint64_t ns[SWEEP_FRAMES];
+    for (int i = 0; i < SWEEP_FRAMES; i++)
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns[i]);
+    qsort(ns, SWEEP_FRAMES, sizeof ns[0], compare_u64);
+
+    return (double)ns[SWEEP_FRAMES/2] / 1e6;
+}
+
+static double image_rmse(const uint8_t *a, const uint8_t *b, size_t num_pixels)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < num_pixels*4; i += 4) {
+        for (int c = 0; c < 3; c++) {
+            int d = (int)a[i+c] - (int)b[i+c];
+            sum += (uint64_t)(d*d);
+        }
+    }
+    return sqrt((double)sum / (double)(num_pixels*3));
+}
+
+static int sweep_order(const void *a, const void *b)
+{
+    const sweep_variant_t *x = a, *y = b;
+    if (x->time_ms != y->time_ms) return x->time_ms < y->time_ms ? -1 : 1;
+    return (x->rmse > y->rmse) - (x->rmse < y->rmse);
+}
+
+/*
+ * Runs the sweep for source and prints every variant with its median GPU
+ * time, RMSE and PSNR against the reference, marking the Pareto set.
+ * Returns false if there was nothing to sweep or the reference failed.
+ */
+static bool run_sweep(GLuint vs, const char *header, const char *source, const char *footer, int width, int height)
+{
+    sweep_param_t params[SWEEP_MAX_PARAMS];
+    int num_params = sweep_parse(source, params);
+    if (num_params == 0) {
+        fprintf(stderr, "sweep: no @sweep parameters declared\n");
+        return false;
+    }
+
+    int num_variants = 1;
+    for (int i = 0; i < num_params; i++) {
+        num_variants *= params[i].num_values;
+        if (num_variants > SWEEP_MAX_VARIANTS) {
+            fprintf(stderr, "sweep: parameter space too large, max %d variants\n", SWEEP_MAX_VARIANTS);
+            return false;
+        }
+    }
+
+    sweep_variant_t *variants = xmalloc((size_t)num_variants*sizeof *variants);
+    const char *(*srcs)[4] = xmalloc((size_t)num_variants*sizeof *srcs);
+    const char ***src_ptrs = xmalloc((size_t)num_variants*sizeof *src_ptrs);
+    int *num_srcs = xmalloc((size_t)num_variants*sizeof *num_srcs);
+    GLuint *programs = xmalloc((size_t)num_variants*sizeof *programs);
+
+    // Mixed radix enumeration, the last variant uses the last value of every parameter.
+    for (int v = 0; v < num_variants; v++) {
+        int digits[SWEEP_MAX_PARAMS];
+        int rest = v;
+        for (int i = num_params-1; i >= 0; i--) {
+            digits[i] = rest % params[i].num_values;
+            rest /= params[i].num_values;
+        }
+
+        char *defines = NULL;
+        char *label = NULL;
+        for (int i = 0; i < num_params; i++) {
+            const char *value = params[i].values[digits[i]];
+            char line[128];
+            int n = snprintf(line, sizeof line, "#define %s %s\n", params[i].name, value);
+            for (int c = 0; c < n; c++)
+                array_push_back(defines, line[c]);
+            n = snprintf(line, sizeof line, "%s%s=%s", i ? " " : "", params[i].name, value);
+            for (int c = 0; c < n; c++)
+                array_push_back(label, line[c]);
+        }
+        array_push_back(defines, 0);
+        array_push_back(label, 0);
+
+        variants[v] = (sweep_variant_t){ .defines = defines, .label = label, .rmse = -1.0 };
+        srcs[v][0] = header;
+        srcs[v][1] = defines;
+        srcs[v][2] = source;
+        srcs[v][3] = footer;
+        src_ptrs[v] = srcs[v];
+        num_srcs[v] = 4;
+    }
+
+    fprintf(stderr, "sweep: compiling %d variants\n", num_variants);
+    load_programs(vs, src_ptrs, num_srcs, num_variants, programs);
+    for (int v = 0; v < num_variants; v++)
+        variants[v].program = programs[v];
+
+    GLuint texture, fbo;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glViewport(0, 0, width, height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    GLuint queries[SWEEP_FRAMES];
+    glGenQueries(SWEEP_FRAMES, queries);
+
+    size_t num_pixels = (size_t)width*(size_t)height;
+    uint8_t *reference = xmalloc(num_pixels*4);
+    uint8_t *image = xmalloc(num_pixels*4);
+
+    bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if (!ok) {
+        fprintf(stderr, "sweep: incomplete framebuffer\n");
+    } else if (!programs[num_variants-1]) {
+        fprintf(stderr, "sweep: reference variant failed to build:\n%.*s\n",
+                (int)array_size(log_buffer), log_buffer ? log_buffer : "");
+        ok = false;
+    } else {
+        sweep_draw(programs[num_variants-1], width, height);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, reference);
+    }
+
+    for (int v = ok ? 0 : num_variants; v < num_variants; v++) {
+        if (!programs[v]) continue;
+
+        variants[v].time_ms = sweep_time(programs[v], width, height, queries);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, image);
+        variants[v].rmse = image_rmse(image, reference, num_pixels);
+    }
+
+    if (ok) {
+        qsort(variants, (size_t)num_variants, sizeof *variants, sweep_order);
+
+        // Sorted by time, a variant is on the front if it beats the error of everything faster.
+        double best = INFINITY;
+        for (int v = 0; v < num_variants; v++) {
+            if (!variants[v].program || variants[v].rmse >= best) continue;
+            variants[v].pareto = true;
+            best = variants[v].rmse;
+        }
+
+        printf("%-8s %10s %10s %10s  %s\n", "pareto", "time(ms)", "rmse", "psnr(dB)", "variant");
+        for (int v = 0; v < num_variants; v++) {
+            const sweep_variant_t *var = &variants[v];
+            printf("%-8s ", var->pareto ? "*" : "");
+            if (var->program) {
+                double psnr = var->rmse > 0.0 ? 20.0*log10(255.0/var->rmse) : INFINITY;
+                printf("%10.3f %10.4f %10.2f  ", var->time_ms, var->rmse, psnr);
+            } else {
+                printf("%10s %10s %10s  ", "failed", "-", "-");
+            }
+            printf("%s\n", var->label);
+        }
+    }
+
+    for (int v = 0; v < num_variants; v++) {
+        if (variants[v].program) glDeleteProgram(variants[v].program);
+        array_free(variants[v].defines);
+        array_free(variants[v].label);
+    }
+
+    glDeleteQueries(SWEEP_FRAMES, queries);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &texture);
+
+    free(reference);
+    free(image);
+    free(programs);
+    free(num_srcs);
+    free(src_ptrs);
+    free(srcs);
+    free(variants);
+
+    return ok;
+}
+
+#endif
@@ -1,17 +1,46 @@
+#include "analysis.h"
+#include "atlas.h"
+#include "audio.h"
+#include "batch.h"
 #include "common.h"
+#include "compare.h"
+#include "compute.h"
+#include "control.h"
+#include "debug_print.h"
+#include "export.h"
 #include "font.h"
+#include "gallery.h"
+#include "gl.h"
+#include "image.h"
 #include "memory.h"
+#include "overlay.h"
+#include "pacing.h"
+#include "platform.h"
+#include "platform_egl.h"
+#include "platform_x11.h"
+#include "quality.h"
+#include "sdf.h"
+#include "shader.h"
+#include "source.h"
+#include "sweep.h"
+#include "trace.h"
+#include "uniforms.h"
+#include "volume.h"
+#include "writer.h"
 #include <assert.h>
+#include <errno.h>
 #include <float.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <GL/gl.h>
-#include <GL/glx.h>
-#include <X11/Xlib.h>
 
 // Update the program every N frame
 #define FILE_UPDATE_RATE    10
@@ -19,26 +48,38 @@
 #define NSEC_PER_SEC        1000000000
 #define DEFAULT_WIDTH       1280
 #define DEFAULT_HEIGHT      720
-
-// Explicit uniform locations
-#define ULOC_RESOLUTION     0
-#define ULOC_TIME           1
-#define ULOC_TIME_DELTA     2
-#define ULOC_FRAME          3
-#define ULOC_MOUSE          4
-
-#define make_vertex(pos, uv, color) (vertex_t){(pos), (uv), (color)}
-#define make_vec2(x, y) (vec2){{(x), (y)}}
-#define make_rect(x, y, w, h) (rect_t){(x), (y), (w), (h)}
-
-#pragma pack(push, 1)
-typedef struct
-{
-    vec2 pos;
-    vec2 uv;
-    uint32_t color;
-} vertex_t;
-#pragma pack(pop)
+// Headless and batch playback advance by a fixed step so runs are reproducible
+#define DEFAULT_FPS         60.0
+#define DEFAULT_BATCH_OUTPUT "frame%05d.ppm"
+#define BATCH_WRITER_THREADS 2
+#define BATCH_WRITER_FRAMES 3
+#define DEFAULT_DIFF_OUTPUT "diff%05d.png"
+#define DEFAULT_THRESHOLD 40.0
+// GPU time of a frame the quality ladder steps down above, leaves room in a 60 Hz frame
+#define DEFAULT_FRAME_BUDGET 14.0
+
+// Frames kept for the control server statistics
+#define STATS_FRAMES        120
+// GPU timer queries in flight
+#define GPU_TIMER_FRAMES    4
+// Upper bound on control commands handled per frame
+#define CONTROL_MAX_COMMANDS 64
+
+// Overlay sliders for @slider uniforms, one row per component
+#define SLIDER_WIDTH        120.0f
+#define SLIDER_HEIGHT       16.0f
+#define SLIDER_ROW          20.0f
+#define SLIDER_LABEL        150.0f
+
+// Overlay text style: outline width, then shadow offset, in logical pixels
+#define QUAD_ULOC_TEXT_STYLE 2
+#define TEXT_OUTLINE        1.0f
+#define TEXT_SHADOW         1.5f
+#define OVERLAY_MAX_SCALE   8.0f
+
+// Luminance histogram in the bottom left corner, in logical pixels
+#define HISTOGRAM_WIDTH     384.0f
+#define HISTOGRAM_HEIGHT    64.0f
 
 static const char *file_template =
     "// Inputs:\n"
@@ -53,8 +94,8 @@ static const char *file_template =
 
 static const char *quad_vs_src =
     "#version 450 core\n"
-    "layout(location = 0) in vec2 pos;\n"
-    "layout(location = 1) in vec2 uv;\n"
+    "layout(location = 0) in vec4 rect;\n"
+    "layout(location = 1) in vec4 uvRect;\n"
     "layout(location = 2) in uint color;\n"
     "layout(location = 0) out vec2 fsUV;\n"
     "layout(location = 1) out vec4 fsColor;\n"
@@ -67,92 +108,119 @@ static const char *quad_vs_src =
     "    return vec4(r, g, b, a);\n"
     "}\n"
     "void main(void) {\n"
+    "   // Two triangles per instance: top left, top right, bottom right, bottom right, bottom left, top left.\n"
+    "   bool right = gl_VertexID >= 1 && gl_VertexID <= 3;\n"
+    "   bool bottom = gl_VertexID >= 2 && gl_VertexID <= 4;\n"
+    "   vec2 pos = vec2(right ? rect.z : rect.x, bottom ? rect.w : rect.y);\n"
     "   gl_Position = vec4(2.0*pos.x/iResolution.x-1.0, 1.0-2.0*pos.y/iResolution.y, 0.0, 1.0);\n"
-    "   fsUV = uv;\n"
+    "   fsUV = vec2(right ? uvRect.z : uvRect.x, bottom ? uvRect.w : uvRect.y);\n"
     "   fsColor = unpack_rgba(color);\n"
     "}\n";
 
+// Glyphs are distance fields with the outline at 0.5. fwidth() is how much the distance changes
+// over a pixel, which gives a one pixel wide edge and outlines in pixels at any scale.
 static const char *quad_fs_src =
     "#version 450 core\n"
     "layout(location = 0) out vec4 fragColor;\n"
     "layout(location = 0) in vec2 fsUV;\n"
     "layout(location = 1) in vec4 fsColor;\n"
     "layout(location = 1) uniform sampler2D iSampler;\n"
+    "layout(location = 2) uniform vec3 uTextStyle;\n"
+    "float coverage(float d, float edge, float w) {\n"
+    "    return clamp((d - edge) / w + 0.5, 0.0, 1.0);\n"
+    "}\n"
     "void main(void) {\n"
     "   if (fsUV.x < 0.0) {\n"
     "       fragColor = fsColor;\n"
-    "   } else {\n"
-    "       fragColor = fsColor * texture(iSampler, fsUV).r;\n"
+    "       return;\n"
+    "   }\n"
+    "   float d = texture(iSampler, fsUV).r;\n"
+    "   float w = max(fwidth(d), 1e-4);\n"
+    "   fragColor = fsColor * coverage(d, 0.5, w);\n"
+    "   if (uTextStyle.x > 0.0) {\n"
+    "       float outline = coverage(d, 0.5 - uTextStyle.x*w, w);\n"
+    "       fragColor += vec4(0.0, 0.0, 0.0, outline*fsColor.a) * (1.0 - fragColor.a);\n"
+    "   }\n"
+    "   if (uTextStyle.yz != vec2(0.0)) {\n"
+    "       // Window y points up, the shadow falls right and down.\n"
+    "       vec2 uv = fsUV - dFdx(fsUV)*uTextStyle.y + dFdy(fsUV)*uTextStyle.z;\n"
+    "       float shadow = coverage(texture(iSampler, uv).r, 0.5, w);\n"
+    "       fragColor += vec4(0.0, 0.0, 0.0, 0.8*shadow*fsColor.a) * (1.0 - fragColor.a);\n"
     "   }\n"
     "}\n";
 
-static const char *vs_src =
-    "#version 450 core\n"
-    "const vec2[3] verts = vec2[3](\n"
-    "   vec2(-4.0, -1.0),\n"
-    "   vec2(1.0, -1.0),\n"
-    "   vec2(1.0, 4.0));\n"
-    "void main(void) {\n"
-    "   gl_Position = vec4(verts[gl_VertexID], 0.0, 1.0);\n"
-    "}\n";
-
-static const char *fs_header_src =
-    "#version 450 core\n"
-    "layout(location = 0) out vec4 fragColor;\n"
-    "layout(location = 0) uniform vec2 iResolution;\n"
-    "layout(location = 1) uniform float iTime;\n"
-    "layout(location = 2) uniform float iTimeDelta;\n"
-    "layout(location = 3) uniform int iFrame;\n"
-    "layout(location = 4) uniform vec2 iMouse;\n";
-
-static const char *fs_footer_src =
-    "void main(void) {\n"
-    "   mainImage(fragColor, gl_FragCoord.xy);\n"
-    "}\n";
-
-static PFNGLXSWAPINTERVALEXTPROC glXSwapIntervalEXT;
-static PFNGLGENVERTEXARRAYSPROC glGenVertexArrays;
-static PFNGLDELETEVERTEXARRAYSPROC glDeleteVertexArrays;
-static PFNGLBINDVERTEXARRAYPROC glBindVertexArray;
-static PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray;
-static PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointer;
-static PFNGLVERTEXATTRIBIPOINTERPROC glVertexAttribIPointer;
-static PFNGLGENBUFFERSPROC glGenBuffers;
-static PFNGLDELETEBUFFERSPROC glDeleteBuffers;
-static PFNGLBINDBUFFERPROC glBindBuffer;
-static PFNGLBUFFERDATAPROC glBufferData;
-static PFNGLTEXSTORAGE2DPROC glTexStorage2D;
-static PFNGLCREATESHADERPROC glCreateShader;
-static PFNGLSHADERSOURCEPROC glShaderSource;
-static PFNGLCOMPILESHADERPROC glCompileShader;
-static PFNGLGETSHADERIVPROC glGetShaderiv;
-static PFNGLGETSHADERINFOLOGPROC glGetShaderInfoLog;
-static PFNGLATTACHSHADERPROC glAttachShader;
-static PFNGLDETACHSHADERPROC glDetachShader;
-static PFNGLDELETESHADERPROC glDeleteShader;
-static PFNGLCREATEPROGRAMPROC glCreateProgram;
-static PFNGLLINKPROGRAMPROC glLinkProgram;
-static PFNGLDELETEPROGRAMPROC glDeleteProgram;
-static PFNGLGETPROGRAMIVPROC glGetProgramiv;
-static PFNGLGETPROGRAMINFOLOGPROC glGetProgramInfoLog;
-static PFNGLUSEPROGRAMPROC glUseProgram;
-static PFNGLGETUNIFORMLOCATIONPROC glGetUniformLocation;
-static PFNGLUNIFORM1FPROC glUniform1f;
-static PFNGLUNIFORM1IPROC glUniform1i;
-static PFNGLUNIFORM2FPROC glUniform2f;
-static PFNGLUNIFORM3FPROC glUniform3f;
-static PFNGLUNIFORM4FPROC glUniform4f;
-
-static Display *display;
-static Window window;
 static int window_width;
 static int window_height;
+// Fixed size the shader renders at with --render-size, scaled to fit the window.
+static int render_width;
+static int render_height;
+// The overlay is laid out in logical pixels, this many to a window pixel.
+static float overlay_scale = 1.0f;
 
 static struct timespec file_mtime;
+static char shader_path[PATH_MAX];
+static bool reload_requested;
+static bool quit_requested;
+
+static struct
+{
+    double time;
+    bool paused;
+    int step_frames;
+} playback;
+
+static struct
+{
+    char path[PATH_MAX];
+    int client;
+    bool pending;
+} capture;
+
+static struct
+{
+    double cpu_ms[STATS_FRAMES];
+    double gpu_ms[STATS_FRAMES];
+    uint64_t num_cpu;
+    uint64_t num_gpu;
+} stats;
+
+static arena_t frame_arena;
+
+static analysis_t analysis;
+static bool analysis_enabled;
+
+static struct
+{
+    GLuint fbo;
+    GLuint texture;
+    int width;
+    int height;
+} scaled;
 
-static char *log_buffer;
-static char *file_buffer;
-static vertex_t *vertex_buffer;
+// Target of the --render-size image, (re)created for the size.
+static GLuint scaled_target(int width, int height)
+{
+    if (scaled.texture && scaled.width == width && scaled.height == height) return scaled.fbo;
+    if (scaled.texture) glDeleteTextures(1, &scaled.texture);
+    if (!scaled.fbo) glGenFramebuffers(1, &scaled.fbo);
+    glGenTextures(1, &scaled.texture);
+    glBindTexture(GL_TEXTURE_2D, scaled.texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, scaled.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scaled.texture, 0);
+    scaled.width = width;
+    scaled.height = height;
+    return scaled.fbo;
+}
+
+// Largest rectangle of the render size's aspect centered in the window.
+static rect_t scaled_rect(void)
+{
+    float sx = (float)window_width / (float)render_width, sy = (float)window_height / (float)render_height;
+    float s = sx < sy ? sx : sy;
+    float w = (float)render_width*s, h = (float)render_height*s;
+    return make_rect(((float)window_width - w)*0.5f, ((float)window_height - h)*0.5f, w, h);
+}
 
 static GLuint vao;
 static GLuint vbo;
@@ -167,203 +235,666 @@ static inline void timespec_sub(struct timespec *r, const struct timespec *a, co
     }
 }
 
-static inline double timespec_to_msec(const struct timespec *a)
+static inline double timespec_to_sec(const struct timespec *a)
 {
-    return (double)a->tv_sec*1000.0 + (double)a->tv_nsec / 1000000000.0;
+    return (double)a->tv_sec + (double)a->tv_nsec / 1000000000.0;
 }
 
-static inline void *get_proc(const char *name)
+static rect_t slider_rect(int row)
 {
-    return (void *)glXGetProcAddress((const GLubyte *)name);
+    return make_rect((float)window_width/overlay_scale - SLIDER_WIDTH - 4.0f, 4.0f + (float)row*SLIDER_ROW, SLIDER_WIDTH, SLIDER_HEIGHT);
 }
 
-static GLXContext create_context(void)
+// Maps a slider row back to its uniform and component.
+static custom_uniform_t *slider_uniform(int row, int *component)
 {
-    static const int visual_attribs[] = {
-        GLX_X_RENDERABLE,   True,
-        GLX_DRAWABLE_TYPE,  GLX_WINDOW_BIT,
-        GLX_RENDER_TYPE,    GLX_RGBA_BIT,
-        GLX_X_VISUAL_TYPE,  GLX_TRUE_COLOR,
-        GLX_RED_SIZE,       8,
-        GLX_GREEN_SIZE,     8,
-        GLX_BLUE_SIZE,      8,
-        GLX_ALPHA_SIZE,     8,
-        GLX_DEPTH_SIZE,     24,
-        GLX_DOUBLEBUFFER,   True,
-        None
-    };
-
-    static const int context_attribs[] = {
-        GLX_CONTEXT_MAJOR_VERSION_ARB,  4,
-        GLX_CONTEXT_MINOR_VERSION_ARB,  5,
-        GLX_CONTEXT_FLAGS_ARB,          GLX_CONTEXT_FORWARD_COMPATIBLE_BIT_ARB,
-        GLX_CONTEXT_PROFILE_MASK_ARB,   GLX_CONTEXT_CORE_PROFILE_BIT_ARB,
-        None
-    };
-    
-    int num_configs;
-    GLXFBConfig *configs = glXChooseFBConfig(display, DefaultScreen(display), visual_attribs, &num_configs);
-    if (!configs || !num_configs) return NULL;
+    for (size_t i = 0; i < array_size(custom_uniforms); i++) {
+        custom_uniform_t *u = &custom_uniforms[i];
+        if (!u->slider) continue;
+        if (row < u->components) {
+            *component = row;
+            return u;
+        }
+        row -= u->components;
+    }
+    return NULL;
+}
 
-    GLXFBConfig config = configs[0];
-    XVisualInfo *vi = glXGetVisualFromFBConfig(display, config);
-    XFree(configs);
+// Pointer positions are in window pixels.
+static int slider_hit(int x, int y)
+{
+    float lx = (float)x/overlay_scale, ly = (float)y/overlay_scale;
+    int component;
+    for (int row = 0; slider_uniform(row, &component); row++) {
+        rect_t r = slider_rect(row);
+        if (lx >= r.x && lx < r.x + r.w && ly >= r.y && ly < r.y + r.h) return row;
+    }
+    return -1;
+}
 
-    GLXContext ctx = glXCreateContext(display, vi, 0, GL_TRUE);
-    XFree(vi);
-    if (!ctx) return NULL;
+static void slider_drag(int row, int x)
+{
+    int component;
+    custom_uniform_t *u = slider_uniform(row, &component);
+    rect_t r = slider_rect(row);
+    if (u) uniform_slide(u, component, ((float)x/overlay_scale - r.x) / r.w);
+}
 
-    PFNGLXCREATECONTEXTATTRIBSARBPROC glXCreateContextAttribsARB = (PFNGLXCREATECONTEXTATTRIBSARBPROC)get_proc("glXCreateContextAttribsARB");
-    glXSwapIntervalEXT = (PFNGLXSWAPINTERVALEXTPROC)get_proc("glXSwapIntervalEXT");
-    glXDestroyContext(display, ctx);
+// Text in the --font atlas when one is loaded, in the built-in font otherwise.
+static font_atlas_t *overlay_font;
 
-    ctx = glXCreateContextAttribsARB(display, config, NULL, GL_TRUE, context_attribs);
-    if (!ctx) return NULL;
+static void overlay_text(const char *str, size_t len, float x, float y)
+{
+    if (overlay_font) font_atlas_push_text(overlay_font, str, len, x, y);
+    else push_text(str, len, x, y);
+}
 
-    return ctx;
+static void push_sliders(void)
+{
+    static const char *suffix[4] = { ".x", ".y", ".z", ".w" };
+    char label[96];
+    int component;
+    for (int row = 0;; row++) {
+        const custom_uniform_t *u = slider_uniform(row, &component);
+        if (!u) break;
+
+        rect_t r = slider_rect(row);
+        float range = u->max - u->min;
+        float t = range != 0.0f ? (u->value[component] - u->min) / range : 0.0f;
+        t = t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t;
+
+        int len = snprintf(label, sizeof label, "%s%s %.3g", u->name,
+                           u->components > 1 ? suffix[component] : "", u->value[component]);
+        push_quad(make_rect(r.x - SLIDER_LABEL, r.y, SLIDER_LABEL + r.w, r.h), make_rect(-1, -1, -1, -1), 0x7F);
+        push_quad(make_rect(r.x, r.y, r.w*t, r.h), make_rect(-1, -1, -1, -1), 0x4A7FB0FF);
+        overlay_text(label, (size_t)len < sizeof label ? (size_t)len : sizeof label - 1, r.x - SLIDER_LABEL + 2.0f, r.y + 13.0f);
+    }
 }
 
-static void get_procs(void)
+static void push_analysis(void)
 {
-    glCreateShader = (PFNGLCREATESHADERPROC)get_proc("glCreateShader");
-    glGenVertexArrays = (PFNGLGENVERTEXARRAYSPROC)get_proc("glGenVertexArrays");
-    glDeleteVertexArrays = (PFNGLDELETEVERTEXARRAYSPROC)get_proc("glDeleteVertexArrays");
-    glBindVertexArray = (PFNGLBINDVERTEXARRAYPROC)get_proc("glBindVertexArray");
-    glEnableVertexAttribArray = (PFNGLENABLEVERTEXATTRIBARRAYPROC)get_proc("glEnableVertexAttribArray");
-    glVertexAttribPointer = (PFNGLVERTEXATTRIBPOINTERPROC)get_proc("glVertexAttribPointer");
-    glVertexAttribIPointer = (PFNGLVERTEXATTRIBIPOINTERPROC)get_proc("glVertexAttribIPointer");
-    glGenBuffers = (PFNGLGENBUFFERSPROC)get_proc("glGenBuffers");
-    glDeleteBuffers = (PFNGLDELETEBUFFERSPROC)get_proc("glDeleteBuffers");
-    glBindBuffer = (PFNGLBINDBUFFERPROC)get_proc("glBindBuffer");
-    glBufferData = (PFNGLBUFFERDATAPROC)get_proc("glBufferData");
-    glTexStorage2D = (PFNGLTEXSTORAGE2DPROC)get_proc("glTexStorage2D");
-    glShaderSource = (PFNGLSHADERSOURCEPROC)get_proc("glShaderSource");
-    glCompileShader = (PFNGLCOMPILESHADERPROC)get_proc("glCompileShader");
-    glGetShaderiv = (PFNGLGETSHADERIVPROC)get_proc("glGetShaderiv");
-    glGetShaderInfoLog = (PFNGLGETSHADERINFOLOGPROC)get_proc("glGetShaderInfoLog");
-    glAttachShader = (PFNGLATTACHSHADERPROC)get_proc("glAttachShader");
-    glDetachShader = (PFNGLDETACHSHADERPROC)get_proc("glDetachShader");
-    glDeleteShader = (PFNGLDELETESHADERPROC)get_proc("glDeleteShader");
-    glCreateProgram = (PFNGLCREATEPROGRAMPROC)get_proc("glCreateProgram");
-    glLinkProgram = (PFNGLLINKPROGRAMPROC)get_proc("glLinkProgram");
-    glDeleteProgram = (PFNGLDELETEPROGRAMPROC)get_proc("glDeleteProgram");
-    glGetProgramiv = (PFNGLGETPROGRAMIVPROC)get_proc("glGetProgramiv");
-    glGetProgramInfoLog = (PFNGLGETPROGRAMINFOLOGPROC)get_proc("glGetProgramInfoLog");
-    glUseProgram = (PFNGLUSEPROGRAMPROC)get_proc("glUseProgram");
-    glGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)get_proc("glGetUniformLocation");
-    glUniform1f = (PFNGLUNIFORM1FPROC)get_proc("glUniform1f");
-    glUniform1i = (PFNGLUNIFORM1IPROC)get_proc("glUniform1i");
-    glUniform2f = (PFNGLUNIFORM2FPROC)get_proc("glUniform2f");
-    glUniform3f = (PFNGLUNIFORM3FPROC)get_proc("glUniform3f");
-    glUniform4f = (PFNGLUNIFORM4FPROC)get_proc("glUniform4f");
+    char buf[96];
+    float y = (float)window_height/overlay_scale - HISTOGRAM_HEIGHT - 4.0f;
+    analysis_push_histogram(&analysis, make_rect(4.0f, y, HISTOGRAM_WIDTH, HISTOGRAM_HEIGHT));
+    int len = analysis_format(&analysis, buf, sizeof buf);
+    push_quad(make_rect(4.0f, y - 20.0f, HISTOGRAM_WIDTH, 18.0f), make_rect(-1, -1, -1, -1), 0x7F);
+    overlay_text(buf, (size_t)len < sizeof buf ? (size_t)len : sizeof buf - 1, 6.0f, y - 6.0f);
 }
 
-static GLuint create_shader(const char **src, int num_src,  GLenum type)
+static void push_gallery(const gallery_t *g)
 {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, num_src, src, NULL);
-    glCompileShader(shader);
-    GLint status;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-    if (status == GL_FALSE) {
+    char label[160];
+    for (size_t i = 0; i < array_size(g->tiles); i++) {
+        const gallery_tile_t *t = &g->tiles[i];
+        rect_t r = gallery_rect(g, (int)i, window_width);
+        r.h += (float)g->label_height;
+        if (!gallery_visible(r, window_width, window_height)) continue;
+
+        float x = r.x/overlay_scale, y = r.y/overlay_scale;
+        if (!t->drawn)
+            push_quad(make_rect(x, y, (float)g->tile_width/overlay_scale, (float)g->tile_height/overlay_scale),
+                      make_rect(-1, -1, -1, -1), 0x7F);
         int len;
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
-        if (len > 0) {
-            array_clear(log_buffer);
-            array_ensure(log_buffer, (size_t)len);
-            glGetShaderInfoLog(shader, len, &len, log_buffer);
-            glDeleteShader(shader);
-            assert(log_buffer);
-            array_header(log_buffer)->size = (size_t)len;
-        }
-        return 0;
+        if (t->error[0])
+            len = snprintf(label, sizeof label, "%s: %s", t->name, t->error);
+        else if (!t->program)
+            len = snprintf(label, sizeof label, "%s: building", t->name);
+        else
+            len = snprintf(label, sizeof label, "%s  %.2f ms%s", t->name, t->cost_ms, t->animated ? "" : "  static");
+        overlay_text(label, (size_t)len < sizeof label ? (size_t)len : sizeof label - 1, x,
+                     (float)(g->tile_height + g->label_height)/overlay_scale + y - 4.0f);
     }
+}
 
-    return shader;
+static void stats_summary(const double *samples, uint64_t total, double *avg, double *min, double *max)
+{
+    int n = total < STATS_FRAMES ? (int)total : STATS_FRAMES;
+    *avg = 0.0;
+    *min = n ? DBL_MAX : 0.0;
+    *max = 0.0;
+    for (int i = 0; i < n; i++) {
+        *avg += samples[i];
+        if (samples[i] < *min) *min = samples[i];
+        if (samples[i] > *max) *max = samples[i];
+    }
+    if (n) *avg /= n;
 }
 
-static GLuint link_program(GLuint vs, GLuint fs)
+/*
+ * Control protocol, one command per line:
+ *   load <path>            Watch and compile a different shader file
+ *   set <name> <v>...      Set a custom uniform from up to four numbers
+ *   uniforms               List the custom uniforms and their values
+ *   pause / resume         Stop or restart the playback clock
+ *   step [n]               Advance a paused clock by n frames of 1/60 s
+ *   time <seconds>         Seek the playback clock
+ *   capture <path>         Write the next rendered frame as a PPM, PNG or QOI
+ *   stats                  Frame time statistics over the last frames
+ *   analysis [on|off]      Luminance statistics of the last analyzed frame, or toggle them
+ *   quit                   Exit after the current frame
+ */
+static void handle_command(control_t *ctl, int client, char *line, GLuint program)
 {
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
-    glLinkProgram(program);
-    glDetachShader(program, vs);
-    glDetachShader(program, fs);
-    GLint status;
-    glGetProgramiv(program, GL_LINK_STATUS, &status);
-    if (status == GL_FALSE) {
-        int len;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
-        if(len > 0) {
-            array_clear(log_buffer);
-            array_ensure(log_buffer, (size_t)len);
-            glGetProgramInfoLog(program, len, &len, log_buffer);
-            glDeleteProgram(program);
-            assert(log_buffer);
-            array_header(log_buffer)->size = (size_t)len;
+    char *save;
+    char *cmd = strtok_r(line, " \t", &save);
+    char *arg = strtok_r(NULL, " \t", &save);
+    if (!cmd) return;
+
+    if (strcmp(cmd, "load") == 0) {
+        struct stat st;
+        if (!arg || strlen(arg) >= sizeof shader_path) {
+            control_reply(ctl, client, "error usage: load <path>");
+        } else if (stat(arg, &st)) {
+            control_reply(ctl, client, "error %s: %s", arg, strerror(errno));
+        } else {
+            strcpy(shader_path, arg);
+            reload_requested = true;
+            control_reply(ctl, client, "ok");
+        }
+    } else if (strcmp(cmd, "set") == 0) {
+        float value[4];
+        int count = 0;
+        for (char *v = strtok_r(NULL, " \t", &save); v && count < 4; v = strtok_r(NULL, " \t", &save))
+            value[count++] = strtof(v, NULL);
+        if (!arg || count == 0 || !uniform_set(program, arg, value, count))
+            control_reply(ctl, client, "error usage: set <name> <value>...");
+        else
+            control_reply(ctl, client, "ok");
+    } else if (strcmp(cmd, "uniforms") == 0) {
+        char buf[CONTROL_LINE_SIZE - 8];
+        size_t n = 0;
+        for (size_t i = 0; i < array_size(custom_uniforms) && n < sizeof buf; i++) {
+            const custom_uniform_t *u = &custom_uniforms[i];
+            int w = snprintf(buf + n, sizeof buf - n, " %s=%g,%g,%g,%g", u->name,
+                             u->value[0], u->value[1], u->value[2], u->value[3]);
+            if (w < 0) break;
+            n += (size_t)w;
+        }
+        buf[n < sizeof buf ? n : sizeof buf - 1] = 0;
+        control_reply(ctl, client, "ok%s", buf);
+    } else if (strcmp(cmd, "pause") == 0) {
+        playback.paused = true;
+        control_reply(ctl, client, "ok");
+    } else if (strcmp(cmd, "resume") == 0) {
+        playback.paused = false;
+        playback.step_frames = 0;
+        control_reply(ctl, client, "ok");
+    } else if (strcmp(cmd, "step") == 0) {
+        playback.paused = true;
+        playback.step_frames += arg ? atoi(arg) : 1;
+        control_reply(ctl, client, "ok");
+    } else if (strcmp(cmd, "time") == 0) {
+        if (!arg) {
+            control_reply(ctl, client, "ok %f", playback.time);
+        } else {
+            playback.time = strtod(arg, NULL);
+            control_reply(ctl, client, "ok");
+        }
+    } else if (strcmp(cmd, "capture") == 0) {
+        if (!arg || strlen(arg) >= sizeof capture.path) {
+            control_reply(ctl, client, "error usage: capture <path>");
+        } else if (capture.pending) {
+            control_reply(ctl, client, "error capture already pending");
+        } else {
+            strcpy(capture.path, arg);
+            capture.client = client;
+            capture.pending = true;
+        }
+    } else if (strcmp(cmd, "quit") == 0) {
+        quit_requested = true;
+        control_reply(ctl, client, "ok");
+    } else if (strcmp(cmd, "analysis") == 0) {
+        if (arg && (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0)) {
+            analysis_enabled = strcmp(arg, "on") == 0;
+            analysis.valid = false;
+            control_reply(ctl, client, "ok");
+        } else if (!analysis_enabled || !analysis.valid) {
+            control_reply(ctl, client, "error no analysis results");
+        } else {
+            char buf[CONTROL_LINE_SIZE - 8];
+            analysis_format(&analysis, buf, sizeof buf);
+            control_reply(ctl, client, "ok %s", buf);
         }
-        return 0;
+    } else if (strcmp(cmd, "stats") == 0) {
+        double cpu_avg, cpu_min, cpu_max, gpu_avg, gpu_min, gpu_max;
+        stats_summary(stats.cpu_ms, stats.num_cpu, &cpu_avg, &cpu_min, &cpu_max);
+        stats_summary(stats.gpu_ms, stats.num_gpu, &gpu_avg, &gpu_min, &gpu_max);
+        control_reply(ctl, client, "ok frames=%llu time=%.3f fps=%.2f "
+                      "cpu_ms=%.3f/%.3f/%.3f gpu_ms=%.3f/%.3f/%.3f",
+                      (unsigned long long)stats.num_cpu, playback.time, cpu_avg > 0.0 ? 1000.0/cpu_avg : 0.0,
+                      cpu_avg, cpu_min, cpu_max, gpu_avg, gpu_min, gpu_max);
+    } else {
+        control_reply(ctl, client, "error unknown command '%s'", cmd);
     }
-
-    return program;
 }
 
-static inline void push_quad(rect_t r, rect_t uv, uint32_t color)
+typedef struct
+{
+    platform_t platform;
+    int width;
+    int height;
+    double fps;
+    const char *output;
+    GLuint vs;
+    GLuint program;
+    GLuint vao;
+    image_writer_t writer;
+} batch_state_t;
+
+// Runs in each worker process, file_buffer was copied before the fork.
+static bool batch_init(void *user)
 {
-    array_push_back(vertex_buffer, make_vertex(make_vec2(r.x, r.y), make_vec2(uv.x, uv.y), color));
-    array_push_back(vertex_buffer, make_vertex(make_vec2(r.x+r.w, r.y), make_vec2(uv.x+uv.w, uv.y), color));
-    array_push_back(vertex_buffer, make_vertex(make_vec2(r.x+r.w, r.y+r.h), make_vec2(uv.x+uv.w, uv.y+uv.h), color));
+    batch_state_t *b = user;
+    b->platform = platform_egl;
+    if (!b->platform.init(&b->platform, b->width, b->height, false)) return false;
+    get_procs();
+
+    b->vs = create_shader(&vs_src, 1, GL_VERTEX_SHADER);
+    const char *src[3] = { fs_header_src, file_buffer, fs_footer_src };
+    b->program = b->vs ? load_program(b->vs, src, 3) : 0;
+    if (!b->program) {
+        fprintf(stderr, "%.*s\n", (int)array_size(log_buffer), log_buffer ? log_buffer : "");
+        if (b->vs) glDeleteShader(b->vs);
+        b->platform.destroy(&b->platform);
+        return false;
+    }
+    uniforms_bind(b->program);
 
-    array_push_back(vertex_buffer, make_vertex(make_vec2(r.x+r.w, r.y+r.h), make_vec2(uv.x+uv.w, uv.y+uv.h), color));
-    array_push_back(vertex_buffer, make_vertex(make_vec2(r.x, r.y+r.h), make_vec2(uv.x, uv.y+uv.h), color));
-    array_push_back(vertex_buffer, make_vertex(make_vec2(r.x, r.y), make_vec2(uv.x, uv.y), color));
+    glGenVertexArrays(1, &b->vao);
+    glBindVertexArray(b->vao);
+    // Encoding overlaps rendering of the next frames, the workers already keep every core busy.
+    return !b->output || image_writer_init(&b->writer, BATCH_WRITER_THREADS, BATCH_WRITER_FRAMES);
 }
 
-static void push_text(const char *str, size_t len, float x, float y)
+static void batch_draw(batch_state_t *b, int frame)
 {
-    uint32_t color = 0xFFFFFFFF;
-    float orig_x = x;
-    for (size_t i = 0; i < len; i++) {
-        if (str[i] == '\n') {
-            y += 20.0f;
-            x = orig_x;
-            continue;
-        }
+    glBindFramebuffer(GL_FRAMEBUFFER, b->platform.begin_frame(&b->platform));
+    glViewport(0, 0, b->width, b->height);
+    glUseProgram(b->program);
+    set_user_uniforms(b->width, b->height, (double)frame / b->fps, 1.0 / b->fps, frame, -1, -1);
+    uniforms_apply();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
 
-        const glyph_t *glyph = get_glyph(str[i]);
-        rect_t r = make_rect(x+(float)glyph->offset_x, y-(float)glyph->offset_y, (float)glyph->width, (float)glyph->height);
-        push_quad(r, glyph->uv, color);
-        x += glyph->advance_x;
-    }
+static bool batch_render(void *user, int frame)
+{
+    batch_state_t *b = user;
+    batch_draw(b, frame);
+
+    int slot;
+    uint8_t *pixels = image_writer_acquire(&b->writer, b->width, b->height, &slot);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, b->width, b->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof path, b->output, frame);
+    image_writer_submit(&b->writer, slot, path, frame);
+    return true;
 }
 
-static bool update_file_buffer(const char *path, size_t size)
+// The frame is done once written, the writer reports the path on failure.
+static bool batch_collect(void *user, bool wait, int *frame, bool *ok)
 {
-    array_ensure(file_buffer, size+1);
+    batch_state_t *b = user;
+    return image_writer_result(&b->writer, wait, frame, ok);
+}
 
-    FILE *fp = fopen(path, "r");
-    if (!fp) return false;
+static bool batch_shutdown(void *user)
+{
+    batch_state_t *b = user;
+    bool ok = !b->output || image_writer_flush(&b->writer) == 0;
+    image_writer_destroy(&b->writer);
+    glDeleteVertexArrays(1, &b->vao);
+    glDeleteProgram(b->program);
+    glDeleteShader(b->vs);
+    b->platform.destroy(&b->platform);
+    return ok;
+}
 
-    size_t n = fread(file_buffer, 1, size, fp);
-    file_buffer[n] = 0;
-    fclose(fp);
+// Compare mode renders each frame at the size of its reference image.
+static bool compare_render(void *user, int frame, int width, int height, uint8_t *pixels)
+{
+    batch_state_t *b = user;
+    b->width = b->platform.width = width;
+    b->height = b->platform.height = height;
+    batch_draw(b, frame);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    return glGetError() == GL_NO_ERROR;
+}
 
-    return true;
+// The output pattern is used as a format string, it may only take the frame number.
+static bool valid_frame_pattern(const char *pattern)
+{
+    int conversions = 0;
+    for (const char *p = pattern; *p; p++) {
+        if (*p != '%') continue;
+        if (*++p == '%') continue;
+        while (*p == '0' || *p == '-' || *p == ' ' || *p == '+') p++;
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p != 'd') return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] path\n"
+            "  --sweep           Benchmark every @sweep variant of the shader and exit\n"
+            "  --control <path>  Listen for control commands on a Unix socket\n"
+            "  --export <name>   Publish frames to a shared memory ring, e.g. /tadershoy\n"
+            "  --record <fmt>    Write every frame, path with the frame number as %%d\n"
+            "  --headless        Render offscreen through EGL, without an X server\n"
+            "  --size <w>x<h>    Window or offscreen target size (default %dx%d)\n"
+            "  --frames <n>      Exit after rendering n frames\n"
+            "  --fps <rate>      Fixed frame rate of headless and batch playback (default %g)\n"
+            "  --batch <a>:<b>   Render frames a to b offline on worker processes and exit\n"
+            "  --workers <n>     Batch worker processes or record encoder threads (default: one per core)\n"
+            "  --output <fmt>    Batch output path with the frame number as %%d (default %s),\n"
+            "                    or the diff images of failed comparisons (default %s)\n"
+            "  --compare <fmt>   Compare the --batch range (default 0:0) against reference images and exit\n"
+            "  --threshold <dB>  Minimum PSNR for a comparison to pass (default %g)\n"
+            "  --font <path>     Draw the overlay with a TrueType, OpenType or bitmap font file\n"
+            "  --font-size <px>  Pixel size of the --font (default %d)\n"
+            "  --overlay-scale <s>  Scale of the overlay (default: from the display's DPI)\n"
+            "  --text-style <s>  Overlay text drawn plain, with an outline or with a shadow (default plain)\n"
+            "  --analyze         Show a luminance histogram and NaN/Inf counts of every frame\n"
+            "  --audio <path>    Stream a WAV file's spectrum and waveform to iChannel0\n"
+            "  --volume <path>   Stream a raw volume file to iChannel1, a sampler3D\n"
+            "  --volume-budget <MB>  Halve the volume until its texture fits in this much memory\n"
+            "  --frame-delay <ms>  Start frames this long after a vblank, or auto (default auto)\n"
+            "  --quality <n>     Build the shader at QUALITY 0 to n-1 and drop levels over the frame budget\n"
+            "  --frame-budget <ms>  GPU time per frame for --quality (default %g)\n"
+            "  --fullscreen      Cover the screen and ask the compositor to unredirect the window\n"
+            "  --render-size <w>x<h>  Render the shader at this size, scaled to fit the window\n"
+            "  --compute         Run mainImage in a compute shader instead of a fragment shader\n"
+            "  --workgroup <w>x<h>  Compute workgroup size in pixels (default %dx%d)\n"
+            "  --tile-order <o>  Order compute workgroups shade tiles in: linear, morton or hilbert\n"
+            "                    (default linear)\n"
+            "  --tile-sweep      Benchmark every workgroup size and tile order on the compute path and exit\n"
+            "  --gallery         Show every .glsl and .frag file in the directory at path as a tile of\n"
+            "                    --render-size (default %dx%d), sharing --frame-budget between them\n"
+            "  --debug-print <x>,<y>|mouse  Show the debugPrint() values of the shader at this window pixel\n"
+            "Frames are written as PNG or QOI for paths ending in .png or .qoi, PPM otherwise.\n",
+            name, DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_FPS, DEFAULT_BATCH_OUTPUT, DEFAULT_DIFF_OUTPUT,
+            DEFAULT_THRESHOLD, FONT_DEFAULT_SIZE, DEFAULT_FRAME_BUDGET, COMPUTE_DEFAULT_GROUP, COMPUTE_DEFAULT_GROUP,
+            GALLERY_TILE_WIDTH, GALLERY_TILE_HEIGHT);
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2) {
+    static const struct option long_options[] = {
+        { "sweep",   no_argument,       NULL, 's' },
+        { "control", required_argument, NULL, 'c' },
+        { "export",  required_argument, NULL, 'e' },
+        { "record",  required_argument, NULL, 'r' },
+        { "headless", no_argument,      NULL, 'H' },
+        { "size",    required_argument, NULL, 'S' },
+        { "frames",  required_argument, NULL, 'n' },
+        { "fps",     required_argument, NULL, 'f' },
+        { "batch",   required_argument, NULL, 'b' },
+        { "workers", required_argument, NULL, 'w' },
+        { "output",  required_argument, NULL, 'o' },
+        { "compare", required_argument, NULL, 'C' },
+        { "threshold", required_argument, NULL, 't' },
+        { "font",    required_argument, NULL, 'F' },
+        { "font-size", required_argument, NULL, 'z' },
+        { "overlay-scale", required_argument, NULL, 'L' },
+        { "text-style", required_argument, NULL, 'T' },
+        { "analyze", no_argument,       NULL, 'A' },
+        { "audio",   required_argument, NULL, 'a' },
+        { "volume",  required_argument, NULL, 'V' },
+        { "volume-budget", required_argument, NULL, 'M' },
+        { "frame-delay", required_argument, NULL, 'D' },
+        { "quality", required_argument, NULL, 'Q' },
+        { "frame-budget", required_argument, NULL, 'B' },
+        { "fullscreen", no_argument,    NULL, 'U' },
+        { "render-size", required_argument, NULL, 'R' },
+        { "compute", no_argument,       NULL, 'P' },
+        { "workgroup", required_argument, NULL, 'W' },
+        { "tile-order", required_argument, NULL, 'O' },
+        { "tile-sweep", no_argument,    NULL, 'X' },
+        { "debug-print", required_argument, NULL, 'G' },
+        { "gallery", no_argument,       NULL, 'Y' },
+        { "help",    no_argument,       NULL, 'h' },
+        { 0 }
+    };
+
+    bool sweep = false;
+    const char *control_path = NULL;
+    const char *export_name = NULL;
+    const char *record = NULL;
+    bool headless = false;
+    int width = DEFAULT_WIDTH;
+    int height = DEFAULT_HEIGHT;
+    long max_frames = -1;
+    double fps = DEFAULT_FPS;
+    bool batch = false;
+    int batch_first = 0, batch_last = 0;
+    int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *output = NULL;
+    const char *compare = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    const char *font_path = NULL;
+    int font_size = FONT_DEFAULT_SIZE;
+    float scale = 0.0f;
+    float text_style[3] = {0};
+    const char *audio_path = NULL;
+    const char *volume_path = NULL;
+    size_t volume_budget = 0;
+    double frame_delay = -1.0;
+    int quality_levels = 0;
+    double frame_budget = DEFAULT_FRAME_BUDGET;
+    bool fullscreen = false;
+    bool compute = false;
+    int group_width = COMPUTE_DEFAULT_GROUP, group_height = COMPUTE_DEFAULT_GROUP;
+    tile_order_t tile_order = TILE_ORDER_LINEAR;
+    bool tile_sweep = false;
+    bool debug_enabled = false;
+    int debug_x = -1, debug_y = -1;     // Window pixel, -1 follows the pointer
+    bool gallery_mode = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's': sweep = true; break;
+            case 'c': control_path = optarg; break;
+            case 'e': export_name = optarg; break;
+            case 'r':
+                if (!valid_frame_pattern(optarg)) {
+                    fprintf(stderr, "Record pattern needs exactly one %%d conversion.\n");
+                    return EXIT_FAILURE;
+                }
+                record = optarg;
+                break;
+            case 'H': headless = true; break;
+            case 'S':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                    fprintf(stderr, "Invalid size '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n': max_frames = strtol(optarg, NULL, 10); break;
+            case 'f':
+                fps = strtod(optarg, NULL);
+                if (fps <= 0.0) {
+                    fprintf(stderr, "Invalid frame rate '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                if (sscanf(optarg, "%d:%d", &batch_first, &batch_last) != 2 || batch_first < 0 || batch_last < batch_first) {
+                    fprintf(stderr, "Invalid frame range '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                batch = true;
+                break;
+            case 'w': {
+                char *end;
+                long n = strtol(optarg, &end, 10);
+                if (end == optarg || *end || n < 1 || n > BATCH_MAX_WORKERS) {
+                    fprintf(stderr, "Workers must be between 1 and %d.\n", BATCH_MAX_WORKERS);
+                    return EXIT_FAILURE;
+                }
+                workers = (int)n;
+            } break;
+            case 'o':
+                if (!valid_frame_pattern(optarg)) {
+                    fprintf(stderr, "Output pattern needs exactly one %%d conversion.\n");
+                    return EXIT_FAILURE;
+                }
+                output = optarg;
+                break;
+            case 'C':
+                if (!valid_frame_pattern(optarg)) {
+                    fprintf(stderr, "Reference pattern needs exactly one %%d conversion.\n");
+                    return EXIT_FAILURE;
+                }
+                compare = optarg;
+                break;
+            case 't': {
+                char *end;
+                threshold = strtod(optarg, &end);
+                if (end == optarg || *end || !isfinite(threshold)) {
+                    fprintf(stderr, "Invalid threshold '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+            } break;
+            case 'F': font_path = optarg; break;
+            case 'A': analysis_enabled = true; break;
+            case 'z':
+                font_size = atoi(optarg);
+                if (font_size < FONT_MIN_SIZE || font_size > FONT_MAX_SIZE) {
+                    fprintf(stderr, "Font size must be between %d and %d.\n", FONT_MIN_SIZE, FONT_MAX_SIZE);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'L':
+                scale = strtof(optarg, NULL);
+                if (!(scale > 0.0f && scale <= OVERLAY_MAX_SCALE)) {
+                    fprintf(stderr, "Invalid overlay scale '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'T':
+                if (!strcmp(optarg, "outline")) {
+                    text_style[0] = TEXT_OUTLINE;
+                } else if (!strcmp(optarg, "shadow")) {
+                    text_style[1] = text_style[2] = TEXT_SHADOW;
+                } else if (strcmp(optarg, "plain")) {
+                    fprintf(stderr, "Unknown text style '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'a': audio_path = optarg; break;
+            case 'V': volume_path = optarg; break;
+            case 'M': {
+                char *end;
+                double mb = strtod(optarg, &end);
+                if (*end || !(mb > 0.0)) {
+                    fprintf(stderr, "Invalid volume budget '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                volume_budget = (size_t)(mb*1024.0*1024.0);
+            } break;
+            case 'D':
+                if (strcmp(optarg, "auto")) {
+                    char *end;
+                    frame_delay = strtod(optarg, &end);
+                    if (*end || !(frame_delay >= 0.0)) {
+                        fprintf(stderr, "Invalid frame delay '%s'.\n", optarg);
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            case 'Q':
+                quality_levels = atoi(optarg);
+                if (quality_levels < 1 || quality_levels > QUALITY_MAX_LEVELS) {
+                    fprintf(stderr, "Quality levels must be between 1 and %d.\n", QUALITY_MAX_LEVELS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'B':
+                frame_budget = strtod(optarg, NULL);
+                if (!(frame_budget > 0.0)) {
+                    fprintf(stderr, "Invalid frame budget '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'U': fullscreen = true; break;
+            case 'R':
+                if (sscanf(optarg, "%dx%d", &render_width, &render_height) != 2 || render_width <= 0 || render_height <= 0) {
+                    fprintf(stderr, "Invalid render size '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'P': compute = true; break;
+            case 'W':
+                if (sscanf(optarg, "%dx%d", &group_width, &group_height) != 2 || group_width <= 0 ||
+                    group_height <= 0 || group_width*group_height > COMPUTE_MAX_INVOCATIONS) {
+                    fprintf(stderr, "Invalid workgroup size '%s', at most %d invocations.\n",
+                            optarg, COMPUTE_MAX_INVOCATIONS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'O': {
+                int o = 0;
+                while (o < NUM_TILE_ORDERS && strcmp(optarg, tile_order_names[o])) o++;
+                if (o == NUM_TILE_ORDERS) {
+                    fprintf(stderr, "Unknown tile order '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                tile_order = (tile_order_t)o;
+            } break;
+            case 'X': tile_sweep = true; break;
+            case 'G':
+                if (strcmp(optarg, "mouse") &&
+                    (sscanf(optarg, "%d,%d", &debug_x, &debug_y) != 2 || debug_x < 0 || debug_y < 0)) {
+                    fprintf(stderr, "Invalid debug pixel '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                debug_enabled = true;
+                break;
+            case 'Y': gallery_mode = true; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (debug_enabled && compute) {
+        fprintf(stderr, "--debug-print needs the fragment path, not --compute.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (gallery_mode && (batch || compare || sweep || tile_sweep || compute || quality_levels || debug_enabled)) {
+        fprintf(stderr, "--gallery only combines with display, recording and overlay options.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (optind != argc-1) {
         fprintf(stderr, "Please specify a path.\n");
+        usage(argv[0]);
         return EXIT_SUCCESS;
     }
 
-    const char *path = argv[1];
+    if (strlen(argv[optind]) >= sizeof shader_path) {
+        fprintf(stderr, "Path too long.\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(shader_path, argv[optind]);
+    const char *path = shader_path;
 
     // Check if the given file exists, create one if it does not.
     struct stat st;
-    if (stat(path, &st)) {
+    if (gallery_mode) {
+        if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "%s: not a directory.\n", path);
+            return EXIT_FAILURE;
+        }
+    } else if (stat(path, &st)) {
         FILE *fp = fopen(path, "w");
         if (fp) {
             fwrite(file_template, strlen(file_template), 1, fp);
@@ -373,72 +904,109 @@ int main(int argc, char *argv[])
         }
     }
 
-    display = XOpenDisplay(NULL);
-    Atom wm_delete_window = XInternAtom(display, "WM_DELETE_WINDOW", False);
-
-    XSetWindowAttributes attr = {0};
-    attr.event_mask = ExposureMask|StructureNotifyMask|PointerMotionMask;
-    window = XCreateWindow(display, DefaultRootWindow(display), 0, 0, DEFAULT_WIDTH, DEFAULT_HEIGHT,
-                           0, CopyFromParent, InputOutput, CopyFromParent, CWEventMask, &attr);
-    XSetWMProtocols(display, window, &wm_delete_window, 1);
-    XMapWindow(display, window);
-
-    window_width = DEFAULT_WIDTH;
-    window_height = DEFAULT_HEIGHT;
-    
-    GLXContext ctx = create_context();
-    if (!ctx) {
-        XDestroyWindow(display, window);
-        return EXIT_FAILURE;
+    // Rendering stays on this thread, the comparisons run on a thread pool.
+    if (compare) {
+        // Workers compile it long after this, the file may be saved again by then.
+        if (!update_file_buffer(path) || !detach_file_buffer()) {
+            perror(path);
+            return EXIT_FAILURE;
+        }
+        uniforms_parse(file_buffer);
+
+        batch_state_t state = { .width = width, .height = height, .fps = fps };
+        bool ok = batch_init(&state);
+        if (ok) {
+            compare_renderer_t renderer = { compare_render, &state };
+            ok = run_compare(batch_first, batch_last, workers, compare, output ? output : DEFAULT_DIFF_OUTPUT,
+                             threshold, &renderer);
+            batch_shutdown(&state);
+        }
+        array_free(custom_uniforms);
+        free_file_buffer();
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Workers are forked before any GL state exists and each create their own context.
+    if (batch) {
+        // Workers compile it long after this, the file may be saved again by then.
+        if (!update_file_buffer(path) || !detach_file_buffer()) {
+            perror(path);
+            return EXIT_FAILURE;
+        }
+        uniforms_parse(file_buffer);
+
+        batch_state_t state = { .width = width, .height = height, .fps = fps,
+                                .output = output ? output : DEFAULT_BATCH_OUTPUT };
+        batch_worker_t worker = { batch_init, batch_render, batch_collect, batch_shutdown, &state };
+        bool ok = run_batch(batch_first, batch_last, workers, &worker);
+        array_free(custom_uniforms);
+        free_file_buffer();
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    glXMakeCurrent(display, window, ctx);
-    glXSwapIntervalEXT(display, window, 1);
+
+    platform_t platform = headless ? platform_egl : platform_x11;
+    platform.fullscreen = fullscreen;
+    if (!platform.init(&platform, width, height, !sweep && !tile_sweep))
+        return EXIT_FAILURE;
     get_procs();
 
+    window_width = platform.width;
+    window_height = platform.height;
+    overlay_scale = scale > 0.0f ? scale : platform.scale;
+
     GLuint vs = create_shader(&quad_vs_src, 1, GL_VERTEX_SHADER);
     if (!vs) {
-        glXDestroyContext(display, ctx);
-        XDestroyWindow(display, window);
-        XCloseDisplay(display);
+        platform.destroy(&platform);
         return EXIT_FAILURE;
     }
     GLuint fs = create_shader(&quad_fs_src, 1, GL_FRAGMENT_SHADER);
     if (!fs) {
         glDeleteShader(vs);
-        glXDestroyContext(display, ctx);
-        XDestroyWindow(display, window);
-        XCloseDisplay(display);
+        platform.destroy(&platform);
         return EXIT_FAILURE;
     }
     GLuint quad_program = link_program(vs, fs);
     glDeleteShader(vs);
     glDeleteShader(fs);
     if (!quad_program) {
-        glXDestroyContext(display, ctx);
-        XDestroyWindow(display, window);
-        XCloseDisplay(display);
+        platform.destroy(&platform);
         return EXIT_FAILURE;
     }
 
     GLuint program = 0;
+    quality_t quality;
+    quality_init(&quality, quality_levels, frame_budget);
     vs = create_shader(&vs_src, 1, GL_VERTEX_SHADER);
     if (!vs) {
-        glXDestroyContext(display, ctx);
-        XDestroyWindow(display, window);
-        XCloseDisplay(display);
+        platform.destroy(&platform);
         return EXIT_FAILURE;
     }
 
+    // The built-in font is drawn from its distance field, made before any text is laid out.
+    uint8_t *font_pixels = xmalloc((size_t)SDF_FONT_WIDTH*SDF_FONT_HEIGHT);
+    font_sdf_init(font_pixels);
     GLuint texture;
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, FONT_TEXTURE_WIDTH, FONT_TEXTURE_HEIGHT);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, SDF_FONT_WIDTH, SDF_FONT_HEIGHT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, FONT_TEXTURE_WIDTH, FONT_TEXTURE_HEIGHT, GL_RED,
-                    GL_UNSIGNED_BYTE, font_data + NUM_GLYPHS*sizeof(glyph_t));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SDF_FONT_WIDTH, SDF_FONT_HEIGHT, GL_RED, GL_UNSIGNED_BYTE, font_pixels);
+    free(font_pixels);
+
+    // Overlay text is drawn from the atlas texture in place of the built-in one.
+    font_atlas_t font = {0};
+    if (font_path) {
+        if (!font_atlas_init(&font, font_path, font_size)) {
+            glDeleteProgram(quad_program);
+            platform.destroy(&platform);
+            return EXIT_FAILURE;
+        }
+        overlay_font = &font;
+    }
 
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
@@ -447,63 +1015,204 @@ int main(int argc, char *argv[])
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (void *)offsetof(vertex_t, pos));
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (void *)offsetof(vertex_t, uv));
-    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(vertex_t), (void *)offsetof(vertex_t, color));
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(overlay_quad_t), (void *)offsetof(overlay_quad_t, left));
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(overlay_quad_t), (void *)offsetof(overlay_quad_t, u0));
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(overlay_quad_t), (void *)offsetof(overlay_quad_t, color));
+    for (GLuint i = 0; i < 3; i++)
+        glVertexAttribDivisor(i, 1);
+
+    TRACE_INIT();
 
     struct timespec t0;
     clock_gettime(CLOCK_MONOTONIC, &t0);
 
-    // TODO: Possibly use XQueryPointer() instead of this to initialize the state.
+    // -1 until the pointer is over the window, it is queried again before every draw.
     int mouse_x = -1;
     int mouse_y = -1;
+    platform.query_pointer(&platform, &mouse_x, &mouse_y);
+    int drag_slider = -1;
+
+    control_t ctl = { .fd = -1 };
+    if (control_path && !control_open(&ctl, control_path)) {
+        glDeleteProgram(quad_program);
+        platform.destroy(&platform);
+        return EXIT_FAILURE;
+    }
+
+    export_t ex = {0};
+    if (export_name && !export_open(&ex, export_name)) {
+        control_close(&ctl);
+        glDeleteProgram(quad_program);
+        platform.destroy(&platform);
+        return EXIT_FAILURE;
+    }
+
+    // One buffer more than there are encoders keeps them all busy while the next frame is read.
+    image_writer_t writer = {0};
+    if (record && !image_writer_init(&writer, workers, workers + 1)) {
+        export_close(&ex);
+        control_close(&ctl);
+        glDeleteProgram(quad_program);
+        platform.destroy(&platform);
+        return EXIT_FAILURE;
+    }
+
+    GLuint gpu_timers[GPU_TIMER_FRAMES];
+    bool gpu_timer_pending[GPU_TIMER_FRAMES] = {0};
+    int gpu_timer_level[GPU_TIMER_FRAMES];
+    glGenQueries(GPU_TIMER_FRAMES, gpu_timers);
 
     char fps_buffer[16];
-    double t_total = 0.0;
     int frame = 0;
     int last_read = FILE_UPDATE_RATE;
+    // Hash of the source the program was last built from
+    bool built = false;
+    uint64_t built_hash = 0;
     int running = 1;
+    int status = EXIT_SUCCESS;
+
+    // The sweep renders offscreen with the same vertex shader and VAO, then exits.
+    if (sweep) {
+        if (!update_file_buffer(path) ||
+            !run_sweep(vs, fs_header_src, file_buffer, fs_footer_src, render_width ? render_width : window_width,
+                       render_width ? render_height : window_height))
+            status = EXIT_FAILURE;
+        running = 0;
+    } else if (tile_sweep) {
+        if (!update_file_buffer(path) ||
+            !run_tile_sweep(vs, file_buffer, render_width ? render_width : window_width,
+                            render_width ? render_height : window_height))
+            status = EXIT_FAILURE;
+        running = 0;
+    }
+
+    audio_t audio = { .fd = -1 };
+    if (running && audio_path && !audio_open(&audio, audio_path)) {
+        status = EXIT_FAILURE;
+        running = 0;
+    }
+    volume_t volume = {0};
+    if (running && volume_path && !volume_open(&volume, volume_path, volume_budget)) {
+        status = EXIT_FAILURE;
+        running = 0;
+    }
+
+    frame_pacer_t pacer;
+    pacing_init(&pacer, &platform, frame_delay);
+    platform_flip_t flip = PLATFORM_FLIP_COMPOSITED;
+
+    compute_path_t cpath = {0};
+    if (compute) compute_init(&cpath, group_width, group_height, tile_order);
+
+    // Without --debug-print the header's debugPrint() expands to nothing.
+    debug_print_t debug = {0};
+    char *debug_header = NULL;
+    if (debug_enabled) {
+        debug_print_init(&debug);
+        debug_header = debug_print_header(fs_header_src);
+    }
+    const char *header_src = debug_header ? debug_header : fs_header_src;
+
+    // Tiles take the --render-size, the window itself is never scaled.
+    gallery_t gallery = { .inotify_fd = -1 };
+    if (running && gallery_mode) {
+        if (gallery_open(&gallery, path, render_width ? render_width : GALLERY_TILE_WIDTH,
+                         render_width ? render_height : GALLERY_TILE_HEIGHT, frame_budget)) {
+            gallery.label_height = (int)(18.0f*overlay_scale);
+        } else {
+            status = EXIT_FAILURE;
+            running = 0;
+        }
+    }
+
     while (running) {
-        while (XPending(display)) {
-            XEvent event;
-            XNextEvent(display, &event);
+        TRACE_BEGIN("frame");
+        TRACE_BEGIN("pacing");
+        pacing_wait(&pacer, &platform);
+        TRACE_END();
+
+        TRACE_BEGIN("events");
+        platform_event_t event;
+        while (platform.next_event(&platform, &event)) {
             switch (event.type) {
-                case MotionNotify: {
-                    mouse_x = event.xmotion.x;
-                    mouse_y = event.xmotion.y;
+                case PLATFORM_EVENT_MOTION: {
+                    mouse_x = event.x;
+                    mouse_y = event.y;
+                    if (drag_slider >= 0) slider_drag(drag_slider, mouse_x);
+                } break;
+
+                case PLATFORM_EVENT_BUTTON_PRESS: {
+                    if (event.button != PLATFORM_BUTTON_LEFT) {
+                        if (gallery_mode)
+                            gallery_scroll(&gallery, event.button == PLATFORM_BUTTON_WHEEL_UP ? -GALLERY_SCROLL_STEP
+                                                                                             : GALLERY_SCROLL_STEP,
+                                           window_width, window_height);
+                        break;
+                    }
+                    drag_slider = slider_hit(event.x, event.y);
+                    if (drag_slider >= 0) slider_drag(drag_slider, event.x);
+                } break;
+
+                case PLATFORM_EVENT_BUTTON_RELEASE: {
+                    drag_slider = -1;
+                } break;
+
+                case PLATFORM_EVENT_QUIT: {
+                    running = 0;
                 } break;
 
-                case ClientMessage: {
-                    if ((Atom)event.xclient.data.l[0] == wm_delete_window)
-                        running = 0;
+                case PLATFORM_EVENT_RESIZE: {
+                    window_width = event.x;
+                    window_height = event.y;
                 } break;
 
-                case ConfigureNotify: {
-                    window_width = event.xconfigure.width;
-                    window_height = event.xconfigure.height;
+                case PLATFORM_EVENT_KEY_PRESS: {
+                    if (event.key == PLATFORM_KEY_F12)
+                        TRACE_DUMP();
                 } break;
             }
         }
-
-        if (last_read >= FILE_UPDATE_RATE) {
+        TRACE_END();
+
+        quality_poll(&quality);
+
+        TRACE_BEGIN("control");
+        char line[CONTROL_LINE_SIZE];
+        int client;
+        for (int i = 0; i < CONTROL_MAX_COMMANDS && control_next(&ctl, line, &client); i++)
+            handle_command(&ctl, client, line, program);
+        TRACE_END();
+
+        // The gallery watches its directory instead.
+        if (!gallery_mode && (last_read >= FILE_UPDATE_RATE || reload_requested)) {
+            TRACE_BEGIN("file check");
+            if (reload_requested) {
+                file_mtime = (struct timespec){0};
+                built = false;
+                reload_requested = false;
+            }
             if (stat(path, &st) == 0) {
-                if (st.st_mtim.tv_sec != file_mtime.tv_sec || st.st_mtim.tv_nsec != file_mtime.tv_nsec) {
-                    if (update_file_buffer(path, (size_t)st.st_size)) {
-                        const char *src[3] = { fs_header_src, file_buffer, fs_footer_src };
-                        if (program) glDeleteProgram(program);
-                        program = 0;
-                        fs = create_shader(src, 3, GL_FRAGMENT_SHADER);
-                        if (fs) {
-                            program = link_program(vs, fs);
-                            if (program) {
-                                file_mtime = st.st_mtim;
-                                array_clear(log_buffer);
-                            }
-                        }
+                if ((st.st_mtim.tv_sec != file_mtime.tv_sec || st.st_mtim.tv_nsec != file_mtime.tv_nsec) &&
+                    update_file_buffer(path)) {
+                    // Touching, autosaving or checking out a file often leaves its content as it was.
+                    if (!built || file_hash != built_hash) {
+                        TRACE_BEGIN("compile/link");
+                        uniforms_parse(file_buffer);
+                        drag_slider = -1;
+                        program = quality_build(&quality, compute ? 0 : vs, compute ? cpath.header : header_src,
+                                                file_buffer, compute ? compute_footer_src : fs_footer_src);
+                        uniforms_bind(program);
+                        if (program) array_clear(log_buffer);
+                        built = true;
+                        built_hash = file_hash;
+                        TRACE_END();
                     }
+                    // A failed build is read again, the file may have been caught halfway through a save.
+                    if (program) file_mtime = st.st_mtim;
                 }
             }
             last_read = 0;
+            TRACE_END();
         }
 
         struct timespec t1, delta;
@@ -511,58 +1220,264 @@ int main(int argc, char *argv[])
         timespec_sub(&delta, &t1, &t0);
         t0 = t1;
 
-        double dt = timespec_to_msec(&delta);
-        t_total += dt;
-        if (t_total > (double)FLT_MAX) t_total -= (double)FLT_MAX;
+        double dt = timespec_to_sec(&delta);
+        stats.cpu_ms[stats.num_cpu++ % STATS_FRAMES] = dt*1000.0;
+        double time_step = platform.headless ? 1.0/fps : dt;
+        if (!playback.paused) {
+            playback.time += time_step;
+        } else if (playback.step_frames > 0) {
+            playback.time += 1.0/60.0;
+            playback.step_frames--;
+        }
+        if (playback.time > (double)FLT_MAX) playback.time -= (double)FLT_MAX;
 
+        GLuint framebuffer = platform.begin_frame(&platform);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
         glClearColor(0, 0, 0, 1);
         glClear(GL_COLOR_BUFFER_BIT);
         glViewport(0, 0, window_width, window_height);
-        if (program) {
+        if (analysis_enabled && !analysis.reduce_program && !analysis_init(&analysis))
+            analysis_enabled = false;
+        // The pointer is read once more right before drawing, events may be a frame old.
+        int64_t input_ns = pacing_now();
+        platform.query_pointer(&platform, &mouse_x, &mouse_y);
+        if (gallery_mode) {
+            TRACE_BEGIN("gallery");
+            GPU_TRACE_BEGIN("gallery");
+            gallery_poll(&gallery, vs);
+            gallery_draw(&gallery, framebuffer, window_width, window_height, playback.time, (double)input_ns/1e9,
+                         mouse_x, mouse_y);
+            glViewport(0, 0, window_width, window_height);
+            GPU_TRACE_END();
+            TRACE_END();
+
+            TRACE_BEGIN("overlay build");
+            push_gallery(&gallery);
+            TRACE_END();
+        } else if (program) {
+            int width = render_width ? render_width : window_width;
+            int height = render_width ? render_height : window_height;
+            int shader_mouse_x = mouse_x, shader_mouse_y = mouse_y;
+            rect_t fit = {0};
+            if (render_width) {
+                fit = scaled_rect();
+                shader_mouse_x = (int)(((float)mouse_x - fit.x) * (float)width / fit.w);
+                shader_mouse_y = (int)(((float)mouse_y - fit.y) * (float)height / fit.h);
+            }
+            GLuint output = render_width ? scaled_target(width, height) : framebuffer;
+            GLuint target = analysis_enabled ? analysis_target(&analysis, width, height) : output;
+            glBindFramebuffer(GL_FRAMEBUFFER, target);
+            glViewport(0, 0, width, height);
+
+            TRACE_BEGIN("uniform upload");
             glUseProgram(program);
-            glUniform2f(ULOC_RESOLUTION, (float)window_width, (float)window_height);
-            glUniform1f(ULOC_TIME, (float)t_total);
-            glUniform1f(ULOC_TIME_DELTA, (float)dt);
-            glUniform1i(ULOC_FRAME, frame);
-            glUniform2f(ULOC_MOUSE, (float)mouse_x, (float)mouse_y);
-            glDrawArrays(GL_TRIANGLES, 0, 3);
+            set_user_uniforms(width, height, playback.time, time_step, frame, shader_mouse_x, shader_mouse_y);
+            uniforms_apply();
+            // Unbound channels read as black.
+            if (audio_path)
+                audio_update(&audio, playback.paused ? playback.time : playback.time + time_step);
+            else
+                glBindTexture(GL_TEXTURE_2D, 0);
+            TRACE_END();
+
+            if (debug_enabled) {
+                int x = debug_x >= 0 ? debug_x : shader_mouse_x;
+                int y = debug_x >= 0 ? debug_y : shader_mouse_y;
+                if (render_width && debug_x >= 0) {
+                    x = (int)(((float)debug_x - fit.x) * (float)width / fit.w);
+                    y = (int)(((float)debug_y - fit.y) * (float)height / fit.h);
+                }
+                // Fragment rows run bottom to top.
+                debug_print_begin(&debug, x, height - 1 - y);
+            }
+
+            if (volume_path) {
+                TRACE_BEGIN("volume upload");
+                volume_update(&volume);
+                TRACE_END();
+            }
+
+            TRACE_BEGIN("user draw");
+            GPU_TRACE_BEGIN("user draw");
+            // Timer results are picked up GPU_TIMER_FRAMES frames later, by then they are long done.
+            int timer = frame % GPU_TIMER_FRAMES;
+            int level = quality.level;
+            if (gpu_timer_pending[timer]) {
+                GLuint64 ns;
+                glGetQueryObjectui64v(gpu_timers[timer], GL_QUERY_RESULT, &ns);
+                stats.gpu_ms[stats.num_gpu++ % STATS_FRAMES] = (double)ns / 1e6;
+                quality_sample(&quality, gpu_timer_level[timer], (double)ns / 1e6);
+            }
+            gpu_timer_pending[timer] = true;
+            gpu_timer_level[timer] = level;
+            glBeginQuery(GL_TIME_ELAPSED, gpu_timers[timer]);
+            if (compute)
+                compute_draw(&cpath, program, width, height, target);
+            else
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            glEndQuery(GL_TIME_ELAPSED);
+            GPU_TRACE_END();
+            TRACE_END();
+            if (debug_enabled) debug_print_end(&debug);
+            // The next frame draws the new level, this one's uniforms were set for the old one.
+            if (quality.level != level) {
+                program = quality_program(&quality);
+                uniforms_bind(program);
+            }
 
+            if (analysis_enabled) {
+                TRACE_BEGIN("analysis");
+                GPU_TRACE_BEGIN("analysis");
+                analysis_run(&analysis, output);
+                GPU_TRACE_END();
+                TRACE_END();
+            }
+
+            if (render_width) {
+                // Window rows run top to bottom, GL's bottom to top.
+                int y0 = window_height - (int)(fit.y + fit.h);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, output);
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+                glBlitFramebuffer(0, 0, width, height, (int)fit.x, y0, (int)(fit.x + fit.w), y0 + (int)fit.h,
+                                  GL_COLOR_BUFFER_BIT, GL_LINEAR);
+                glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            }
+            glViewport(0, 0, window_width, window_height);
+
+            TRACE_BEGIN("overlay build");
             int len = snprintf(fps_buffer, 16, "FPS: %.3f", 1.0/(double)dt);
             push_quad(make_rect(0, 0, 90, 18), make_rect(-1, -1, -1, -1), 0x7F);
-            push_text(fps_buffer, (size_t)len, 0, 14.0f);
-        } else {
-            push_text(log_buffer, array_size(log_buffer), 0, 14.0f);
+            overlay_text(fps_buffer, (size_t)len, 0, 14.0f);
+            if (pacer.presented) {
+                char latency[64];
+                len = snprintf(latency, sizeof latency, "Latency: %.1f ms", pacer.latency_ms);
+                push_quad(make_rect(0, 18, 120, 18), make_rect(-1, -1, -1, -1), 0x7F);
+                overlay_text(latency, (size_t)len, 0, 32.0f);
+            }
+            if (fullscreen) {
+                static const char *flip_names[] = { "offscreen", "composited", "unredirected", "direct" };
+                // Asking the X server costs a round trip, once a second is enough.
+                if (frame % 60 == 0) flip = platform.flip_mode(&platform);
+                char flips[64];
+                len = snprintf(flips, sizeof flips, "Flips: %s", flip_names[flip]);
+                push_quad(make_rect(0, 36, 120, 18), make_rect(-1, -1, -1, -1), 0x7F);
+                overlay_text(flips, (size_t)len, 0, 50.0f);
+            }
+            if (array_size(debug.text)) {
+                float y = fullscreen ? 54.0f : pacer.presented ? 36.0f : 18.0f;
+                overlay_text(debug.text, array_size(debug.text), 0, y + 14.0f);
+            }
+            push_sliders();
+            if (analysis_enabled && analysis.valid) push_analysis();
+            TRACE_END();
+        }
+
+        if (export_name) {
+            TRACE_BEGIN("export");
+            export_frame(&ex, window_width, window_height);
+            TRACE_END();
+        }
+
+        if (record) {
+            // Blocks here when the encoders fall behind.
+            TRACE_BEGIN("record");
+            int slot;
+            uint8_t *pixels = image_writer_acquire(&writer, window_width, window_height, &slot);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, window_width, window_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            char record_path[PATH_MAX];
+            snprintf(record_path, sizeof record_path, record, frame);
+            image_writer_submit(&writer, slot, record_path, -1);
+            TRACE_END();
         }
 
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(array_size(vertex_buffer)*sizeof(vertex_t)),
-                     vertex_buffer, GL_STREAM_DRAW);
+        if (capture.pending) {
+            // Read before the overlay is drawn on top.
+            uint8_t *pixels = arena_push(&frame_arena, uint8_t, (size_t)window_width*(size_t)window_height*4);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, window_width, window_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            if (write_image(capture.path, pixels, window_width, window_height))
+                control_reply(&ctl, capture.client, "ok");
+            else
+                control_reply(&ctl, capture.client, "error %s: %s", capture.path, strerror(errno));
+            capture.pending = false;
+        }
+
+        if (!program && !gallery_mode) {
+            TRACE_BEGIN("overlay build");
+            overlay_text(log_buffer, array_size(log_buffer), 0, 14.0f);
+            TRACE_END();
+        }
 
+        TRACE_BEGIN("glBufferData");
+        GPU_TRACE_BEGIN("overlay upload");
+        if (overlay_font) font_atlas_flush(overlay_font);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(array_size(quad_buffer)*sizeof(overlay_quad_t)),
+                     quad_buffer, GL_STREAM_DRAW);
+        GPU_TRACE_END();
+        TRACE_END();
+
+        TRACE_BEGIN("overlay draw");
+        GPU_TRACE_BEGIN("overlay draw");
         glEnable(GL_BLEND);
         glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
         glUseProgram(quad_program);
-        glUniform2f(ULOC_RESOLUTION, (float)window_width, (float)window_height);
-        glDrawArrays(GL_TRIANGLES, 0, (GLsizei)array_size(vertex_buffer));
+        // Bound here, backends bind their own textures when creating render targets.
+        glBindTexture(GL_TEXTURE_2D, overlay_font ? overlay_font->texture : texture);
+        glUniform2f(ULOC_RESOLUTION, (float)window_width/overlay_scale, (float)window_height/overlay_scale);
+        glUniform3f(QUAD_ULOC_TEXT_STYLE, text_style[0], text_style[1], text_style[2]);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, (GLsizei)array_size(quad_buffer));
         glDisable(GL_BLEND);
+        GPU_TRACE_END();
+        TRACE_END();
 
-        array_clear(vertex_buffer);
+        array_clear(quad_buffer);
+        arena_reset(&frame_arena);
 
-        glXSwapBuffers(display, window);
+        TRACE_BEGIN("present");
+        platform.present(&platform);
+        pacing_presented(&pacer, &platform, input_ns);
+        TRACE_END();
+        TRACE_END();
+        TRACE_FRAME();
 
         frame++;
         last_read++;
+        if (quit_requested || (max_frames >= 0 && frame >= max_frames))
+            running = 0;
     }
 
+    TRACE_DUMP();
+    TRACE_SHUTDOWN();
+
+    if (record && image_writer_flush(&writer))
+        status = EXIT_FAILURE;
+    image_writer_destroy(&writer);
+    control_close(&ctl);
+    export_close(&ex);
+    glDeleteQueries(GPU_TIMER_FRAMES, gpu_timers);
+
+    array_free(custom_uniforms);
     array_free(log_buffer);
-    array_free(file_buffer);
-    array_free(vertex_buffer);
+    free_file_buffer();
+    array_free(quad_buffer);
+    arena_free(&frame_arena);
+    font_atlas_destroy(&font);
+    analysis_destroy(&analysis);
+    compute_destroy(&cpath);
+    if (scaled.texture) glDeleteTextures(1, &scaled.texture);
+    if (scaled.fbo) glDeleteFramebuffers(1, &scaled.fbo);
+    audio_close(&audio);
+    volume_close(&volume);
+    debug_print_destroy(&debug);
+    gallery_close(&gallery);
+    free(debug_header);
 
     glDeleteBuffers(1, &vbo);
     glDeleteVertexArrays(1, &vao);
     glDeleteProgram(quad_program);
-    glDeleteProgram(program);
-    glXDestroyContext(display, ctx);
-    XDestroyWindow(display, window);
-    XCloseDisplay(display);
+    quality_destroy(&quality);
+    platform.destroy(&platform);
 
-    return EXIT_SUCCESS;
+    return status;
 }
@@ -0,0 +1,217 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Frame instrumentation, enabled by compiling with -DTADERSHOY_TRACE.
+ * CPU zones are begin/end pairs on the main thread, GPU zones are pairs of
+ * timestamp queries resolved a few frames later. The last TRACE_MAX_EVENTS
+ * events are kept and written in the Chrome JSON trace format, which can be
+ * opened in Perfetto or chrome://tracing. Without the define every macro
+ * expands to nothing.
+ */
+
+#ifdef TADERSHOY_TRACE
+
+#include "gl.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define TRACE_PATH          "tadershoy-trace.json"
+#define TRACE_MAX_EVENTS    65536
+#define TRACE_MAX_DEPTH     16
+#define TRACE_GPU_FRAMES    4 // Frames in flight before GPU results are read back
+#define TRACE_GPU_ZONES     16 // Per frame
+
+#define TRACE_TID_CPU       1
+#define TRACE_TID_GPU       2
+
+typedef struct
+{
+    const char *name;
+    int64_t ts;  // ns, CLOCK_MONOTONIC
+    int64_t dur; // ns
+    int tid;
+} trace_event_t;
+
+typedef struct
+{
+    const char *name;
+    GLuint queries[2];
+} trace_gpu_zone_t;
+
+static struct
+{
+    trace_event_t events[TRACE_MAX_EVENTS];
+    uint64_t num_events; // Total, the ring holds the last TRACE_MAX_EVENTS
+
+    const char *stack_name[TRACE_MAX_DEPTH];
+    int64_t stack_ts[TRACE_MAX_DEPTH];
+    int depth;
+
+    trace_gpu_zone_t gpu_zones[TRACE_GPU_FRAMES][TRACE_GPU_ZONES];
+    int num_gpu_zones[TRACE_GPU_FRAMES];
+    int gpu_open; // Index of the open GPU zone or -1
+    int gpu_frame;
+    int64_t gpu_offset; // CPU time minus GPU time
+    bool gpu_ready;
+} trace;
+
+static inline int64_t trace_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+static inline void trace_emit(const char *name, int64_t ts, int64_t dur, int tid)
+{
+    trace.events[trace.num_events++ % TRACE_MAX_EVENTS] = (trace_event_t){ name, ts, dur, tid };
+}
+
+static inline void trace_begin(const char *name)
+{
+    if (trace.depth < TRACE_MAX_DEPTH) {
+        trace.stack_name[trace.depth] = name;
+        trace.stack_ts[trace.depth] = trace_now();
+    }
+    trace.depth++;
+}
+
+static inline void trace_end(void)
+{
+    if (trace.depth == 0) return;
+    int64_t now = trace_now();
+    if (--trace.depth < TRACE_MAX_DEPTH)
+        trace_emit(trace.stack_name[trace.depth], trace.stack_ts[trace.depth],
+                   now - trace.stack_ts[trace.depth], TRACE_TID_CPU);
+}
+
+// Needs a current context, pairs the GPU timestamp domain with CLOCK_MONOTONIC.
+static void trace_init(void)
+{
+    for (int f = 0; f < TRACE_GPU_FRAMES; f++) {
+        for (int z = 0; z < TRACE_GPU_ZONES; z++)
+            glGenQueries(2, trace.gpu_zones[f][z].queries);
+    }
+
+    GLint64 gpu;
+    int64_t before = trace_now();
+    glGetInteger64v(GL_TIMESTAMP, &gpu);
+    int64_t after = trace_now();
+    trace.gpu_offset = before + (after - before)/2 - (int64_t)gpu;
+    trace.gpu_open = -1;
+    trace.gpu_ready = true;
+}
+
+static void trace_shutdown(void)
+{
+    if (!trace.gpu_ready) return;
+    for (int f = 0; f < TRACE_GPU_FRAMES; f++) {
+        for (int z = 0; z < TRACE_GPU_ZONES; z++)
+            glDeleteQueries(2, trace.gpu_zones[f][z].queries);
+    }
+    trace.gpu_ready = false;
+}
+
+static inline void gpu_trace_begin(const char *name)
+{
+    int f = trace.gpu_frame;
+    if (!trace.gpu_ready || trace.gpu_open >= 0 || trace.num_gpu_zones[f] == TRACE_GPU_ZONES) return;
+
+    trace_gpu_zone_t *zone = &trace.gpu_zones[f][trace.num_gpu_zones[f]];
+    zone->name = name;
+    glQueryCounter(zone->queries[0], GL_TIMESTAMP);
+    trace.gpu_open = trace.num_gpu_zones[f];
+}
+
+static inline void gpu_trace_end(void)
+{
+    if (trace.gpu_open < 0) return;
+    int f = trace.gpu_frame;
+    glQueryCounter(trace.gpu_zones[f][trace.gpu_open].queries[1], GL_TIMESTAMP);
+    trace.num_gpu_zones[f]++;
+    trace.gpu_open = -1;
+}
+
+static void trace_resolve(int f, bool wait)
+{
+    for (int z = 0; z < trace.num_gpu_zones[f]; z++) {
+        trace_gpu_zone_t *zone = &trace.gpu_zones[f][z];
+        if (!wait) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(zone->queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+        }
+
+        GLuint64 t0, t1;
+        glGetQueryObjectui64v(zone->queries[0], GL_QUERY_RESULT, &t0);
+        glGetQueryObjectui64v(zone->queries[1], GL_QUERY_RESULT, &t1);
+        trace_emit(zone->name, (int64_t)t0 + trace.gpu_offset, (int64_t)(t1 - t0), TRACE_TID_GPU);
+    }
+    trace.num_gpu_zones[f] = 0;
+}
+
+// Call once per frame, after the swap.
+static void trace_frame(void)
+{
+    if (!trace.gpu_ready) return;
+    trace.gpu_frame = (trace.gpu_frame + 1) % TRACE_GPU_FRAMES;
+    // The oldest frame in the ring should be long done, results still pending are dropped.
+    trace_resolve(trace.gpu_frame, false);
+}
+
+static void trace_dump(const char *path)
+{
+    if (trace.gpu_ready) {
+        for (int i = 1; i < TRACE_GPU_FRAMES; i++)
+            trace_resolve((trace.gpu_frame + i) % TRACE_GPU_FRAMES, true);
+    }
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        perror(path);
+        return;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"CPU\"}},\n"
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}",
+            TRACE_TID_CPU, TRACE_TID_GPU);
+
+    uint64_t first = trace.num_events > TRACE_MAX_EVENTS ? trace.num_events - TRACE_MAX_EVENTS : 0;
+    for (uint64_t i = first; i < trace.num_events; i++) {
+        const trace_event_t *e = &trace.events[i % TRACE_MAX_EVENTS];
+        fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                e->name, e->tid, (double)e->ts/1000.0, (double)e->dur/1000.0);
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    fprintf(stderr, "trace: wrote %llu events to %s\n",
+            (unsigned long long)(trace.num_events - first), path);
+}
+
+#define TRACE_INIT()            trace_init()
+#define TRACE_SHUTDOWN()        trace_shutdown()
+#define TRACE_BEGIN(name)       trace_begin(name)
+#define TRACE_END()             trace_end()
+#define GPU_TRACE_BEGIN(name)   gpu_trace_begin(name)
+#define GPU_TRACE_END()         gpu_trace_end()
+#define TRACE_FRAME()           trace_frame()
+#define TRACE_DUMP()            trace_dump(TRACE_PATH)
+
+#else
+
+#define TRACE_INIT()            ((void)0)
+#define TRACE_SHUTDOWN()        ((void)0)
+#define TRACE_BEGIN(name)       ((void)0)
+#define TRACE_END()             ((void)0)
+#define GPU_TRACE_BEGIN(name)   ((void)0)
+#define GPU_TRACE_END()         ((void)0)
+#define TRACE_FRAME()           ((void)0)
+#define TRACE_DUMP()            ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+/*
+ * Custom uniforms set at runtime. Values are kept by name so they survive
+ * program reloads; locations and types are looked up again whenever a new
+ * program is bound.
+ *
+ * Uniforms can also be declared tweakable in the source:
+ *
+ *     uniform float uRough; // @slider 0 1 0.5
+ *
+ * with the range and default value. float, int and vecN are supported, the
+ * range applies to every component. Such uniforms get overlay sliders and
+ * keep their value across reloads as long as the declaration is unchanged.
+ */
+
+#include "gl.h"
+#include "memory.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    char name[64];
+    float value[4];
+    GLint location;
+    GLenum type;
+
+    // Declared with @slider
+    bool slider;
+    bool integer;
+    int components;
+    float min;
+    float max;
+    char decl[128]; // Normalized declaration, a change resets the value
+    bool seen;
+} custom_uniform_t;
+
+static custom_uniform_t *custom_uniforms;
+
+static void uniform_resolve(GLuint program, custom_uniform_t *u)
+{
+    u->location = -1;
+    u->type = GL_NONE;
+    if (!program) return;
+
+    GLint location = glGetUniformLocation(program, u->name);
+    if (location < 0) return;
+
+    GLint count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; i++) {
+        char name[64];
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program, (GLuint)i, sizeof name, NULL, &size, &type, name);
+        if (strcmp(name, u->name) == 0) {
+            u->location = location;
+            u->type = type;
+            return;
+        }
+    }
+}
+
+static void uniforms_bind(GLuint program)
+{
+    for (size_t i = 0; i < array_size(custom_uniforms); i++)
+        uniform_resolve(program, &custom_uniforms[i]);
+}
+
+// Returns false if the name is too long to be a uniform.
+static bool uniform_set(GLuint program, const char *name, const float *value, int count)
+{
+    if (strlen(name) >= sizeof custom_uniforms[0].name) return false;
+
+    custom_uniform_t *u = NULL;
+    for (size_t i = 0; i < array_size(custom_uniforms); i++) {
+        if (strcmp(custom_uniforms[i].name, name) == 0) {
+            u = &custom_uniforms[i];
+            break;
+        }
+    }
+    if (!u) {
+        custom_uniform_t item = {0};
+        strcpy(item.name, name);
+        array_push_back(custom_uniforms, item);
+        u = &custom_uniforms[array_size(custom_uniforms)-1];
+        uniform_resolve(program, u);
+    }
+
+    memset(u->value, 0, sizeof u->value);
+    memcpy(u->value, value, (size_t)(count < 4 ? count : 4)*sizeof *value);
+    return true;
+}
+
+static const char *skip_space(const char *p)
+{
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+static const char *read_word(const char *p, char *word, size_t size)
+{
+    size_t n = 0;
+    while (isalnum((unsigned char)*p) || *p == '_') {
+        if (n + 1 < size) word[n++] = *p;
+        p++;
+    }
+    word[n] = 0;
+    return p;
+}
+
+// Parses one "uniform <type> <name>; // @slider min max [default]" line.
+static bool parse_slider(const char *line, const char *end, custom_uniform_t *u)
+{
+    char type[16], name[sizeof u->name];
+    const char *p = skip_space(line);
+    if (strncmp(p, "uniform", 7) != 0 || (p[7] != ' ' && p[7] != '\t')) return false;
+    p = read_word(skip_space(p + 7), type, sizeof type);
+    p = read_word(skip_space(p), name, sizeof name);
+    p = skip_space(p);
+    if (!name[0] || *p != ';') return false;
+
+    // Only within the line, most uniforms carry no tag.
+    const char *tag = p;
+    while (tag + 7 <= end && memcmp(tag, "@slider", 7)) tag++;
+    if (tag + 7 > end) return false;
+
+    memset(u, 0, sizeof *u);
+    if (strcmp(type, "float") == 0) u->components = 1;
+    else if (strcmp(type, "vec2") == 0) u->components = 2;
+    else if (strcmp(type, "vec3") == 0) u->components = 3;
+    else if (strcmp(type, "vec4") == 0) u->components = 4;
+    else if (strcmp(type, "int") == 0) u->components = 1, u->integer = true;
+    else return false;
+
+    float args[3];
+    int num_args = 0;
+    p = tag + 7;
+    while (num_args < 3 && p < end) {
+        char *next;
+        float v = strtof(p, &next);
+        if (next == p || next > end) break;
+        args[num_args++] = v;
+        p = next;
+    }
+    if (num_args < 2) return false;
+    if (num_args == 2) args[2] = args[0];
+
+    strcpy(u->name, name);
+    u->slider = true;
+    u->min = args[0];
+    u->max = args[1];
+    for (int i = 0; i < 4; i++)
+        u->value[i] = i < u->components ? args[2] : 0.0f;
+    u->location = -1;
+    snprintf(u->decl, sizeof u->decl, "%s %s %g %g %g", type, name, args[0], args[1], args[2]);
+    return true;
+}
+
+/*
+ * Collects the @slider declarations of a freshly loaded source. Values of
+ * declarations that did not change are kept, sliders that disappeared from
+ * the source are removed. Uniforms only ever set through the control socket
+ * are left alone.
+ */
+static void uniforms_parse(const char *src)
+{
+    for (size_t i = 0; i < array_size(custom_uniforms); i++)
+        custom_uniforms[i].seen = !custom_uniforms[i].slider;
+
+    for (const char *line = src; *line; ) {
+        const char *end = strchr(line, '\n');
+        if (!end) end = line + strlen(line);
+
+        custom_uniform_t parsed;
+        if (parse_slider(line, end, &parsed)) {
+            custom_uniform_t *u = NULL;
+            for (size_t i = 0; i < array_size(custom_uniforms); i++) {
+                if (strcmp(custom_uniforms[i].name, parsed.name) == 0) {
+                    u = &custom_uniforms[i];
+                    break;
+                }
+            }
+
+            parsed.seen = true;
+            if (!u) array_push_back(custom_uniforms, parsed);
+            else if (!u->slider || strcmp(u->decl, parsed.decl) != 0) *u = parsed;
+            else u->seen = true;
+        }
+
+        line = *end ? end + 1 : end;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < array_size(custom_uniforms); i++) {
+        if (custom_uniforms[i].seen) custom_uniforms[n++] = custom_uniforms[i];
+    }
+    if (custom_uniforms) array_header(custom_uniforms)->size = n;
+}
+
+// Moves component c of a slider to t in [0, 1] of its range.
+static void uniform_slide(custom_uniform_t *u, int c, float t)
+{
+    t = t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t;
+    float v = u->min + t*(u->max - u->min);
+    u->value[c] = u->integer ? roundf(v) : v;
+}
+
+// Expects the program passed to the last uniforms_bind() to be in use.
+static void uniforms_apply(void)
+{
+    for (size_t i = 0; i < array_size(custom_uniforms); i++) {
+        const custom_uniform_t *u = &custom_uniforms[i];
+        const float *v = u->value;
+        switch (u->type) {
+            case GL_FLOAT:      glUniform1f(u->location, v[0]); break;
+            case GL_FLOAT_VEC2: glUniform2f(u->location, v[0], v[1]); break;
+            case GL_FLOAT_VEC3: glUniform3f(u->location, v[0], v[1], v[2]); break;
+            case GL_FLOAT_VEC4: glUniform4f(u->location, v[0], v[1], v[2], v[3]); break;
+            case GL_INT:
+            case GL_BOOL:       glUniform1i(u->location, (GLint)v[0]); break;
+            default: break;
+        }
+    }
+}
+
+#endif
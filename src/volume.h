@@ -0,0 +1,361 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+/*
+ * Volume input for iChannel1, a sampler3D. The raw volume file is mapped,
+ * never read into memory as a whole, and uploaded in bricks through a ring
+ * of slots in a persistently mapped PBO, a bounded number of bytes each
+ * frame, so even a volume of many gigabytes opens at once; bricks not yet
+ * uploaded read as zero. A slot is fenced after its upload and only reused
+ * once the GPU has copied out of it. Bricks go slab by slab along z, and
+ * the pages of every finished slab are dropped from the mapping again.
+ *
+ * With a memory budget, or past GL_MAX_3D_TEXTURE_SIZE, the volume is
+ * halved along every axis until it fits and each brick is box filtered from
+ * the mapping as it is staged.
+ *
+ * A file either starts with a header line, followed by the voxels with x
+ * varying fastest:
+ *
+ *     tvol <width> <height> <depth> <uint8|uint16|float32>\n
+ *
+ * or has no header and names its size and type like the Open SciVis
+ * datasets do, e.g. skull_256x256x256_uint8.raw. Voxels are little endian.
+ */
+
+#include "gl.h"
+#include "memory.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define VOLUME_BRICK        64              // Brick edge in texels
+#define VOLUME_FRAME_BYTES  (16 << 20)      // Voxels read from the file per frame
+#define VOLUME_RING_BYTES   (48 << 20)      // Staging for a few frames of bricks in flight
+
+typedef enum
+{
+    VOLUME_UINT8,
+    VOLUME_UINT16,
+    VOLUME_FLOAT32,
+    NUM_VOLUME_FORMATS,
+} volume_format_t;
+
+static const struct
+{
+    const char *name;
+    int bytes;
+    GLenum internal_format;
+    GLenum type;
+} volume_formats[NUM_VOLUME_FORMATS] = {
+    { "uint8",   1, GL_R8,   GL_UNSIGNED_BYTE },
+    { "uint16",  2, GL_R16,  GL_UNSIGNED_SHORT },
+    { "float32", 4, GL_R32F, GL_FLOAT },
+};
+
+typedef struct
+{
+    uint8_t *map;
+    size_t map_size;
+    size_t offset;          // Of the first voxel in the mapping
+    int size[3];            // Voxels in the file
+    int dims[3];            // Texels, size halved shift times
+    int shift;
+    volume_format_t format;
+
+    GLuint texture;
+    GLuint pbo;
+    uint8_t *staging;       // The PBO, persistently mapped
+    GLsync *fences;         // Per slot, 0 when free
+    int num_slots;
+    int slot;
+    size_t slot_bytes;
+    int bricks[3];
+    int64_t next_brick;
+    int64_t num_bricks;
+    size_t released;        // Start of the mapping dropped so far
+} volume_t;
+
+// Reads the size and format from the header line or, failing that, the file name.
+static bool volume_parse(volume_t *v, const char *path)
+{
+    char name[16] = "";
+    v->offset = 0;
+    if (v->map_size >= 5 && !memcmp(v->map, "tvol ", 5)) {
+        char line[128];
+        size_t n = 0;
+        while (n < sizeof line - 1 && n < v->map_size && v->map[n] != '\n') {
+            line[n] = (char)v->map[n];
+            n++;
+        }
+        line[n] = 0;
+        if (n == v->map_size || v->map[n] != '\n' ||
+            sscanf(line, "tvol %d %d %d %15s", &v->size[0], &v->size[1], &v->size[2], name) != 4) {
+            fprintf(stderr, "%s: Invalid volume header.\n", path);
+            return false;
+        }
+        v->offset = n + 1;
+    } else {
+        const char *base = strrchr(path, '/');
+        base = base ? base + 1 : path;
+        bool found = false;
+        for (const char *p = strchr(base, '_'); p && !found; p = strchr(p + 1, '_'))
+            found = sscanf(p, "_%dx%dx%d_%15[a-z0-9]", &v->size[0], &v->size[1], &v->size[2], name) == 4;
+        if (!found) {
+            fprintf(stderr, "%s: No tvol header, and no _<w>x<h>x<d>_<type> in the file name.\n", path);
+            return false;
+        }
+    }
+
+    int f = 0;
+    while (f < NUM_VOLUME_FORMATS && strcmp(name, volume_formats[f].name)) f++;
+    if (f == NUM_VOLUME_FORMATS) {
+        fprintf(stderr, "%s: Unsupported voxel type '%s', use uint8, uint16 or float32.\n", path, name);
+        return false;
+    }
+    v->format = (volume_format_t)f;
+    if (v->size[0] <= 0 || v->size[1] <= 0 || v->size[2] <= 0) {
+        fprintf(stderr, "%s: Invalid volume size.\n", path);
+        return false;
+    }
+    size_t bytes = (size_t)v->size[0]*(size_t)v->size[1]*(size_t)v->size[2]*(size_t)volume_formats[f].bytes;
+    if (v->map_size - v->offset < bytes) {
+        fprintf(stderr, "%s: File is shorter than a %dx%dx%d %s volume.\n", path,
+                v->size[0], v->size[1], v->size[2], name);
+        return false;
+    }
+    return true;
+}
+
+static inline float volume_load(const uint8_t *p, volume_format_t format)
+{
+    uint16_t u;
+    float x;
+    switch (format) {
+        case VOLUME_UINT8: return (float)*p;
+        case VOLUME_UINT16: memcpy(&u, p, sizeof u); return (float)u;
+        default: memcpy(&x, p, sizeof x); return x;
+    }
+}
+
+static inline void volume_store(uint8_t *p, float x, volume_format_t format)
+{
+    uint16_t u;
+    switch (format) {
+        case VOLUME_UINT8: *p = (uint8_t)(x + 0.5f); break;
+        case VOLUME_UINT16: u = (uint16_t)(x + 0.5f); memcpy(p, &u, sizeof u); break;
+        default: memcpy(p, &x, sizeof x); break;
+    }
+}
+
+/*
+ * Writes the w*h*d texels at x0, y0, z0 to dst, tightly packed. Each
+ * texel averages the voxels of its 2^shift block that are inside the file.
+ */
+static void volume_stage(const volume_t *v, uint8_t *dst, int x0, int y0, int z0, int w, int h, int d)
+{
+    const int vb = volume_formats[v->format].bytes;
+    const size_t row = (size_t)v->size[0]*(size_t)vb, slice = row*(size_t)v->size[1];
+    const uint8_t *voxels = v->map + v->offset;
+    if (!v->shift) {
+        for (int z = 0; z < d; z++) {
+            for (int y = 0; y < h; y++) {
+                memcpy(dst, voxels + (size_t)(z0 + z)*slice + (size_t)(y0 + y)*row + (size_t)x0*vb, (size_t)w*vb);
+                dst += (size_t)w*vb;
+            }
+        }
+        return;
+    }
+
+    const int s = v->shift, f = 1 << s;
+    float sum[VOLUME_BRICK];
+    int count[VOLUME_BRICK];
+    for (int z = 0; z < d; z++) {
+        for (int y = 0; y < h; y++) {
+            memset(sum, 0, sizeof sum);
+            memset(count, 0, sizeof count);
+            for (int sz = (z0 + z) << s; sz < ((z0 + z) << s) + f && sz < v->size[2]; sz++) {
+                for (int sy = (y0 + y) << s; sy < ((y0 + y) << s) + f && sy < v->size[1]; sy++) {
+                    const uint8_t *src = voxels + (size_t)sz*slice + (size_t)sy*row;
+                    for (int x = 0; x < w; x++) {
+                        for (int sx = (x0 + x) << s; sx < ((x0 + x) << s) + f && sx < v->size[0]; sx++) {
+                            sum[x] += volume_load(src + (size_t)sx*vb, v->format);
+                            count[x]++;
+                        }
+                    }
+                }
+            }
+            for (int x = 0; x < w; x++) {
+                volume_store(dst, sum[x] / (float)count[x], v->format);
+                dst += vb;
+            }
+        }
+    }
+}
+
+static void volume_close(volume_t *v)
+{
+    for (int i = 0; v->fences && i < v->num_slots; i++)
+        if (v->fences[i]) glDeleteSync(v->fences[i]);
+    free(v->fences);
+    if (v->pbo) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, v->pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &v->pbo);
+    }
+    if (v->texture) glDeleteTextures(1, &v->texture);
+    if (v->map) munmap(v->map, v->map_size);
+    memset(v, 0, sizeof *v);
+}
+
+/*
+ * Maps the volume at path and creates its texture, halved until it takes
+ * at most budget bytes if budget is not 0. Needs a GL context; the voxels
+ * are uploaded by volume_update().
+ */
+static bool volume_open(volume_t *v, const char *path, size_t budget)
+{
+    memset(v, 0, sizeof *v);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    v->map_size = (size_t)st.st_size;
+    v->map = v->map_size ? mmap(NULL, v->map_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (v->map == MAP_FAILED) {
+        v->map = NULL;
+        fprintf(stderr, "%s: Cannot map the volume.\n", path);
+        return false;
+    }
+    madvise(v->map, v->map_size, MADV_SEQUENTIAL);
+    if (!volume_parse(v, path)) {
+        volume_close(v);
+        return false;
+    }
+
+    const int vb = volume_formats[v->format].bytes;
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+    for (;;) {
+        size_t bytes = (size_t)vb;
+        bool fits = true;
+        for (int i = 0; i < 3; i++) {
+            v->dims[i] = (v->size[i] + (1 << v->shift) - 1) >> v->shift;
+            bytes *= (size_t)v->dims[i];
+            fits = fits && v->dims[i] <= max_size;
+        }
+        if ((fits && (!budget || bytes <= budget)) || (v->dims[0] == 1 && v->dims[1] == 1 && v->dims[2] == 1))
+            break;
+        v->shift++;
+    }
+    if (v->shift)
+        fprintf(stderr, "%s: %dx%dx%d volume loaded at %dx%dx%d.\n", path,
+                v->size[0], v->size[1], v->size[2], v->dims[0], v->dims[1], v->dims[2]);
+
+    const GLenum type = volume_formats[v->format].type;
+    glGenTextures(1, &v->texture);
+    glBindTexture(GL_TEXTURE_3D, v->texture);
+    glTexStorage3D(GL_TEXTURE_3D, 1, volume_formats[v->format].internal_format, v->dims[0], v->dims[1], v->dims[2]);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glClearTexImage(v->texture, 0, GL_RED, type, NULL);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    v->slot_bytes = (size_t)VOLUME_BRICK*VOLUME_BRICK*VOLUME_BRICK*(size_t)vb;
+    v->num_slots = VOLUME_RING_BYTES / (int)v->slot_bytes;
+    v->fences = xmalloc((size_t)v->num_slots*sizeof *v->fences);
+    memset(v->fences, 0, (size_t)v->num_slots*sizeof *v->fences);
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &v->pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, v->pbo);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)v->num_slots*(GLsizeiptr)v->slot_bytes, NULL, flags);
+    v->staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)v->num_slots*(GLsizeiptr)v->slot_bytes, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!v->staging) {
+        fprintf(stderr, "%s: Cannot map the volume staging buffer.\n", path);
+        volume_close(v);
+        return false;
+    }
+
+    v->num_bricks = 1;
+    for (int i = 0; i < 3; i++) {
+        v->bricks[i] = (v->dims[i] + VOLUME_BRICK - 1) / VOLUME_BRICK;
+        v->num_bricks *= v->bricks[i];
+    }
+    return true;
+}
+
+// Drops the mapped pages of every slice before z from memory, they are not read again.
+static void volume_release(volume_t *v, int z)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t slice = (size_t)v->size[0]*(size_t)v->size[1]*(size_t)volume_formats[v->format].bytes;
+    size_t end = (v->offset + (size_t)z*slice) & ~(page - 1);
+    if (end <= v->released) return;
+    madvise(v->map + v->released, end - v->released, MADV_DONTNEED);
+    v->released = end;
+}
+
+/*
+ * Binds the volume to unit 1 and uploads the next bricks, as many as
+ * VOLUME_FRAME_BYTES of the file covers. Stops early rather than wait for
+ * a staging slot the GPU still reads from.
+ */
+static void volume_update(volume_t *v)
+{
+    if (v->next_brick == v->num_bricks) {
+        glBindTextureUnit(1, v->texture);
+        return;
+    }
+
+    const GLenum type = volume_formats[v->format].type;
+    size_t read = v->slot_bytes << (3*v->shift);
+    int64_t budget = read < VOLUME_FRAME_BYTES ? (int64_t)(VOLUME_FRAME_BYTES / read) : 1;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, v->pbo);
+    glBindTexture(GL_TEXTURE_3D, v->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int64_t i = 0; i < budget && v->next_brick < v->num_bricks; i++) {
+        GLsync *fence = &v->fences[v->slot];
+        if (*fence) {
+            GLenum r = glClientWaitSync(*fence, 0, 0);
+            if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED) break;
+            glDeleteSync(*fence);
+            *fence = 0;
+        }
+
+        int64_t b = v->next_brick;
+        int x0 = (int)(b % v->bricks[0])*VOLUME_BRICK;
+        int y0 = (int)(b / v->bricks[0] % v->bricks[1])*VOLUME_BRICK;
+        int z0 = (int)(b / v->bricks[0] / v->bricks[1])*VOLUME_BRICK;
+        int w = v->dims[0] - x0 < VOLUME_BRICK ? v->dims[0] - x0 : VOLUME_BRICK;
+        int h = v->dims[1] - y0 < VOLUME_BRICK ? v->dims[1] - y0 : VOLUME_BRICK;
+        int d = v->dims[2] - z0 < VOLUME_BRICK ? v->dims[2] - z0 : VOLUME_BRICK;
+        size_t offset = (size_t)v->slot*v->slot_bytes;
+        volume_stage(v, v->staging + offset, x0, y0, z0, w, h, d);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, x0, y0, z0, w, h, d, GL_RED, type, (const void *)(uintptr_t)offset);
+        *fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        v->slot = (v->slot + 1) % v->num_slots;
+
+        // The last brick of a slab, the slices it covers are done.
+        if (++v->next_brick % ((int64_t)v->bricks[0]*v->bricks[1]) == 0)
+            volume_release(v, (z0 + d) << v->shift < v->size[2] ? (z0 + d) << v->shift : v->size[2]);
+    }
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindTextureUnit(1, v->texture);
+}
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+/*
+ * Frame writer pool. The render loop acquires a frame buffer, reads pixels
+ * into it and submits it with a path; worker threads encode and write it.
+ * There is a fixed number of frame buffers, so acquire blocks once they are
+ * all queued or being encoded, which throttles rendering to what the disk
+ * and encoders can sustain. Frame buffers, deflate states and encoder
+ * output are kept across frames, nothing is allocated once the pool has
+ * seen the largest frame size.
+ *
+ * QOI frames are encoded by one worker each, PNG frames are split into row
+ * bands that are deflated in parallel; the worker finishing the last band
+ * writes the file. Frames submitted with an id report their outcome through
+ * image_writer_result() once written.
+ */
+
+#include "image.h"
+#include "memory.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WRITER_MAX_THREADS  64
+#define WRITER_BAND_ROWS    64      // Minimum rows per PNG band
+
+typedef struct
+{
+    uint8_t *pixels;
+    size_t pixels_cap;
+    int width;
+    int height;
+    char path[PATH_MAX];
+    int id;                 // Reported by image_writer_result() unless negative
+    image_format_t format;
+    int num_bands;
+    int bands_left;
+    bool band_failed;
+    png_band_t bands[PNG_MAX_BANDS];
+    uint8_t *encoded;
+    size_t encoded_cap;
+} writer_frame_t;
+
+typedef struct
+{
+    int frame;
+    int band;
+} writer_task_t;
+
+typedef struct
+{
+    int id;
+    bool ok;
+} writer_result_t;
+
+typedef struct
+{
+    pthread_t threads[WRITER_MAX_THREADS];
+    int num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready;
+    pthread_cond_t frame_free;
+    writer_frame_t *frames;
+    int num_frames;
+    int *free_frames;
+    int num_free;
+    writer_task_t *tasks;   // Ring, never holds more than num_frames*PNG_MAX_BANDS tasks
+    int task_head;
+    int num_tasks;
+    writer_result_t *results;   // Written frames with an id, not yet taken
+    int num_pending;            // Submitted frames with an id, not yet taken
+    int failed;
+    bool quit;
+} image_writer_t;
+
+static bool writer_encode(writer_frame_t *f)
+{
+    if (f->format == IMAGE_PPM)
+        return write_ppm(f->path, f->pixels, f->width, f->height);
+
+    size_t cap = qoi_max_size(f->width, f->height);
+    if (f->encoded_cap < cap) {
+        f->encoded = xrealloc(f->encoded, cap);
+        f->encoded_cap = cap;
+    }
+    size_t size = encode_qoi(f->encoded, f->pixels, f->width, f->height);
+    FILE *fp = fopen(f->path, "wb");
+    if (!fp) return false;
+    bool ok = fwrite(f->encoded, 1, size, fp) == size;
+    return fclose(fp) == 0 && ok;
+}
+
+static void writer_release(image_writer_t *w, int frame, bool ok)
+{
+    pthread_mutex_lock(&w->lock);
+    if (!ok) w->failed++;
+    if (w->frames[frame].id >= 0)
+        array_push_back(w->results, ((writer_result_t){ w->frames[frame].id, ok }));
+    w->free_frames[w->num_free++] = frame;
+    pthread_cond_broadcast(&w->frame_free);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *writer_thread(void *user)
+{
+    image_writer_t *w = user;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->num_tasks && !w->quit)
+            pthread_cond_wait(&w->task_ready, &w->lock);
+        if (!w->num_tasks) break;
+
+        int cap = w->num_frames*PNG_MAX_BANDS;
+        writer_task_t task = w->tasks[w->task_head];
+        w->task_head = (w->task_head + 1) % cap;
+        w->num_tasks--;
+        pthread_mutex_unlock(&w->lock);
+
+        writer_frame_t *f = &w->frames[task.frame];
+        if (f->format != IMAGE_PNG) {
+            bool ok = writer_encode(f);
+            if (!ok) perror(f->path);
+            writer_release(w, task.frame, ok);
+            pthread_mutex_lock(&w->lock);
+            continue;
+        }
+
+        int y0 = (int)((int64_t)f->height*task.band/f->num_bands);
+        int y1 = (int)((int64_t)f->height*(task.band + 1)/f->num_bands);
+        bool ok = png_band_encode(&f->bands[task.band], f->pixels, f->width, f->height, y0, y1,
+                                  task.band == f->num_bands-1);
+
+        pthread_mutex_lock(&w->lock);
+        if (!ok) f->band_failed = true;
+        bool last = --f->bands_left == 0;
+        pthread_mutex_unlock(&w->lock);
+
+        if (last) {
+            if (f->band_failed) {
+                fprintf(stderr, "%s: Compression failed.\n", f->path);
+                ok = false;
+            } else {
+                ok = write_png_bands(f->path, f->width, f->height, f->bands, f->num_bands);
+                if (!ok) perror(f->path);
+            }
+            writer_release(w, task.frame, ok);
+        }
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// Starts num_threads encoder threads sharing num_frames frame buffers.
+static bool image_writer_init(image_writer_t *w, int num_threads, int num_frames)
+{
+    memset(w, 0, sizeof *w);
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > WRITER_MAX_THREADS) num_threads = WRITER_MAX_THREADS;
+    if (num_frames < 1) num_frames = 1;
+
+    w->num_frames = num_frames;
+    w->frames = xmalloc((size_t)num_frames*sizeof *w->frames);
+    memset(w->frames, 0, (size_t)num_frames*sizeof *w->frames);
+    w->free_frames = xmalloc((size_t)num_frames*sizeof *w->free_frames);
+    for (int i = 0; i < num_frames; i++)
+        w->free_frames[w->num_free++] = num_frames-1 - i;
+    w->tasks = xmalloc((size_t)num_frames*PNG_MAX_BANDS*sizeof *w->tasks);
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->task_ready, NULL);
+    pthread_cond_init(&w->frame_free, NULL);
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&w->threads[i], NULL, writer_thread, w) != 0) break;
+        w->num_threads++;
+    }
+    if (!w->num_threads) {
+        fprintf(stderr, "Could not start image writer threads.\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Returns a buffer for a width*height RGBA frame, bottom row first, and its
+ * slot for image_writer_submit(). Blocks while every buffer is in use.
+ */
+static uint8_t *image_writer_acquire(image_writer_t *w, int width, int height, int *slot)
+{
+    pthread_mutex_lock(&w->lock);
+    while (!w->num_free)
+        pthread_cond_wait(&w->frame_free, &w->lock);
+    *slot = w->free_frames[--w->num_free];
+    pthread_mutex_unlock(&w->lock);
+
+    writer_frame_t *f = &w->frames[*slot];
+    size_t size = (size_t)width*(size_t)height*4;
+    if (f->pixels_cap < size) {
+        f->pixels = xrealloc(f->pixels, size);
+        f->pixels_cap = size;
+    }
+    f->width = width;
+    f->height = height;
+    return f->pixels;
+}
+
+/*
+ * Queues an acquired frame for writing, the format is chosen by the path's
+ * extension. An id of 0 or more is handed back by image_writer_result().
+ */
+static void image_writer_submit(image_writer_t *w, int slot, const char *path, int id)
+{
+    writer_frame_t *f = &w->frames[slot];
+    snprintf(f->path, sizeof f->path, "%s", path);
+    f->id = id;
+    f->format = image_format_from_path(path);
+    f->num_bands = 1;
+    if (f->format == IMAGE_PNG) {
+        f->num_bands = f->height / WRITER_BAND_ROWS;
+        if (f->num_bands > w->num_threads) f->num_bands = w->num_threads;
+        if (f->num_bands > PNG_MAX_BANDS) f->num_bands = PNG_MAX_BANDS;
+        if (f->num_bands < 1) f->num_bands = 1;
+    }
+    f->bands_left = f->num_bands;
+    f->band_failed = false;
+
+    int cap = w->num_frames*PNG_MAX_BANDS;
+    pthread_mutex_lock(&w->lock);
+    if (id >= 0) w->num_pending++;
+    for (int i = 0; i < f->num_bands; i++)
+        w->tasks[(w->task_head + w->num_tasks++) % cap] = (writer_task_t){ slot, i };
+    pthread_cond_broadcast(&w->task_ready);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Waits for every submitted frame to be written. Returns the number of failed writes since the last call.
+static int image_writer_flush(image_writer_t *w)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->num_free < w->num_frames)
+        pthread_cond_wait(&w->frame_free, &w->lock);
+    int failed = w->failed;
+    w->failed = 0;
+    pthread_mutex_unlock(&w->lock);
+    return failed;
+}
+
+/*
+ * Takes the outcome of one written frame that was submitted with an id, in
+ * no particular order. Returns false if none is ready, with wait set only
+ * if none is still being written either.
+ */
+static bool image_writer_result(image_writer_t *w, bool wait, int *id, bool *ok)
+{
+    pthread_mutex_lock(&w->lock);
+    while (wait && !array_size(w->results) && w->num_pending > 0)
+        pthread_cond_wait(&w->frame_free, &w->lock);
+    bool found = array_size(w->results) > 0;
+    if (found) {
+        writer_result_t r = w->results[--array_header(w->results)->size];
+        *id = r.id;
+        *ok = r.ok;
+        w->num_pending--;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return found;
+}
+
+// Writes any queued frames, then stops the threads and frees the pool.
+static void image_writer_destroy(image_writer_t *w)
+{
+    if (!w->frames) return;
+
+    pthread_mutex_lock(&w->lock);
+    w->quit = true;
+    pthread_cond_broadcast(&w->task_ready);
+    pthread_mutex_unlock(&w->lock);
+    for (int i = 0; i < w->num_threads; i++)
+        pthread_join(w->threads[i], NULL);
+
+    for (int i = 0; i < w->num_frames; i++) {
+        writer_frame_t *f = &w->frames[i];
+        for (int j = 0; j < PNG_MAX_BANDS; j++)
+            png_band_free(&f->bands[j]);
+        free(f->pixels);
+        free(f->encoded);
+    }
+    free(w->frames);
+    free(w->free_frames);
+    free(w->tasks);
+    array_free(w->results);
+    pthread_cond_destroy(&w->frame_free);
+    pthread_cond_destroy(&w->task_ready);
+    pthread_mutex_destroy(&w->lock);
+    memset(w, 0, sizeof *w);
+}
+
+#endif